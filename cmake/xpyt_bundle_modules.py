@@ -0,0 +1,73 @@
+#############################################################################
+# Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and      # 
+# Wolf Vollprecht                                                           #
+# Copyright (c) 2018, QuantStack                                            #
+#                                                                           #
+# Distributed under the terms of the BSD 3-Clause License.                  #
+#                                                                           #
+# The full license is in the file LICENSE, distributed with this software.  #
+#############################################################################
+
+"""Packs the pure Python modules imported by the kernel at startup into a
+bundle of marshalled code objects, served from memory by the xpython
+executable instead of being looked up on the filesystem."""
+
+import argparse
+import importlib
+import importlib.machinery
+import importlib.util
+import marshal
+import os
+import sys
+
+
+def collect_modules(roots):
+    for root in roots:
+        importlib.import_module(root)
+
+    modules = {}
+    for name, module in sorted(sys.modules.items()):
+        spec = getattr(module, '__spec__', None)
+        if spec is None or not isinstance(spec.loader, importlib.machinery.SourceFileLoader):
+            continue
+        if not spec.origin or not spec.origin.endswith('.py'):
+            continue
+        code = spec.loader.get_code(name)
+        if code is None:
+            continue
+        is_package = spec.submodule_search_locations is not None
+        modules[name] = (is_package, spec.origin, marshal.dumps(code))
+    return modules
+
+
+def collect_fingerprints(modules):
+    # The source of each top-level module, checked at runtime to detect an
+    # update of the package or another copy earlier on the path
+    fingerprints = {}
+    for name, (is_package, origin, code) in modules.items():
+        if '.' in name:
+            continue
+        stat = os.stat(origin)
+        fingerprints[name] = (os.path.normcase(os.path.abspath(origin)), stat.st_mtime_ns, stat.st_size)
+    return fingerprints
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('output', help='path of the bundle')
+    parser.add_argument('modules', nargs='+', help='modules imported at startup, with their dependencies')
+    args = parser.parse_args()
+
+    modules = collect_modules(args.modules)
+    bundle = {
+        'magic': importlib.util.MAGIC_NUMBER,
+        'modules': modules,
+        'fingerprints': collect_fingerprints(modules)
+    }
+    with open(args.output, 'wb') as f:
+        marshal.dump(bundle, f)
+    print('Bundled {} modules in {}'.format(len(modules), args.output))
+
+
+if __name__ == '__main__':
+    main()
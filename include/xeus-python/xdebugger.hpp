@@ -11,9 +11,11 @@
 #ifndef XPYT_DEBUGGER_HPP
 #define XPYT_DEBUGGER_HPP
 
+#include <future>
 #include <map>
 #include <mutex>
 #include <set>
+#include <string>
 
 #include "zmq.hpp"
 #include "nlohmann/json.hpp"
@@ -45,7 +47,10 @@ namespace xpyt
         nl::json rich_inspect_variables_request(const nl::json& message);
         nl::json attach_request(const nl::json& message);
         nl::json configuration_done_request(const nl::json& message);
+        nl::json prefetched_request(const nl::json& message);
 
+        std::string debugpy_listen_code() const;
+        void prestart_debugpy();
         bool start_debugpy();
         bool start(zmq::socket_t& header_socket,
                    zmq::socket_t& request_socket) override;
@@ -58,6 +63,7 @@ namespace xpyt
         std::string m_debugpy_host;
         std::string m_debugpy_port;
         nl::json m_debugger_config;
+        std::future<bool> m_debugpy_prestart;
     };
 
     XEUS_PYTHON_API
@@ -0,0 +1,41 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_FORKSERVER_HPP
+#define XPYT_FORKSERVER_HPP
+
+#include <string>
+
+#include "xeus_python_config.hpp"
+#include "xinterpreter.hpp"
+
+namespace xpyt
+{
+    /**************
+     * forkserver *
+     **************/
+
+    // Configures the interpreter, then listens on the Unix socket socket_path
+    // and forks a child process for every client connection. This function
+    // only returns in the children, with the connection file sent by the
+    // client; the child is then expected to start a kernel with the
+    // interpreter. Throws std::runtime_error if the socket cannot be created
+    // or if forkservers are not supported on this platform.
+    XEUS_PYTHON_API
+    std::string run_forkserver(interpreter& interpreter, const std::string& socket_path);
+
+    // Asks the forkserver listening on socket_path to start a kernel, and
+    // forwards the signals received to it until it exits. Returns false if
+    // the forkserver could not start the kernel.
+    XEUS_PYTHON_API
+    bool connect_to_forkserver(const std::string& socket_path, const std::string& connection_filename);
+}
+
+#endif
@@ -0,0 +1,35 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_HISTORY_MANAGER_HPP
+#define XPYT_HISTORY_MANAGER_HPP
+
+#include <memory>
+
+#include "xeus/xhistory_manager.hpp"
+
+#include "xeus_python_config.hpp"
+
+namespace xpyt
+{
+    /*******************
+     * history manager *
+     *******************/
+
+    // Returns a history manager answering the history requests from the
+    // SQLite database of the IPython HistoryManager of the shell, so that the
+    // history survives restarts and agrees with %history. The inputs are
+    // stored by the shell when the cells run, the manager keeps no copy of
+    // them in memory.
+    XEUS_PYTHON_API
+    std::unique_ptr<xeus::xhistory_manager> make_python_history_manager();
+}
+
+#endif
@@ -76,6 +76,9 @@ namespace xpyt
 
         py::object m_ipython_shell_app;
         py::object m_ipython_shell;
+        py::object m_completer;
+        py::object m_token_at_cursor;
+        py::object m_inspect;
         py::object m_displayhook;
         py::object m_logger;
         py::object m_terminal_stream;
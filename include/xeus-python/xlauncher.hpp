@@ -0,0 +1,48 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_LAUNCHER_HPP
+#define XPYT_LAUNCHER_HPP
+
+#include <memory>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xkernel.hpp"
+#include "xeus/xlogger.hpp"
+
+#include "xeus_python_config.hpp"
+#include "xinterpreter.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /************
+     * launcher *
+     ************/
+
+    // Builds the kernel shared by the xpython executable and the Python
+    // extension. The sockets are bound from the connection file, or on
+    // random ports if connection_filename is empty.
+    XEUS_PYTHON_API
+    std::unique_ptr<xeus::xkernel> make_python_kernel(const std::string& connection_filename,
+                                                      std::unique_ptr<interpreter> interpreter,
+                                                      std::unique_ptr<xeus::xlogger> logger,
+                                                      nl::json debugger_config);
+
+    // Prints how to connect to the kernel, with the content of the
+    // connection file if the kernel was not started from one
+    XEUS_PYTHON_API
+    void print_startup_message(xeus::xkernel& kernel, const std::string& connection_filename);
+}
+
+#endif
@@ -0,0 +1,43 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_LOGGER_HPP
+#define XPYT_LOGGER_HPP
+
+#include <memory>
+#include <string>
+
+#include "xeus/xlogger.hpp"
+
+#include "xeus_python_config.hpp"
+
+namespace xpyt
+{
+    /**********
+     * logger *
+     **********/
+
+    // Loggers of the kernel messages writing through the asynchronous log
+    // sink of the kernel, the console and file writes being done by a
+    // background thread instead of the threads handling the messages. The
+    // file loggers share the log file of the sink, the last one created
+    // setting its path.
+
+    XEUS_PYTHON_API
+    std::unique_ptr<xeus::xlogger> make_async_console_logger(xeus::xlogger::level log_level,
+                                                             std::unique_ptr<xeus::xlogger> next = nullptr);
+
+    XEUS_PYTHON_API
+    std::unique_ptr<xeus::xlogger> make_async_file_logger(xeus::xlogger::level log_level,
+                                                          const std::string& file_name,
+                                                          std::unique_ptr<xeus::xlogger> next = nullptr);
+}
+
+#endif
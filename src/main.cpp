@@ -10,6 +10,8 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility>
 
@@ -22,17 +24,19 @@
 #endif
 
 #include "xeus/xkernel.hpp"
-#include "xeus/xkernel_configuration.hpp"
-#include "xeus/xserver.hpp"
 
 #include "pybind11/embed.h"
 #include "pybind11/pybind11.h"
 
 #include "xeus-python/xinterpreter.hpp"
-#include "xeus-python/xdebugger.hpp"
+#include "xeus-python/xforkserver.hpp"
+#include "xeus-python/xlauncher.hpp"
+#include "xeus-python/xlogger.hpp"
 #include "xeus-python/xpaths.hpp"
 #include "xeus-python/xeus_python_config.hpp"
 
+#include "xmodule_bundle.hpp"
+
 #ifdef __GNUC__
 void handler(int sig)
 {
@@ -62,6 +66,18 @@ bool should_print_version(int argc, char* argv[])
     return false;
 }
 
+bool has_flag(int argc, char* argv[], const std::string& flag)
+{
+    for (int i = 0; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == flag)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::string extract_filename(int argc, char* argv[])
 {
     std::string res = "";
@@ -81,6 +97,18 @@ std::string extract_filename(int argc, char* argv[])
     return res;
 }
 
+std::string extract_option(int argc, char* argv[], const std::string& option)
+{
+    for (int i = 0; i < argc - 1; ++i)
+    {
+        if (std::string(argv[i]) == option)
+        {
+            return argv[i + 1];
+        }
+    }
+    return "";
+}
+
 void print_pythonhome()
 {
     std::setlocale(LC_ALL, "en_US.utf8");
@@ -110,6 +138,19 @@ int main(int argc, char* argv[])
         std::clog.setstate(std::ios_base::failbit);
     }
 
+    // Starting the kernel in a process forked from a warm forkserver,
+    // which skips the initialization of the interpreter
+    std::string forkserver_client_path = extract_option(argc, argv, "--forkserver-connect");
+    if (!forkserver_client_path.empty())
+    {
+        std::string filename = extract_option(argc, argv, "-f");
+        if (!filename.empty() && xpyt::connect_to_forkserver(forkserver_client_path, filename))
+        {
+            return 0;
+        }
+        std::clog << "Falling back to a regular kernel startup" << std::endl;
+    }
+
     // Registering SIGSEGV handler
 #ifdef __GNUC__
     std::clog << "registering handler for SIGSEGV" << std::endl;
@@ -146,15 +187,34 @@ int main(int argc, char* argv[])
     }
     delete[] argw;
 
+    // Serving the modules imported at startup from the bundle spares their
+    // lookup on slow filesystems
+    if (xpyt::install_module_bundle(xpyt::get_module_bundle_path()))
+    {
+        std::clog << "Python modules served from " << xpyt::get_module_bundle_path() << std::endl;
+    }
+
     // Instantiating the xeus xinterpreter
     using interpreter_ptr = std::unique_ptr<xpyt::interpreter>;
     interpreter_ptr interpreter = interpreter_ptr(new xpyt::interpreter());
 
-    using history_manager_ptr = std::unique_ptr<xeus::xhistory_manager>;
-    history_manager_ptr hist = xeus::make_in_memory_history_manager();
-
     std::string connection_filename = extract_filename(argc, argv);
 
+    std::string forkserver_path = extract_option(argc, argv, "--forkserver");
+    if (!forkserver_path.empty())
+    {
+        try
+        {
+            // Only returns in the forked kernel processes
+            connection_filename = xpyt::run_forkserver(*interpreter, forkserver_path);
+        }
+        catch (std::runtime_error& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
 #ifdef XEUS_PYTHON_PYPI_WARNING
     std::clog <<
         "WARNING: this instance of xeus-python has been installed from a PyPI wheel.\n"
@@ -164,60 +224,21 @@ int main(int argc, char* argv[])
 
     nl::json debugger_config;
     debugger_config["python"] = executable;
+    debugger_config["prestart"] = has_flag(argc, argv, "--debugger-prestart");
 
+    std::unique_ptr<xeus::xlogger> logger = nullptr;
     if (!connection_filename.empty())
     {
-        xeus::xconfiguration config = xeus::load_configuration(connection_filename);
-
-        xeus::xkernel kernel(config,
-                             xeus::get_user_name(),
-                             std::move(interpreter),
-                             std::move(hist),
-                             xeus::make_console_logger(xeus::xlogger::msg_type,
-                                                       xeus::make_file_logger(xeus::xlogger::content, "xeus.log")),
-                             xeus::make_xserver_shell_main,
-                             xpyt::make_python_debugger,
-                             debugger_config);
-
-        std::clog <<
-            "Starting xeus-python kernel...\n\n"
-            "If you want to connect to this kernel from an other client, you can use"
-            " the " + connection_filename + " file."
-            << std::endl;
-
-        kernel.start();
-    }
-    else
-    {
-        xeus::xkernel kernel(xeus::get_user_name(),
-                             std::move(interpreter),
-                             std::move(hist),
-                             nullptr,
-                             xeus::make_xserver_shell_main,
-                             xpyt::make_python_debugger,
-                             debugger_config);
-
-        const auto& config = kernel.get_config();
-        std::clog <<
-            "Starting xeus-python kernel...\n\n"
-            "If you want to connect to this kernel from an other client, just copy"
-            " and paste the following content inside of a `kernel.json` file. And then run for example:\n\n"
-            "# jupyter console --existing kernel.json\n\n"
-            "kernel.json\n```\n{\n"
-            "    \"transport\": \"" + config.m_transport + "\",\n"
-            "    \"ip\": \"" + config.m_ip + "\",\n"
-            "    \"control_port\": " + config.m_control_port + ",\n"
-            "    \"shell_port\": " + config.m_shell_port + ",\n"
-            "    \"stdin_port\": " + config.m_stdin_port + ",\n"
-            "    \"iopub_port\": " + config.m_iopub_port + ",\n"
-            "    \"hb_port\": " + config.m_hb_port + ",\n"
-            "    \"signature_scheme\": \"" + config.m_signature_scheme + "\",\n"
-            "    \"key\": \"" + config.m_key + "\"\n"
-            "}\n```"
-            << std::endl;
-
-        kernel.start();
+        logger = xpyt::make_async_console_logger(xeus::xlogger::msg_type,
+                                                 xpyt::make_async_file_logger(xeus::xlogger::content, "xeus.log"));
     }
 
+    std::unique_ptr<xeus::xkernel> kernel = xpyt::make_python_kernel(connection_filename,
+                                                                     std::move(interpreter),
+                                                                     std::move(logger),
+                                                                     std::move(debugger_config));
+    xpyt::print_startup_message(*kernel, connection_filename);
+    kernel->start();
+
     return 0;
 }
@@ -0,0 +1,176 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "xeus/xsystem.hpp"
+
+#include "xcell_files.hpp"
+#include "xinternal_utils.hpp"
+
+namespace xpyt
+{
+    namespace
+    {
+        class xcell_files
+        {
+        public:
+
+            std::string filename(const std::string& code);
+            void set_lazy(bool enabled);
+            void materialize();
+            void wait();
+            void forget(const std::string& filename);
+
+        private:
+
+            using cell_list = std::vector<std::pair<std::string, std::string>>;
+
+            void write_files(cell_list cells);
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            // Sources of the cells named from the counter, by filename
+            std::map<std::string, std::string> m_sources;
+            std::size_t m_counter = 0;
+            bool m_lazy = false;
+            bool m_hashed = false;
+            bool m_writing = false;
+        };
+
+        std::string xcell_files::filename(const std::string& code)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_lazy && !m_hashed)
+                {
+                    std::string name = get_tmp_prefix() + "cell_" + std::to_string(++m_counter) + get_tmp_suffix();
+                    m_sources[name] = code;
+                    return name;
+                }
+            }
+            return get_cell_tmp_file(code);
+        }
+
+        void xcell_files::set_lazy(bool enabled)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lazy = enabled;
+        }
+
+        void xcell_files::materialize()
+        {
+            cell_list cells;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_hashed)
+                {
+                    return;
+                }
+                m_hashed = true;
+                if (m_sources.empty())
+                {
+                    return;
+                }
+                cells.assign(m_sources.begin(), m_sources.end());
+                m_sources.clear();
+                m_writing = true;
+            }
+            std::thread(&xcell_files::write_files, this, std::move(cells)).detach();
+        }
+
+        void xcell_files::wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return !m_writing; });
+        }
+
+        void xcell_files::forget(const std::string& filename)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sources.erase(filename);
+        }
+
+        void xcell_files::write_files(cell_list cells)
+        {
+            xeus::create_directory(get_tmp_prefix());
+            for (const auto& cell : cells)
+            {
+                const std::string& name = cell.first;
+                std::string hashed_name = get_cell_tmp_file(cell.second);
+                {
+                    std::ofstream out(hashed_name);
+                    out << cell.second;
+                }
+#ifndef _WIN32
+                // The debugger resolves the links, the breakpoints set in the
+                // hashed file apply to the code objects named from the counter
+                std::remove(name.c_str());
+                if (symlink(hashed_name.c_str(), name.c_str()) == 0)
+                {
+                    continue;
+                }
+#endif
+                std::ofstream out(name);
+                out << cell.second;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_writing = false;
+            }
+            m_cv.notify_all();
+        }
+
+        xcell_files& get_cell_files()
+        {
+            // Leaked, the previous cells may still be written during the exit
+            static xcell_files* files = new xcell_files();
+            return *files;
+        }
+    }
+
+    std::string get_cell_filename(const std::string& code)
+    {
+        return get_cell_files().filename(code);
+    }
+
+    void set_lazy_cell_filenames(bool enabled)
+    {
+        get_cell_files().set_lazy(enabled);
+    }
+
+    void materialize_cell_files()
+    {
+        get_cell_files().materialize();
+    }
+
+    void wait_for_cell_files()
+    {
+        get_cell_files().wait();
+    }
+
+    void forget_cell_file(const std::string& filename)
+    {
+        get_cell_files().forget(filename);
+    }
+}
@@ -0,0 +1,42 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_CELL_FILES_HPP
+#define XPYT_CELL_FILES_HPP
+
+#include <string>
+
+namespace xpyt
+{
+    /**************
+     * cell files *
+     **************/
+
+    // Name of the file of a cell, given to its code objects. It is computed
+    // from the hash of the content of the cell, as the frontend does for the
+    // breakpoints, unless the lazy filenames are enabled and the debugger
+    // has not been started yet, the name being made from a counter then.
+    std::string get_cell_filename(const std::string& code);
+
+    void set_lazy_cell_filenames(bool enabled);
+
+    // Switches to the hashed filenames and writes the cells named from the
+    // counter to their hashed files in a background thread, the counter
+    // files being links to them so that the breakpoints match.
+    void materialize_cell_files();
+
+    // Waits until the files of materialize_cell_files are written
+    void wait_for_cell_files();
+
+    // Called when the source of a cell is evicted
+    void forget_cell_file(const std::string& filename);
+}
+
+#endif
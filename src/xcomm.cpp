@@ -8,8 +8,11 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "nlohmann/json.hpp"
 
@@ -26,6 +29,7 @@
 
 #include "xcomm.hpp"
 #include "xinternal_utils.hpp"
+#include "xmetrics.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -34,7 +38,7 @@ namespace xpyt
 {
     /*********************
      * xcomm declaration *
-     ********************/
+     *********************/
 
     class xcomm
     {
@@ -52,8 +56,12 @@ namespace xpyt
         std::string comm_id() const;
         bool kernel() const;
 
+        bool batch() const;
+        void set_batch(bool batch);
+
         void close(const py::args& args, const py::kwargs& kwargs);
         void send(const py::args& args, const py::kwargs& kwargs);
+        void flush();
         void on_msg(const python_callback_type& callback);
         void on_close(const python_callback_type& callback);
 
@@ -64,6 +72,12 @@ namespace xpyt
         cpp_callback_type cpp_callback(const python_callback_type& callback) const;
 
         xeus::xcomm m_comm;
+
+        // State update waiting to be sent, only accessed with the GIL held
+        nl::json m_pending_metadata;
+        nl::json m_pending_data;
+        bool m_has_pending = false;
+        bool m_batch = true;
     };
 
     struct xcomm_manager
@@ -73,18 +87,93 @@ namespace xpyt
         void register_target(const py::str& target_name, const py::object& callback);
     };
 
+    /*****************
+     * comm batching *
+     *****************/
+
+    namespace
+    {
+        double& get_batch_interval()
+        {
+            static double interval = 0.;
+            return interval;
+        }
+
+        // Comms holding a state update waiting to be sent, only accessed
+        // with the GIL held.
+        std::vector<xcomm*>& get_pending_comms()
+        {
+            static std::vector<xcomm*> pending;
+            return pending;
+        }
+
+        bool is_state_update(const nl::json& data)
+        {
+            if (!data.is_object())
+            {
+                return false;
+            }
+            auto method = data.find("method");
+            auto state = data.find("state");
+            return method != data.end() && *method == "update"
+                && state != data.end() && state->is_object();
+        }
+
+        py::object get_kwarg(const py::kwargs& kwargs, const char* name, py::object default_value)
+        {
+            PyObject* value = PyDict_GetItemString(kwargs.ptr(), name);
+            return value != nullptr ? py::reinterpret_borrow<py::object>(value) : default_value;
+        }
+    }
+
+    void set_comm_batch_interval(double interval)
+    {
+        get_batch_interval() = interval;
+    }
+
+    void flush_comms()
+    {
+        std::vector<xcomm*> pending;
+        pending.swap(get_pending_comms());
+        // The publishing releases the GIL, the references keep the comms
+        // alive meanwhile
+        std::vector<py::object> comms;
+        comms.reserve(pending.size());
+        for (xcomm* comm : pending)
+        {
+            comms.push_back(py::cast(comm, py::return_value_policy::reference));
+        }
+        for (xcomm* comm : pending)
+        {
+            comm->flush();
+        }
+    }
+
+    namespace
+    {
+        // Sends the batched messages at the end of the batching window
+        xgil_timer& get_comm_flush_timer()
+        {
+            static xgil_timer* timer = new xgil_timer(&flush_comms);
+            return *timer;
+        }
+    }
+
     /************************
      * xcomm implementation *
      ************************/
 
     xcomm::xcomm(const py::args& /*args*/, const py::kwargs& kwargs)
         : m_comm(target(kwargs), id(kwargs))
+        , m_batch(get_kwarg(kwargs, "batch", py::bool_(true)).cast<bool>())
     {
-        m_comm.open(
-            kwargs.attr("get")("metadata", py::dict()),
-            kwargs.attr("get")("data", py::dict()),
-            pylist_to_zmq_buffers(kwargs.attr("get")("buffers", py::list()))
-        );
+        flush_comms();
+        nl::json metadata = get_kwarg(kwargs, "metadata", py::dict());
+        nl::json data = get_kwarg(kwargs, "data", py::dict());
+        auto buffers = pylist_to_zmq_buffers(get_kwarg(kwargs, "buffers", py::list()));
+
+        xpublish_guard guard;
+        m_comm.open(std::move(metadata), std::move(data), std::move(buffers));
     }
 
     xcomm::xcomm(xeus::xcomm&& comm)
@@ -94,6 +183,12 @@ namespace xpyt
 
     xcomm::~xcomm()
     {
+        if (m_has_pending)
+        {
+            auto& pending = get_pending_comms();
+            pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+            flush();
+        }
     }
 
     std::string xcomm::comm_id() const
@@ -106,22 +201,83 @@ namespace xpyt
         return true;
     }
 
+    bool xcomm::batch() const
+    {
+        return m_batch;
+    }
+
+    void xcomm::set_batch(bool batch)
+    {
+        m_batch = batch;
+        if (!batch)
+        {
+            flush();
+        }
+    }
+
     void xcomm::close(const py::args& /*args*/, const py::kwargs& kwargs)
     {
-        m_comm.close(
-            kwargs.attr("get")("metadata", py::dict()),
-            kwargs.attr("get")("data", py::dict()),
-            pylist_to_zmq_buffers(kwargs.attr("get")("buffers", py::list()))
-        );
+        flush_comms();
+        nl::json metadata = get_kwarg(kwargs, "metadata", py::dict());
+        nl::json data = get_kwarg(kwargs, "data", py::dict());
+        auto buffers = pylist_to_zmq_buffers(get_kwarg(kwargs, "buffers", py::list()));
+
+        xpublish_guard guard;
+        m_comm.close(std::move(metadata), std::move(data), std::move(buffers));
     }
 
     void xcomm::send(const py::args& /*args*/, const py::kwargs& kwargs)
     {
-        m_comm.send(
-            kwargs.attr("get")("metadata", py::dict()),
-            kwargs.attr("get")("data", py::dict()),
-            pylist_to_zmq_buffers(kwargs.attr("get")("buffers", py::list()))
-        );
+        nl::json metadata = get_kwarg(kwargs, "metadata", py::dict());
+        nl::json data = get_kwarg(kwargs, "data", py::dict());
+        py::object buffers = get_kwarg(kwargs, "buffers", py::list());
+
+        double interval = get_batch_interval();
+        if (interval > 0. && m_batch && py::len(buffers) == 0 && is_state_update(data))
+        {
+            if (m_has_pending && m_pending_metadata == metadata)
+            {
+                // Later values of the attributes replace the earlier ones
+                m_pending_data["state"].update(data["state"]);
+                return;
+            }
+
+            // The messages sent earlier must not be overtaken
+            flush_comms();
+            m_pending_metadata = std::move(metadata);
+            m_pending_data = std::move(data);
+            m_has_pending = true;
+            get_pending_comms().push_back(this);
+            get_comm_flush_timer().schedule(
+                std::chrono::duration_cast<xgil_timer::clock_type::duration>(std::chrono::duration<double>(interval))
+            );
+            return;
+        }
+
+        flush_comms();
+        xmetric_timer timer(xmetric::comm_send);
+        auto cpp_buffers = pylist_to_zmq_buffers(buffers);
+
+        xpublish_guard guard;
+        m_comm.send(std::move(metadata), std::move(data), std::move(cpp_buffers));
+    }
+
+    void xcomm::flush()
+    {
+        if (!m_has_pending)
+        {
+            return;
+        }
+        auto& pending = get_pending_comms();
+        pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+        m_has_pending = false;
+
+        xmetric_timer timer(xmetric::comm_send);
+        nl::json metadata = std::move(m_pending_metadata);
+        nl::json data = std::move(m_pending_data);
+
+        xpublish_guard guard;
+        m_comm.send(std::move(metadata), std::move(data), xeus::buffer_sequence());
     }
 
     void xcomm::on_msg(const python_callback_type& callback)
@@ -162,7 +318,8 @@ namespace xpyt
 
     void xcomm_manager::register_target(const py::str& target_name, const py::object& callback)
     {
-        auto target_callback = [&callback] (xeus::xcomm&& comm, const xeus::xmessage& msg) {
+        // The callback is copied while the GIL is held, it must outlive this call
+        auto target_callback = [callback] (xeus::xcomm&& comm, const xeus::xmessage& msg) {
             XPYT_HOLDING_GIL(callback(xcomm(std::move(comm)), cppmessage_to_pymessage(msg)));
         };
 
@@ -183,15 +340,22 @@ namespace xpyt
             .def(py::init<py::args, py::kwargs>())
             .def("close", &xcomm::close)
             .def("send", &xcomm::send)
+            .def("flush", &xcomm::flush)
             .def("on_msg", &xcomm::on_msg)
             .def("on_close", &xcomm::on_close)
             .def_property_readonly("comm_id", &xcomm::comm_id)
-            .def_property_readonly("kernel", &xcomm::kernel);
+            .def_property_readonly("kernel", &xcomm::kernel)
+            .def_property("batch", &xcomm::batch, &xcomm::set_batch);
 
         py::class_<xcomm_manager>(comm_module, "CommManager")
             .def(py::init<>())
             .def("register_target", &xcomm_manager::register_target);
 
+        comm_module.def("set_batch_interval", &set_comm_batch_interval, py::arg("interval"));
+        comm_module.def("flush_comms", &flush_comms);
+
+        register_zmq_buffer_type(comm_module);
+
         return comm_module;
     }
 
@@ -18,6 +18,10 @@ namespace py = pybind11;
 namespace xpyt
 {
     py::module get_comm_module();
+
+    // Sends the comm state updates waiting in the batching window. Must be
+    // called with the GIL held.
+    void flush_comms();
 }
 
 #endif
@@ -22,6 +22,7 @@
 
 #include "xeus-python/xutils.hpp"
 
+#include "xcell_files.hpp"
 #include "xcompiler.hpp"
 #include "xinternal_utils.hpp"
 
@@ -33,7 +34,7 @@ namespace xpyt
 
     py::str get_filename(const py::str& raw_code)
     {
-        return get_cell_tmp_file(raw_code);
+        return get_cell_filename(raw_code);
     }
 
     /*******************
@@ -45,8 +46,13 @@ namespace xpyt
         py::module compiler_module = create_module("compiler");
 
         compiler_module.def("get_filename", get_filename);
+        compiler_module.def("forget_cell_file", forget_cell_file);
+        compiler_module.def("set_lazy_filenames", set_lazy_cell_filenames);
 
         ::xpyt::exec(py::str(R"(
+import linecache
+import os
+
 from IPython.core.compilerop import CachingCompiler
 
 class XCachingCompiler(CachingCompiler):
@@ -59,9 +65,21 @@ class XCachingCompiler(CachingCompiler):
         filename = get_filename(raw_code)
 
         if self.filename_mapper is not None:
-            self.filename_mapper(filename, number)
+            for evicted in self.filename_mapper(filename, number):
+                self._forget_cell(evicted)
 
         return filename
+
+    def _forget_cell(self, filename):
+        forget_cell_file(filename)
+        linecache.cache.pop(filename, None)
+        getattr(linecache, '_ipython_cache', {}).pop(filename, None)
+        getattr(self, '_filename_map', {}).pop(filename, None)
+        # Dumped by the debugger
+        try:
+            os.remove(filename)
+        except OSError:
+            pass
          )"), compiler_module.attr("__dict__"));
 
         return compiler_module;
@@ -0,0 +1,111 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include "pybind11/pybind11.h"
+
+#include "xeus-python/xutils.hpp"
+
+#include "xcompleter.hpp"
+#include "xinternal_utils.hpp"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /********************
+     * completer module *
+     ********************/
+
+    py::module get_completer_module_impl()
+    {
+        py::module completer_module = create_module("completer");
+
+        exec(py::str(R"(
+import time
+
+from IPython.core.completer import provisionalcompleter, rectify_completions
+from traitlets import Any, Float
+from traitlets.config import Configurable
+
+
+def _is_identifier_part(text):
+    return all(c.isalnum() or c == '_' for c in text)
+
+
+class XCompleter(Configurable):
+    """Answers complete requests, reusing the previous result when the
+    user keeps typing the same identifier."""
+
+    cache_lifetime = Float(2.0, config=True, help=
+        """Time in seconds during which a completion result can be filtered
+        to answer the next requests. Set to 0 to disable the cache."""
+    )
+
+    shell = Any()
+
+    def __init__(self, **kwargs):
+        super(XCompleter, self).__init__(**kwargs)
+        self._last = None
+
+    def complete(self, code, cursor_pos):
+        execution_count = self.shell.execution_count
+        now = time.monotonic()
+
+        result = self._complete_from_cache(code, cursor_pos, execution_count, now)
+        if result is not None:
+            return result
+
+        with provisionalcompleter():
+            raw_completions = self.shell.Completer.completions(code, cursor_pos)
+            completions = list(rectify_completions(code, raw_completions))
+
+        if completions:
+            cursor_start = completions[0].start
+            cursor_end = completions[0].end
+            matches = [c.text for c in completions]
+        else:
+            cursor_start = cursor_pos
+            cursor_end = cursor_pos
+            matches = []
+
+        self._last = (code, cursor_pos, execution_count, now, matches, cursor_start, cursor_end)
+        return matches, cursor_start, cursor_end
+
+    def _complete_from_cache(self, code, cursor_pos, execution_count, now):
+        if self._last is None:
+            return None
+
+        last_code, last_pos, last_count, last_time, matches, cursor_start, cursor_end = self._last
+        if (now - last_time > self.cache_lifetime or execution_count != last_count
+                or not matches or cursor_end != last_pos or cursor_pos < last_pos):
+            return None
+
+        # Only the characters typed at the cursor may differ from the cached request
+        if code[:last_pos] != last_code[:last_pos] or code[cursor_pos:] != last_code[last_pos:]:
+            return None
+        if not _is_identifier_part(code[last_pos:cursor_pos]):
+            return None
+
+        prefix = code[cursor_start:cursor_pos]
+        filtered = [m for m in matches if m.startswith(prefix)]
+        if not filtered:
+            return None
+        return filtered, cursor_start, cursor_pos
+        )"), completer_module.attr("__dict__"));
+
+        return completer_module;
+    }
+
+    py::module get_completer_module()
+    {
+        static py::module completer_module = get_completer_module_impl();
+        return completer_module;
+    }
+}
@@ -8,11 +8,14 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <atomic>
 #include <cctype>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <string>
 #include <thread>
+#include <unordered_set>
 
 // This must be included BEFORE pybind
 // otherwise it fails to build on Windows
@@ -22,6 +25,7 @@
 #include "pybind11_json/pybind11_json.hpp"
 
 #include "pybind11/pybind11.h"
+#include "pybind11/eval.h"
 #include "pybind11/stl.h"
 
 #include "xeus/xinterpreter.hpp"
@@ -29,9 +33,13 @@
 #include "xeus/xsystem.hpp"
 
 #include "xeus-python/xdebugger.hpp"
+#include "xeus-python/xtraceback.hpp"
 #include "xeus-python/xutils.hpp"
+#include "xcell_files.hpp"
 #include "xdebugpy_client.hpp"
+#include "xfilename_registry.hpp"
 #include "xinternal_utils.hpp"
+#include "xrich_inspect.hpp"
 
 namespace nl = nlohmann;
 namespace py = pybind11;
@@ -41,6 +49,71 @@ using namespace std::placeholders;
 
 namespace xpyt
 {
+    namespace
+    {
+        /******************************
+         * lazy variables references *
+         ******************************/
+
+        // Containers whose children can be requested, a variablesReference
+        // being its index in the list plus one. Reset by every inspection of
+        // the global namespace, and released when the threads stop or
+        // continue, since the references are only valid during a stop.
+        struct xvariable_references
+        {
+            py::list m_objects;
+            std::size_t m_generation = 0;
+        };
+
+        std::atomic<std::size_t>& get_references_generation()
+        {
+            static std::atomic<std::size_t> generation(0);
+            return generation;
+        }
+
+        // Must be called with the GIL held
+        py::list& get_variable_references()
+        {
+            // Intentionally leaked, the objects must not be
+            // released after the finalization of the interpreter
+            static xvariable_references* references = new xvariable_references();
+            std::size_t generation = get_references_generation().load();
+            if (references->m_generation != generation)
+            {
+                references->m_objects = py::list();
+                references->m_generation = generation;
+            }
+            return references->m_objects;
+        }
+
+        void release_variable_references()
+        {
+            get_variable_references();
+        }
+
+        xgil_timer& get_references_release_timer()
+        {
+            static xgil_timer* timer = new xgil_timer(&release_variable_references);
+            return *timer;
+        }
+
+        // The events are received by the thread of the debugpy client, which
+        // does not hold the GIL: the references are released by a timer thread
+        xdebugpy_client::event_callback release_references_on_events(xdebugpy_client::event_callback callback)
+        {
+            return [callback](const nl::json& message)
+            {
+                std::string event = message.value("event", "");
+                if (event == "stopped" || event == "continued")
+                {
+                    ++get_references_generation();
+                    get_references_release_timer().schedule(xgil_timer::clock_type::duration::zero());
+                }
+                callback(message);
+            };
+        }
+    }
+
     debugger::debugger(zmq::context_t& context,
                        const xeus::xconfiguration& config,
                        const std::string& user_name,
@@ -54,7 +127,7 @@ namespace xpyt
                                                                       xeus::dap_init_type::parallel,
                                                                       user_name,
                                                                       session_id),
-                                               get_event_callback()))
+                                               release_references_on_events(get_event_callback())))
         , m_debugpy_host("127.0.0.1")
         , m_debugpy_port("")
         , m_debugger_config(debugger_config)
@@ -64,6 +137,14 @@ namespace xpyt
         register_request_handler("richInspectVariables", std::bind(&debugger::rich_inspect_variables_request, this, _1), false);
         register_request_handler("attach", std::bind(&debugger::attach_request, this, _1), true);
         register_request_handler("configurationDone", std::bind(&debugger::configuration_done_request, this, _1), true);
+        register_request_handler("scopes", std::bind(&debugger::prefetched_request, this, _1), true);
+        register_request_handler("variables", std::bind(&debugger::prefetched_request, this, _1), true);
+
+        auto it = m_debugger_config.find("prestart");
+        if (it != m_debugger_config.end() && it->get<bool>())
+        {
+            prestart_debugpy();
+        }
     }
 
     debugger::~debugger()
@@ -74,11 +155,11 @@ namespace xpyt
 
     namespace
     {
-        using name_list = std::vector<std::string>;
+        using name_set = std::unordered_set<std::string>;
 
-        const name_list& get_excluded_variables()
+        const name_set& get_excluded_variables()
         {
-            static name_list l =
+            static name_set l =
             { 
                 "__name__",
                 "__doc__",
@@ -106,41 +187,235 @@ namespace xpyt
 
         bool keep_variable(const std::string& var_name)
         {
-            const name_list& l = get_excluded_variables();
+            const name_set& l = get_excluded_variables();
             bool res = var_name.substr(0u, 2u) != "_i";
             res = res && !(var_name[0] == '_' && std::isdigit(var_name[1]));
-            res = res && std::find(l.cbegin(), l.cend(), var_name) == l.cend();
+            res = res && l.find(var_name) == l.cend();
             return res;
         }
+
+        std::string get_type_name(const py::handle& value)
+        {
+            // Strips "<class '" and "'>"
+            std::string var_type = py::str(value.get_type());
+            size_t size = var_type.size();
+            return var_type.substr(size_t(8), size - 10u);
+        }
+
+        /*****************************
+         * lazy variables inspection *
+         *****************************/
+
+        py::object get_shell_option(const char* name)
+        {
+            return py::module::import("IPython").attr("get_ipython")().attr(name);
+        }
+
+        // Returns a reprlib.Repr instance limiting strings and objects to max_size
+        py::object make_repr(std::size_t max_size)
+        {
+            py::object repr_obj = py::module::import("reprlib").attr("Repr")();
+            repr_obj.attr("maxstring") = max_size;
+            repr_obj.attr("maxother") = max_size;
+            return repr_obj.attr("repr");
+        }
+
+        std::string truncated_repr(const py::handle& value, const py::object& repr, std::size_t max_size)
+        {
+            std::string res;
+            try
+            {
+                res = py::str(repr(value));
+            }
+            catch (py::error_already_set& e)
+            {
+                res = "<repr failed: " + std::string(py::str(e.value())) + ">";
+            }
+            if (res.size() > max_size)
+            {
+                res = res.substr(0, max_size > 3 ? max_size - 3 : 0) + "...";
+            }
+            return res;
+        }
+
+        // Returns the mapping of the named children of value, or None
+        py::object get_named_children(const py::handle& value)
+        {
+            if (py::isinstance<py::dict>(value))
+            {
+                return py::reinterpret_borrow<py::object>(value);
+            }
+            if (py::isinstance<py::list>(value) || py::isinstance<py::tuple>(value) || py::isinstance<py::set>(value)
+                || PyFrozenSet_Check(value.ptr()) || PyModule_Check(value.ptr()) || PyType_Check(value.ptr()))
+            {
+                return py::none();
+            }
+            if (py::hasattr(value, "__dict__"))
+            {
+                py::object attributes = value.attr("__dict__");
+                if (py::isinstance<py::dict>(attributes) && py::len(attributes) != 0)
+                {
+                    return attributes;
+                }
+            }
+            return py::none();
+        }
+
+        bool has_indexed_children(const py::handle& value)
+        {
+            return py::isinstance<py::list>(value) || py::isinstance<py::tuple>(value)
+                || py::isinstance<py::set>(value) || PyFrozenSet_Check(value.ptr());
+        }
+
+        nl::json describe_variable(const std::string& name,
+                                   const py::handle& value,
+                                   const py::object& repr,
+                                   std::size_t repr_size)
+        {
+            nl::json json_var = nl::json::object();
+            json_var["name"] = name;
+            json_var["type"] = get_type_name(value);
+            json_var["value"] = truncated_repr(value, repr, repr_size);
+            json_var["variablesReference"] = 0;
+
+            if (py::hasattr(value, "shape") && !PyType_Check(value.ptr()))
+            {
+                try
+                {
+                    json_var["shape"] = std::string(py::str(value.attr("shape")));
+                }
+                catch (py::error_already_set&)
+                {
+                }
+            }
+            else if (py::hasattr(value, "__len__") && !PyType_Check(value.ptr()))
+            {
+                Py_ssize_t length = PyObject_Length(value.ptr());
+                if (length >= 0)
+                {
+                    json_var["length"] = length;
+                }
+                else
+                {
+                    PyErr_Clear();
+                }
+            }
+
+            py::object named = get_named_children(value);
+            bool indexed = has_indexed_children(value);
+            if (indexed || !named.is_none())
+            {
+                py::list& references = get_variable_references();
+                references.append(value);
+                json_var["variablesReference"] = py::len(references);
+                if (indexed)
+                {
+                    json_var["indexedVariables"] = py::len(value);
+                }
+                else
+                {
+                    json_var["namedVariables"] = py::len(named);
+                }
+            }
+            return json_var;
+        }
+
+        nl::json inspect_children(const py::handle& value,
+                                  std::size_t start,
+                                  std::size_t count,
+                                  const py::object& repr,
+                                  std::size_t repr_size)
+        {
+            nl::json json_vars = nl::json::array();
+            py::object islice = py::module::import("itertools").attr("islice");
+            py::object stop = count == 0 ? py::object(py::none()) : py::object(py::int_(start + count));
+
+            py::object named = get_named_children(value);
+            if (!named.is_none())
+            {
+                bool is_dict = py::isinstance<py::dict>(value);
+                for (py::handle item : islice(named.attr("items")(), start, stop))
+                {
+                    py::tuple pair = py::reinterpret_borrow<py::tuple>(item);
+                    std::string name = is_dict ? std::string(py::repr(pair[0])) : std::string(py::str(pair[0]));
+                    json_vars.push_back(describe_variable(name, pair[1], repr, repr_size));
+                }
+            }
+            else
+            {
+                std::size_t index = start;
+                for (py::handle item : islice(value, start, stop))
+                {
+                    json_vars.push_back(describe_variable(std::to_string(index++), item, repr, repr_size));
+                }
+            }
+            return json_vars;
+        }
     }
 
     nl::json debugger::inspect_variables_request(const nl::json& message)
     {
         py::gil_scoped_acquire acquire;
-        py::object variables = py::globals();
+
+        nl::json arguments = message.value("arguments", nl::json::object());
+        std::size_t reference = arguments.value("variablesReference", std::size_t(0));
+        std::size_t start = arguments.value("start", std::size_t(0));
+        std::size_t count = arguments.value("count", std::size_t(0));
+
+        bool lazy = reference != 0 || get_shell_option("debugger_lazy_variables").cast<bool>();
+        std::size_t repr_size = lazy ? get_shell_option("debugger_variable_repr_size").cast<std::size_t>() : 0;
+        py::object repr = lazy ? make_repr(repr_size) : py::object(py::none());
 
         nl::json json_vars = nl::json::array();
-        for (const py::handle& key : variables)
+        if (reference != 0)
         {
-            nl::json json_var = nl::json::object();
-            std::string var_name = py::str(key);
-            if (keep_variable(var_name))
+            py::list& references = get_variable_references();
+            if (reference <= py::len(references))
             {
-                json_var["name"] = var_name;
-                json_var["variablesReference"] = 0;
-                try
+                json_vars = inspect_children(py::object(references[reference - 1]), start, count, repr, repr_size);
+            }
+        }
+        else
+        {
+            py::object variables = py::globals();
+            if (lazy)
+            {
+                get_variable_references() = py::list();
+            }
+
+            std::size_t index = 0;
+            for (const py::handle& key : variables)
+            {
+                std::string var_name = py::str(key);
+                if (!keep_variable(var_name))
+                {
+                    continue;
+                }
+                if (lazy)
                 {
-                    json_var["value"] = variables[key];
+                    // Pages of the global namespace
+                    if (index++ < start || (count != 0 && index > start + count))
+                    {
+                        continue;
+                    }
+                    json_vars.push_back(describe_variable(var_name, py::object(variables[key]), repr, repr_size));
                 }
-                catch(std::exception&)
+                else
                 {
-                    json_var["value"] = py::repr(variables[key]);
+                    nl::json json_var = nl::json::object();
+                    json_var["name"] = var_name;
+                    json_var["variablesReference"] = 0;
+                    try
+                    {
+                        json_var["value"] = variables[key];
+                    }
+                    catch(std::exception&)
+                    {
+                        json_var["value"] = py::repr(variables[key]);
+                    }
+                    json_var["type"] = get_type_name(variables[key]);
+                    json_vars.push_back(json_var);
                 }
-                std::string var_type = py::str(variables[key].get_type());
-                size_t size = var_type.size();
-                std::string var_trunc_type = var_type.substr(size_t(8), size - 10u);
-                json_var["type"] = var_trunc_type;
-                json_vars.push_back(json_var);
             }
         }
 
@@ -159,67 +434,67 @@ namespace xpyt
 
     nl::json debugger::rich_inspect_variables_request(const nl::json& message)
     {
-
-
         std::string var_name = message["arguments"]["variableName"].get<std::string>();
-        std::string var_repr_data = var_name + "_repr_data";
-        std::string var_repr_metadata = var_name + "_repr_metada";
 
+        nl::json reply = {
+            {"type", "response"},
+            {"request_seq", message["seq"]},
+            {"success", false},
+            {"command", message["command"]}
+        };
+
+        nl::json body;
         if (base_type::get_stopped_threads().empty())
         {
-            // The code did not hit a breakpoint, we use the interpreter 
-            // to get the rich reprensentation of the variable
-            std::string code = "from IPython import get_ipython;";
-            code += var_repr_data + ',' + var_repr_metadata + "= get_ipython().display_formatter.format(" + var_name + ")";
+            // The code did not hit a breakpoint, the variable is formatted
+            // from the namespace of the shell, without running the shell
             py::gil_scoped_acquire acquire;
-            exec(py::str(code));
+            try
+            {
+                py::object user_ns = py::module::import("IPython.core.getipython").attr("get_ipython")().attr("user_ns");
+                py::object value = py::eval(py::str(var_name), user_ns);
+                body = rich_inspect_variable(var_name, value);
+            }
+            catch (py::error_already_set& e)
+            {
+                reply["message"] = e.what();
+                return reply;
+            }
         }
         else
-        {   
-            // The code has stopped on a breakpoint, we use the setExpression request
-            // to get the rich representation of the variable
-            std::string lvalue = var_repr_data + ',' + var_repr_metadata;
-            std::string code = "get_ipython().display_formatter.format(" + var_name + ")";
+        {
+            // The code has stopped on a breakpoint, the variable is evaluated
+            // in the frame and stores its representation for the debugger
+            std::string token = std::to_string(message["seq"].get<int>());
+            std::string expression = "__import__('xeus_python')._store_rich_inspection("
+                + nl::json(token).dump() + ", " + nl::json(var_name).dump() + ", " + var_name + ")";
             int frame_id = message["arguments"]["frameId"].get<int>();
             int seq = message["seq"].get<int>();
             nl::json request = {
                 {"type", "request"},
-                {"command", "setExpression"},
+                {"command", "evaluate"},
                 {"seq", seq+1},
                 {"arguments", {
-                    {"expression", lvalue},
-                    {"value", code},
-                    {"frameId", frame_id}
+                    {"expression", expression},
+                    {"frameId", frame_id},
+                    {"context", "repl"}
                 }}
             };
-            forward_message(request);
-        }
-
-        nl::json reply = {
-            {"type", "response"},
-            {"request_seq", message["seq"]},
-            {"success", false},
-            {"command", message["command"]}
-        };
+            nl::json response = forward_message(request);
 
-        py::gil_scoped_acquire acquire;
-        py::object variables = py::globals();
-        py::object repr_data = variables[py::str(var_repr_data)];
-        py::object repr_metadata = variables[py::str(var_repr_metadata)];
-        nl::json body = {
-            {"data", {}},
-            {"metadata", {}}
-        };
-        for (const py::handle& key : repr_data)
-        {
-            std::string data_key = py::str(key);
-            body["data"][data_key] = repr_data[key];
-            if (repr_metadata.contains(key))
+            py::gil_scoped_acquire acquire;
+            body = pop_rich_inspection(token);
+            if (body.is_null())
             {
-                body["metadata"][data_key] = repr_metadata[key];
+                if (response.contains("message"))
+                {
+                    reply["message"] = response["message"];
+                }
+                return reply;
             }
         }
-        reply["body"] = body;
+
+        reply["body"] = std::move(body);
         reply["success"] = true;
         return reply;
     }
@@ -248,39 +523,142 @@ namespace xpyt
         return reply;
     }
 
-    bool debugger::start_debugpy()
+    nl::json debugger::prefetched_request(const nl::json& message)
+    {
+        // Answered from the responses fetched by the client when the thread
+        // stopped, if the frontend asks for the same ones
+        nl::json reply = p_debugpy_client->get_prefetched_response(message);
+        if (reply.is_null())
+        {
+            return forward_message(message);
+        }
+        return reply;
+    }
+
+    namespace
+    {
+        void log_debugpy_error(const std::string& ename,
+                               const std::string& evalue,
+                               const std::vector<std::string>& traceback)
+        {
+            std::clog << "Exception raised when trying to import debugpy" << std::endl;
+            for(std::size_t i = 0; i < traceback.size(); ++i)
+            {
+                std::clog << traceback[i] << std::endl;
+            }
+            std::clog << ename << " - " << evalue << std::endl;
+        }
+
+        // Whether the frontends set breakpoints in the file, from the global
+        // debugger of pydevd running in the kernel: the setBreakpoints
+        // requests are handled by xeus. Called with the GIL held.
+        bool has_breakpoints(const std::string& filename)
+        {
+            try
+            {
+                py::object pydevd = py::module::import("sys").attr("modules").attr("get")("pydevd");
+                py::object py_db = pydevd.is_none() ? py::object(py::none()) : pydevd.attr("get_global_debugger")();
+                if (py_db.is_none())
+                {
+                    return false;
+                }
+                // The frontends set the breakpoints in the hashed files,
+                // the counter names of the cells being linked to them
+                py::object realpath = py::module::import("os.path").attr("realpath");
+                py::object path = realpath(filename);
+                for (auto item : py::dict(py_db.attr("breakpoints")))
+                {
+                    if (py::len(item.second) != 0 && realpath(item.first).equal(path))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            catch (py::error_already_set&)
+            {
+                // Rather kept than losing the source of a breakpoint
+                return true;
+            }
+        }
+
+        // Runs the code in a thread, which only takes the GIL once the
+        // interpreter has released it
+        std::future<bool> exec_in_background(std::string code)
+        {
+            std::packaged_task<bool()> task([code = std::move(code)]() {
+                if (!Py_IsInitialized())
+                {
+                    return false;
+                }
+                py::gil_scoped_acquire acquire;
+                try
+                {
+                    py::dict scope;
+                    scope["__builtins__"] = py::module::import("builtins");
+                    py::exec(py::str(code), scope);
+                    return true;
+                }
+                catch (py::error_already_set& e)
+                {
+                    xerror error = extract_error(e);
+                    log_debugpy_error(error.m_ename, error.m_evalue, error.m_traceback);
+                    return false;
+                }
+            });
+            std::future<bool> result = task.get_future();
+            std::thread(std::move(task)).detach();
+            return result;
+        }
+    }
+
+    std::string debugger::debugpy_listen_code() const
     {
         // import debugpy
         std::string code = "import debugpy;";
         // specify sys.executable
+        auto it = m_debugger_config.find("python");
+        if (it != m_debugger_config.end())
+        {
+            code += "debugpy.configure({\'python\': r\'" + it->template get<std::string>()  + "\'});";
+        }
+        // call to debugpy.listen
+        code += "debugpy.listen((\'" + m_debugpy_host + "\'," + m_debugpy_port + "))";
+        return code;
+    }
+
+    void debugger::prestart_debugpy()
+    {
+        // debugpy and pydevd are imported by the time the frontend starts the
+        // debugger. debugpy.listen is deferred until then, since it turns on
+        // the tracing of the code, which slows down the execution of the cells.
+        m_debugpy_prestart = exec_in_background("import debugpy; import debugpy.server.api");
+    }
+
+    bool debugger::start_debugpy()
+    {
         if (std::getenv("XEUS_LOG") != nullptr)
         {
             std::ofstream out("xeus.log", std::ios_base::app);
             out << "===== DEBUGGER CONFIG =====" << std::endl;
             out << m_debugger_config.dump() << std::endl;
         }
-        auto it = m_debugger_config.find("python");
-        if (it != m_debugger_config.end())
+
+        if (m_debugpy_prestart.valid())
         {
-            code += "debugpy.configure({\'python\': r\'" + it->template get<std::string>()  + "\'});";
+            // Without going through the shell, which may be running a cell
+            return m_debugpy_prestart.get() && exec_in_background(debugpy_listen_code()).get();
         }
-        // call to debugpy.listen
-        code += "debugpy.listen((\'" + m_debugpy_host + "\'," + m_debugpy_port + "))";
+
         nl::json json_code;
-        json_code["code"] = code;
+        json_code["code"] = debugpy_listen_code();
         nl::json rep = xdebugger::get_control_messenger().send_to_shell(json_code);
         std::string status = rep["status"].get<std::string>();
         if(status != "ok")
         {
-            std::string ename = rep["ename"].get<std::string>();
-            std::string evalue = rep["evalue"].get<std::string>();
-            std::vector<std::string> traceback = rep["traceback"].get<std::vector<std::string>>();
-            std::clog << "Exception raised when trying to import debugpy" << std::endl;
-            for(std::size_t i = 0; i < traceback.size(); ++i)
-            {
-                std::clog << traceback[i] << std::endl;
-            }
-            std::clog << ename << " - " << evalue << std::endl;
+            log_debugpy_error(rep["ename"].get<std::string>(),
+                              rep["evalue"].get<std::string>(),
+                              rep["traceback"].get<std::vector<std::string>>());
         }
         return status == "ok";
     }
@@ -321,6 +699,14 @@ namespace xpyt
         std::string tmp_folder =  get_tmp_prefix();
         xeus::create_directory(tmp_folder);
 
+        // The cells run before are written in the background, and the new
+        // ones are named from the hash of their content
+        materialize_cell_files();
+
+        // The cells in which breakpoints are set keep their sources while
+        // the debugger is running, until their breakpoints are cleared
+        set_filename_mapping_pinned(&has_breakpoints);
+
         return true;
     }
 
@@ -330,6 +716,8 @@ namespace xpyt
         std::string controller_header_end_point = xeus::get_controller_end_point("debugger_header");
         request_socket.unbind(controller_end_point);
         header_socket.unbind(controller_header_end_point);
+
+        set_filename_mapping_pinned(nullptr);
     }
 
     xeus::xdebugger_info debugger::get_debugger_info() const
@@ -343,6 +731,10 @@ namespace xpyt
 
     std::string debugger::get_cell_temporary_file(const std::string& code) const
     {
+        // Called for the dumpCell requests, the breakpoints set in the
+        // file must apply to the cells run before the debugger started
+        materialize_cell_files();
+        wait_for_cell_files();
         return get_cell_tmp_file(code);
     }
 
@@ -12,14 +12,28 @@
 #include "nlohmann/json.hpp"
 #include "xeus/xmessage.hpp"
 #include "xdebugpy_client.hpp"
+#include "xrich_inspect.hpp"
 
-#include <thread>
 #include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace nl = nlohmann;
 
 namespace xpyt
 {
+    namespace
+    {
+        std::string prefetch_key(const nl::json& request)
+        {
+            return request["command"].get<std::string>() + request["arguments"].dump();
+        }
+    }
+
     xdebugpy_client::xdebugpy_client(zmq::context_t& context,
                                      const xeus::xconfiguration& config,
                                      int socket_linger,
@@ -29,29 +43,203 @@ namespace xpyt
     {
     }
 
+    nl::json xdebugpy_client::get_prefetched_response(const nl::json& request)
+    {
+        if (!request.contains("arguments"))
+        {
+            return nl::json();
+        }
+
+        // The requests of the frontend can arrive before the end of the
+        // prefetch, the stopped event being forwarded first
+        std::unique_lock<std::mutex> lock(m_prefetch_mutex);
+        m_prefetch_cv.wait_for(lock, std::chrono::seconds(5), [this]() { return !m_prefetching; });
+        auto it = m_prefetched.find(prefetch_key(request));
+        if (it == m_prefetched.end())
+        {
+            return nl::json();
+        }
+        nl::json response = std::move(it->second);
+        m_prefetched.erase(it);
+        response["request_seq"] = request["seq"];
+        return response;
+    }
+
     void xdebugpy_client::handle_event(nl::json message)
     {
+        const std::string& event = message["event"].get_ref<const std::string&>();
+        if (event == "stopped")
+        {
+            invalidate_rich_inspect_cache();
+            set_all_threads_stopped(message["body"].value("allThreadsStopped", false));
+            {
+                std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+                m_prefetched.clear();
+                m_prefetching = true;
+            }
+            nl::json stopped_event = message;
+            forward_event(std::move(message));
+            prefetch_stopped_state(stopped_event);
+            {
+                std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+                m_prefetching = false;
+            }
+            m_prefetch_cv.notify_all();
+            return;
+        }
+        else if (event == "continued")
+        {
+            invalidate_rich_inspect_cache();
+            set_all_threads_stopped(false);
+            clear_prefetched_responses();
+        }
         forward_event(std::move(message));
     }
 
-    nl::json xdebugpy_client::get_stack_frames(int thread_id, int seq)
+    std::vector<nl::json> xdebugpy_client::send_dap_requests(std::vector<nl::json> requests)
     {
-        nl::json request = {
+        std::map<int, std::size_t> pending;
+        for (std::size_t i = 0; i < requests.size(); ++i)
+        {
+            pending[requests[i]["seq"].get<int>()] = i;
+            send_dap_request(std::move(requests[i]));
+        }
+
+        std::vector<nl::json> responses(requests.size());
+        while (!pending.empty())
+        {
+            nl::json response = wait_for_message([&pending](const nl::json& message)
+            {
+                return message["type"] == "response"
+                    && message.contains("request_seq")
+                    && pending.count(message["request_seq"].get<int>()) != 0;
+            });
+            auto it = pending.find(response["request_seq"].get<int>());
+            responses[it->second] = std::move(response);
+            pending.erase(it);
+        }
+        return responses;
+    }
+
+    nl::json xdebugpy_client::make_request(const std::string& command, nl::json arguments)
+    {
+        return {
             {"type", "request"},
-            {"seq", seq},
-            {"command", "stackTrace"},
-            {"arguments", {
-                {"threadId", thread_id}
-            }}
+            {"seq", m_seq++},
+            {"command", command},
+            {"arguments", std::move(arguments)}
         };
+    }
+
+    nl::json xdebugpy_client::get_stack_frames(int thread_id)
+    {
+        std::vector<nl::json> requests;
+        requests.push_back(make_request("stackTrace", {{"threadId", thread_id}}));
+        nl::json reply = std::move(send_dap_requests(std::move(requests))[0]);
+        return reply["body"]["stackFrames"];
+    }
 
-        send_dap_request(std::move(request));
+    std::vector<nl::json> xdebugpy_client::get_stopped_threads(const nl::json& event)
+    {
+        // The thread of the event comes first
+        std::vector<nl::json> thread_ids;
+        const nl::json& body = event["body"];
+        if (body.contains("threadId"))
+        {
+            thread_ids.push_back(body["threadId"]);
+        }
+        if (!body.value("allThreadsStopped", false))
+        {
+            return thread_ids;
+        }
 
-        nl::json reply = wait_for_message([](const nl::json& message)
+        std::vector<nl::json> requests;
+        requests.push_back(make_request("threads", nl::json::object()));
+        nl::json threads = std::move(send_dap_requests(std::move(requests))[0]);
+        if (threads.value("success", false))
         {
-            return message["type"] == "response" && message["command"] == "stackTrace";
-        });
-        return reply["body"]["stackFrames"];
+            for (const nl::json& thread : threads["body"]["threads"])
+            {
+                if (thread_ids.empty() || thread["id"] != thread_ids.front())
+                {
+                    thread_ids.push_back(thread["id"]);
+                }
+            }
+        }
+        return thread_ids;
     }
-}
 
+    void xdebugpy_client::prefetch_stopped_state(const nl::json& event)
+    {
+        // For each stopped thread, the frontend asks for the stack frames,
+        // then the scopes of the top frame, then their variables. The scopes
+        // and the variables are fetched after the event is forwarded, the
+        // requests of each step being sent at once for all the threads. The
+        // stack frames are not kept since the stackTrace responses are
+        // processed by xeus.
+        std::vector<nl::json> requests;
+        for (const nl::json& thread_id : get_stopped_threads(event))
+        {
+            requests.push_back(make_request("stackTrace", {{"threadId", thread_id}}));
+        }
+        std::vector<nl::json> stack_traces = send_dap_requests(std::move(requests));
+
+        requests.clear();
+        for (const nl::json& stack_trace : stack_traces)
+        {
+            if (stack_trace.value("success", false) && !stack_trace["body"]["stackFrames"].empty())
+            {
+                requests.push_back(make_request("scopes", {{"frameId", stack_trace["body"]["stackFrames"][0]["id"]}}));
+            }
+        }
+        std::vector<std::string> scopes_keys;
+        for (const nl::json& request : requests)
+        {
+            scopes_keys.push_back(prefetch_key(request));
+        }
+        std::vector<nl::json> scopes = send_dap_requests(std::move(requests));
+
+        requests.clear();
+        for (const nl::json& frame_scopes : scopes)
+        {
+            if (frame_scopes.value("success", false))
+            {
+                for (const nl::json& scope : frame_scopes["body"]["scopes"])
+                {
+                    if (!scope.value("expensive", false))
+                    {
+                        requests.push_back(make_request("variables", {{"variablesReference", scope["variablesReference"]}}));
+                    }
+                }
+            }
+        }
+        std::vector<std::string> variables_keys;
+        for (const nl::json& request : requests)
+        {
+            variables_keys.push_back(prefetch_key(request));
+        }
+        std::vector<nl::json> variables = send_dap_requests(std::move(requests));
+
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        for (std::size_t i = 0; i < scopes.size(); ++i)
+        {
+            if (scopes[i].value("success", false))
+            {
+                m_prefetched[scopes_keys[i]] = std::move(scopes[i]);
+            }
+        }
+        for (std::size_t i = 0; i < variables.size(); ++i)
+        {
+            if (variables[i].value("success", false))
+            {
+                m_prefetched[variables_keys[i]] = std::move(variables[i]);
+            }
+        }
+    }
+
+    void xdebugpy_client::clear_prefetched_responses()
+    {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        m_prefetched.clear();
+    }
+}
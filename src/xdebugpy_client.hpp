@@ -11,8 +11,18 @@
 #ifndef XPYT_DEBUGPY_CLIENT_HPP
 #define XPYT_DEBUGPY_CLIENT_HPP
 
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
 #include "xeus/xdap_tcp_client.hpp"
 
+namespace nl = nlohmann;
+
 namespace xpyt
 {
     using xeus::xdap_tcp_client;
@@ -34,10 +44,35 @@ namespace xpyt
 
         virtual ~xdebugpy_client() = default;
 
+        // Returns the response to a scopes or variables request
+        // prefetched when the threads stopped, or a null value. Waits for
+        // the prefetch in progress. A prefetched response is only returned
+        // once.
+        nl::json get_prefetched_response(const nl::json& request);
+
     private:
 
         void handle_event(nl::json message) override;
-        nl::json get_stack_frames(int thread_id, int seq);
+
+        // Sends all the requests before waiting for their responses, which are
+        // matched with the requests by their request_seq, and returned in the
+        // order of the requests.
+        std::vector<nl::json> send_dap_requests(std::vector<nl::json> requests);
+        nl::json make_request(const std::string& command, nl::json arguments);
+        nl::json get_stack_frames(int thread_id);
+
+        std::vector<nl::json> get_stopped_threads(const nl::json& event);
+        void prefetch_stopped_state(const nl::json& event);
+        void clear_prefetched_responses();
+
+        // Sequence numbers of the requests sent by the client itself, far
+        // from the ones of the frontend requests forwarded to debugpy
+        int m_seq = 1 << 30;
+
+        std::mutex m_prefetch_mutex;
+        std::condition_variable m_prefetch_cv;
+        std::map<std::string, nl::json> m_prefetched;
+        bool m_prefetching = false;
     };
 }
 
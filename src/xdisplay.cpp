@@ -9,8 +9,11 @@
 ****************************************************************************/
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "nlohmann/json.hpp"
@@ -25,8 +28,12 @@
 
 #include "xeus-python/xutils.hpp"
 
+#include "xcomm.hpp"
 #include "xdisplay.hpp"
 #include "xinternal_utils.hpp"
+#include "xmetrics.hpp"
+#include "xoutput_spill.hpp"
+#include "xstream.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -34,22 +41,279 @@ using namespace pybind11::literals;
 
 namespace xpyt
 {
+    /********************
+     * display throttle *
+     ********************/
+
+    namespace
+    {
+        using throttle_clock = std::chrono::steady_clock;
+
+        // The data is converted when the bundle is sent, the outputs
+        // exceeding the budget being spilled without being converted
+        struct xdisplay_bundle
+        {
+            py::object m_data;
+            nl::json m_metadata;
+            nl::json m_transient;
+            bool m_update;
+        };
+
+        // Display of the frame following a clear_output(wait=True), or the
+        // stream output written between them when m_stream_name is not empty
+        struct xframe_output
+        {
+            std::string m_stream_name;
+            std::string m_text;
+            xdisplay_bundle m_bundle;
+        };
+
+        // Latest pending bundles of the throttled displays, only accessed
+        // with the GIL held and leaked with their Python objects. Each display_id is updated at most once per
+        // period, and so is the pair of a clear_output(wait=True) and the
+        // displays and streams following it.
+        struct xdisplay_throttle
+        {
+            bool m_enabled = false;
+            throttle_clock::duration m_period = throttle_clock::duration::zero();
+            std::map<std::string, throttle_clock::time_point> m_last_updates;
+            std::map<std::string, xdisplay_bundle> m_pending_updates;
+            throttle_clock::time_point m_last_clear;
+            bool m_pending_clear = false;
+            std::vector<xframe_output> m_pending_frame;
+        };
+
+        xdisplay_throttle& get_display_throttle()
+        {
+            static xdisplay_throttle* throttle = new xdisplay_throttle();
+            return *throttle;
+        }
+
+        std::string get_display_id(const nl::json& transient)
+        {
+            if (transient.is_object())
+            {
+                auto it = transient.find("display_id");
+                if (it != transient.end() && it->is_string())
+                {
+                    return it->get<std::string>();
+                }
+            }
+            return std::string();
+        }
+
+        void send_display_bundle(xdisplay_bundle bundle)
+        {
+            // The displayed widgets must be up to date
+            flush_comms();
+            nl::json data;
+            spill_mime_bundle(bundle.m_data, data, bundle.m_metadata);
+
+            auto& interp = xeus::get_interpreter();
+            xpublish_guard guard;
+            if (bundle.m_update)
+            {
+                interp.update_display_data(std::move(data), std::move(bundle.m_metadata), std::move(bundle.m_transient));
+            }
+            else
+            {
+                interp.display_data(std::move(data), std::move(bundle.m_metadata), std::move(bundle.m_transient));
+            }
+        }
+
+        void send_clear(bool wait)
+        {
+            auto& interp = xeus::get_interpreter();
+            xpublish_guard guard;
+            interp.clear_output(wait);
+        }
+
+        void send_pending_frame(xdisplay_throttle& throttle, throttle_clock::time_point now)
+        {
+            std::vector<xframe_output> frame;
+            frame.swap(throttle.m_pending_frame);
+            throttle.m_pending_clear = false;
+            throttle.m_last_clear = now;
+            send_clear(true);
+            for (xframe_output& output : frame)
+            {
+                if (output.m_stream_name.empty())
+                {
+                    send_display_bundle(std::move(output.m_bundle));
+                }
+                else
+                {
+                    publish_stream_message(output.m_stream_name, output.m_text);
+                }
+            }
+        }
+
+        void send_pending_update(xdisplay_throttle& throttle, const std::string& display_id, throttle_clock::time_point now)
+        {
+            auto it = throttle.m_pending_updates.find(display_id);
+            if (it != throttle.m_pending_updates.end())
+            {
+                xdisplay_bundle bundle = std::move(it->second);
+                throttle.m_pending_updates.erase(it);
+                throttle.m_last_updates[display_id] = now;
+                send_display_bundle(std::move(bundle));
+            }
+        }
+
+        void send_due_displays();
+
+        xgil_timer& get_display_timer()
+        {
+            static xgil_timer* timer = new xgil_timer(&send_due_displays);
+            return *timer;
+        }
+
+        // Sends the pending bundles whose period is over, and schedules the
+        // timer for the others
+        void send_due_displays()
+        {
+            xdisplay_throttle& throttle = get_display_throttle();
+            throttle_clock::time_point now = throttle_clock::now();
+            throttle_clock::time_point next = throttle_clock::time_point::max();
+
+            if (throttle.m_pending_clear)
+            {
+                throttle_clock::time_point due = throttle.m_last_clear + throttle.m_period;
+                if (due <= now)
+                {
+                    send_pending_frame(throttle, now);
+                }
+                else
+                {
+                    next = due;
+                }
+            }
+
+            std::vector<std::string> due_ids;
+            for (const auto& pending : throttle.m_pending_updates)
+            {
+                throttle_clock::time_point due = throttle.m_last_updates[pending.first] + throttle.m_period;
+                if (due <= now)
+                {
+                    due_ids.push_back(pending.first);
+                }
+                else
+                {
+                    next = std::min(next, due);
+                }
+            }
+            for (const std::string& display_id : due_ids)
+            {
+                send_pending_update(throttle, display_id, now);
+            }
+
+            // The displays which have not been updated for a period
+            // are not throttled anymore
+            for (auto it = throttle.m_last_updates.begin(); it != throttle.m_last_updates.end();)
+            {
+                if (it->second + throttle.m_period <= now && throttle.m_pending_updates.count(it->first) == 0)
+                {
+                    it = throttle.m_last_updates.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if (next != throttle_clock::time_point::max())
+            {
+                get_display_timer().schedule(next - now);
+            }
+        }
+
+        void schedule_display_timer(throttle_clock::time_point due, throttle_clock::time_point now)
+        {
+            get_display_timer().schedule(due > now ? due - now : throttle_clock::duration::zero());
+        }
+    }
+
+    void set_display_throttle(bool enabled, double max_fps)
+    {
+        flush_displays();
+        xdisplay_throttle& throttle = get_display_throttle();
+        throttle.m_enabled = enabled && max_fps > 0.;
+        throttle.m_period = throttle.m_enabled
+            ? std::chrono::duration_cast<throttle_clock::duration>(std::chrono::duration<double>(1. / max_fps))
+            : throttle_clock::duration::zero();
+        throttle.m_last_updates.clear();
+    }
+
+    void flush_displays()
+    {
+        xdisplay_throttle& throttle = get_display_throttle();
+        throttle_clock::time_point now = throttle_clock::now();
+        if (throttle.m_pending_clear)
+        {
+            send_pending_frame(throttle, now);
+        }
+        while (!throttle.m_pending_updates.empty())
+        {
+            send_pending_update(throttle, throttle.m_pending_updates.begin()->first, now);
+        }
+    }
+
+    bool hold_stream_output(const std::string& name, const std::string& text)
+    {
+        xdisplay_throttle& throttle = get_display_throttle();
+        if (!throttle.m_pending_clear)
+        {
+            return false;
+        }
+        // Sent after the delayed clear, which would otherwise wipe it
+        throttle.m_pending_frame.push_back({name, text, xdisplay_bundle()});
+        return true;
+    }
+
     /****************************************
      * xpublish_display_data implementation *
      ****************************************/
 
     void xpublish_display_data(const py::object& data, const py::object& metadata, const py::object& transient, bool update)
     {
-        auto& interp = xeus::get_interpreter();
+        // The buffered outputs written before the display are sent first
+        flush_streams();
+        xmetric_timer timer(xmetric::display_data);
 
-        if (update)
-        {
-            interp.update_display_data(data, metadata, transient);
-        }
-        else
+        xdisplay_bundle bundle = {data, metadata, transient, update};
+
+        xdisplay_throttle& throttle = get_display_throttle();
+        if (throttle.m_enabled)
         {
-            interp.display_data(data, metadata, transient);
+            throttle_clock::time_point now = throttle_clock::now();
+            std::string display_id = get_display_id(bundle.m_transient);
+            if (update && !display_id.empty())
+            {
+                auto last_update = throttle.m_last_updates.find(display_id);
+                if (last_update != throttle.m_last_updates.end() && now < last_update->second + throttle.m_period)
+                {
+                    // Only the latest update of the period is kept
+                    throttle.m_pending_updates[display_id] = std::move(bundle);
+                    schedule_display_timer(last_update->second + throttle.m_period, now);
+                    return;
+                }
+                throttle.m_pending_updates.erase(display_id);
+                throttle.m_last_updates[display_id] = now;
+            }
+            else if (throttle.m_pending_clear)
+            {
+                // Part of the frame following a clear_output(wait=True)
+                throttle.m_pending_frame.push_back({std::string(), std::string(), std::move(bundle)});
+                return;
+            }
+            else if (!display_id.empty())
+            {
+                // A pending update of this display must not overwrite it
+                throttle.m_pending_updates.erase(display_id);
+            }
         }
+
+        send_display_bundle(std::move(bundle));
     }
 
     /********************************************
@@ -58,12 +322,20 @@ namespace xpyt
 
     void xpublish_execution_result(const py::int_& execution_count, const py::object& data, const py::object& metadata)
     {
+        flush_comms();
+        flush_displays();
+
         auto& interp = xeus::get_interpreter();
+        xmetric_timer timer(xmetric::execution_result);
 
-        nl::json cpp_data = data;
+        nl::json cpp_data;
+        nl::json cpp_metadata = metadata;
+        spill_mime_bundle(data, cpp_data, cpp_metadata);
         if (cpp_data.size() != 0)
         {
-            interp.publish_execution_result(execution_count, std::move(cpp_data), metadata);
+            int cpp_execution_count = execution_count;
+            xpublish_guard guard;
+            interp.publish_execution_result(cpp_execution_count, std::move(cpp_data), std::move(cpp_metadata));
         }
     }
 
@@ -73,9 +345,29 @@ namespace xpyt
 
     void xclear(bool wait = false)
     {
-        auto& interp = xeus::get_interpreter();
+        // The buffered outputs written before the clear are cleared with
+        // the rest of the output area
+        flush_streams();
+        xdisplay_throttle& throttle = get_display_throttle();
+        if (throttle.m_enabled && wait)
+        {
+            throttle_clock::time_point now = throttle_clock::now();
+            if (throttle.m_pending_clear || now < throttle.m_last_clear + throttle.m_period)
+            {
+                // The frame is replaced by the one following this clear
+                throttle.m_pending_clear = true;
+                throttle.m_pending_frame.clear();
+                schedule_display_timer(throttle.m_last_clear + throttle.m_period, now);
+                return;
+            }
+            throttle.m_last_clear = now;
+        }
+        else
+        {
+            flush_displays();
+        }
 
-        interp.clear_output(wait);
+        send_clear(wait);
     }
 
     /******************
@@ -106,22 +398,156 @@ namespace xpyt
             py::arg("wait") = false
         );
 
+        display_module.def("set_throttle",
+            set_display_throttle,
+            py::arg("enabled"),
+            py::arg("max_fps")
+        );
+
+        display_module.def("flush_displays", flush_displays);
+
         exec(py::str(R"(
+import collections
+import reprlib
 import sys
+import weakref
 
 from IPython.core.displaypub import DisplayPublisher
 from IPython.core.displayhook import DisplayHook
 
+from traitlets import Enum, Integer
+
 
 class XDisplayPublisher(DisplayPublisher):
     def publish(self, data, metadata=None, source=None, *, transient=None, update=False, **kwargs) -> None:
+        sys.stdout.flush()
+        sys.stderr.flush()
+
         publish_display_data(data, metadata, transient, update)
 
     def clear_output(self, wait=False):
+        sys.stdout.flush()
+        sys.stderr.flush()
+
         clear_output(wait)
 
 
+class XEvictedOutput(object):
+    """Summary of a result evicted from the output cache."""
+
+    def __init__(self, value, size):
+        self.type_name = type(value).__name__
+        self.size = size
+        self.summary = reprlib.repr(value)
+
+    def __repr__(self):
+        return '<evicted {} of ~{} bytes: {}>'.format(self.type_name, self.size, self.summary)
+
+
+def approximate_size(value):
+    try:
+        memory_usage = getattr(value, 'memory_usage', None)
+        if callable(memory_usage):
+            # pandas.DataFrame returns a Series per column, pandas.Series
+            # a scalar; deep counts the objects of the object columns
+            usage = memory_usage(index=True, deep=True)
+            return int(usage.sum()) if hasattr(usage, 'sum') else int(usage)
+        nbytes = getattr(value, 'nbytes', None)
+        if isinstance(nbytes, int):
+            return nbytes
+    except Exception:
+        pass
+    try:
+        return sys.getsizeof(value)
+    except Exception:
+        return 0
+
+
 class XDisplayHook(DisplayHook):
+    output_cache_budget = Integer(0, config=True, help=
+        """Approximate maximum size in bytes of the results kept in Out and
+        the _N variables, the oldest ones being evicted beyond it. Set to 0
+        for no limit."""
+    )
+
+    output_cache_eviction = Enum(['drop', 'weakref', 'summary'], 'drop', config=True, help=
+        """What remains of an evicted result: nothing, a weak reference
+        when the object supports it, or a summary of its repr."""
+    )
+
+    def __init__(self, *args, **kwargs):
+        super(XDisplayHook, self).__init__(*args, **kwargs)
+        self._cache_sizes = collections.OrderedDict()
+        self._cache_bytes = 0
+        self._cache_evictions = 0
+        self._cache_evicted_bytes = 0
+
+    def update_user_ns(self, result):
+        super(XDisplayHook, self).update_user_ns(result)
+        if self.output_cache_budget <= 0 or not self.do_full_cache or result is self.shell.user_ns['_oh']:
+            return
+
+        size = approximate_size(result)
+        self._cache_sizes[self.prompt_count] = size
+        self._cache_bytes += size
+        # The latest result is kept whatever its size
+        while self._cache_bytes > self.output_cache_budget and len(self._cache_sizes) > 1:
+            self._evict_oldest()
+
+    def _evict_oldest(self):
+        prompt_count, size = self._cache_sizes.popitem(last=False)
+        self._cache_bytes -= size
+        output_hist = self.shell.user_ns['_oh']
+        if prompt_count not in output_hist:
+            # Already culled by IPython
+            return
+
+        value = output_hist[prompt_count]
+        replacement = None
+        if self.output_cache_eviction == 'weakref':
+            try:
+                replacement = weakref.ref(value)
+            except TypeError:
+                replacement = XEvictedOutput(value, size)
+        elif self.output_cache_eviction == 'summary':
+            replacement = XEvictedOutput(value, size)
+
+        user_ns = self.shell.user_ns
+        name = '_{}'.format(prompt_count)
+        if replacement is None:
+            del output_hist[prompt_count]
+            if user_ns.get(name) is value:
+                del user_ns[name]
+                self.shell.user_ns_hidden.pop(name, None)
+        else:
+            output_hist[prompt_count] = replacement
+            if user_ns.get(name) is value:
+                user_ns[name] = replacement
+
+        for attr in ('_', '__', '___'):
+            if getattr(self, attr) is value:
+                setattr(self, attr, replacement if replacement is not None else '')
+                if user_ns.get(attr) is value:
+                    user_ns[attr] = getattr(self, attr)
+
+        self._cache_evictions += 1
+        self._cache_evicted_bytes += size
+
+    def cache_stats(self):
+        """Returns the statistics of the output cache."""
+        return {
+            'entries': len(self._cache_sizes),
+            'bytes': self._cache_bytes,
+            'budget': self.output_cache_budget,
+            'evictions': self._cache_evictions,
+            'evicted_bytes': self._cache_evicted_bytes,
+        }
+
+    def flush(self):
+        super(XDisplayHook, self).flush()
+        self._cache_sizes.clear()
+        self._cache_bytes = 0
+
     def start_displayhook(self):
         self.data = {}
         self.metadata = {}
@@ -11,6 +11,8 @@
 #ifndef XPYT_DISPLAY_HPP
 #define XPYT_DISPLAY_HPP
 
+#include <string>
+
 #include "pybind11/pybind11.h"
 #include "pybind11/functional.h"
 
@@ -20,6 +22,15 @@ namespace xpyt
 {
     py::module get_display_module();
     void xdisplay(py::args, py::kwargs);
+
+    // Sends the throttled displays still pending.
+    // Must be called with the GIL held.
+    void flush_displays();
+
+    // Keeps the stream output in the frame following a pending
+    // clear_output(wait=True), returns false when no clear is pending.
+    // Must be called with the GIL held.
+    bool hold_stream_output(const std::string& name, const std::string& text);
 }
 
 #endif
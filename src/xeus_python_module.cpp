@@ -0,0 +1,199 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11_json/pybind11_json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xeus_python_module.hpp"
+#include "xinternal_utils.hpp"
+#include "xinterrupt.hpp"
+#include "xlog_sink.hpp"
+#include "xmetrics.hpp"
+#include "xoutput_spill.hpp"
+#include "xresource_usage.hpp"
+#include "xrich_inspect.hpp"
+#include "xsubinterpreter.hpp"
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    void dump_metrics(const std::string& path, const std::string& format)
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            throw std::runtime_error("Could not open " + path);
+        }
+        if (format == "prometheus")
+        {
+            out << metrics_to_prometheus();
+        }
+        else if (format == "json")
+        {
+            out << metrics_to_json().dump(4);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown metrics format: " + format);
+        }
+    }
+
+    /**********************
+     * xeus_python module *
+     **********************/
+
+    py::module get_xeus_python_module_impl()
+    {
+        py::module xeus_python_module = create_module("xeus_python");
+
+        xeus_python_module.def("metrics",
+            metrics_to_json,
+            "Returns the counters and latency histograms of the instrumented sections of the kernel."
+        );
+
+        xeus_python_module.def("metrics_prometheus",
+            metrics_to_prometheus,
+            "Returns the metrics in the Prometheus text format."
+        );
+
+        xeus_python_module.def("enable_metrics",
+            set_metrics_enabled,
+            py::arg("enabled") = true
+        );
+
+        xeus_python_module.def("reset_metrics", reset_metrics);
+
+        xeus_python_module.def("dump_metrics",
+            dump_metrics,
+            py::arg("path"),
+            py::arg("format") = "json"
+        );
+
+        xeus_python_module.def("set_metrics_dump",
+            set_metrics_dump,
+            py::arg("path"),
+            py::arg("interval"),
+            py::arg("format") = "json"
+        );
+
+        xeus_python_module.def("output_cache_stats",
+            []() { return py::module::import("IPython.core.getipython").attr("get_ipython")().attr("displayhook").attr("cache_stats")(); },
+            "Returns the number and approximate size of the results kept in Out, and the evictions."
+        );
+
+        xeus_python_module.def("log_stats",
+            log_sink_stats,
+            "Returns the number of messages written, dropped and sampled out by the log sink of the kernel."
+        );
+
+        xeus_python_module.def("set_output_budget",
+            set_output_budget,
+            py::arg("max_message_size"),
+            py::arg("max_cell_size"),
+            py::arg("preview_size"),
+            py::arg("max_spill_size")
+        );
+
+        xeus_python_module.def("read_spilled_output",
+            read_spilled_output,
+            py::arg("output_id"),
+            py::arg("key") = "",
+            py::arg("offset") = 0,
+            py::arg("length") = -1,
+            "Returns the content of an output spilled to disk, key being the stream name or the mimetype."
+        );
+
+        xeus_python_module.def("spilled_outputs",
+            spilled_outputs,
+            "Returns the files and sizes of the outputs spilled to disk."
+        );
+
+        xeus_python_module.def("clear_spilled_outputs",
+            clear_spilled_outputs,
+            "Removes the files of the outputs spilled to disk."
+        );
+
+        xeus_python_module.def("set_resource_accounting",
+            set_resource_accounting,
+            py::arg("level"),
+            py::arg("history_size"),
+            py::arg("top_allocations")
+        );
+
+        xeus_python_module.def("resource_usage",
+            resource_usage_history,
+            py::arg("count") = 0,
+            "Returns the resource usage of the last count cells, of all the cells kept if count is 0."
+        );
+
+        xeus_python_module.def("clear_resource_usage",
+            clear_resource_usage_history,
+            "Clears the history of the resource usage of the cells."
+        );
+
+        xeus_python_module.def("set_interrupt_options",
+            set_interrupt_options,
+            py::arg("escalation_delay"),
+            py::arg("cell_timeout")
+        );
+
+        xeus_python_module.def("interrupt_execution",
+            interrupt_execution,
+            "Interrupts the running cell, e.g. from another thread."
+        );
+
+        xeus_python_module.def("subinterpreters_supported", subinterpreters_supported);
+
+        xeus_python_module.def("run_in_subinterpreter",
+            run_in_subinterpreter,
+            py::arg("name"),
+            py::arg("code"),
+            py::arg("background") = false,
+            "Runs code in the named sub-interpreter, its outputs are sent by wait_subinterpreter or, in the background, to a display of the running cell."
+        );
+
+        xeus_python_module.def("wait_subinterpreter",
+            wait_subinterpreter,
+            py::arg("name"),
+            py::arg("timeout") = -1.,
+            "Waits until the cells submitted to the named sub-interpreter are done while sending their outputs, returns False on timeout."
+        );
+
+        xeus_python_module.def("subinterpreters",
+            subinterpreter_names,
+            "Returns the names of the sub-interpreters."
+        );
+
+        // Evaluated by the debugger in the frame of a stopped thread
+        xeus_python_module.def("_store_rich_inspection",
+            store_rich_inspection,
+            py::arg("token"),
+            py::arg("name"),
+            py::arg("value")
+        );
+
+        return xeus_python_module;
+    }
+
+    py::module get_xeus_python_module()
+    {
+        static py::module xeus_python_module = get_xeus_python_module_impl();
+        return xeus_python_module;
+    }
+}
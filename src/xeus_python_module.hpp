@@ -0,0 +1,24 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_XEUS_PYTHON_MODULE_HPP
+#define XPYT_XEUS_PYTHON_MODULE_HPP
+
+#include "pybind11/pybind11.h"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    // Kernel-side API, importable as "xeus_python" from the user code
+    py::module get_xeus_python_module();
+}
+
+#endif
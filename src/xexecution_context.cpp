@@ -0,0 +1,75 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <utility>
+
+#include "xexecution_context.hpp"
+
+namespace xpyt
+{
+    /*************************************
+     * xexecution_context implementation *
+     *************************************/
+
+    void xexecution_context::register_hook(enter_callback_type enter, exit_callback_type exit)
+    {
+        m_hooks.push_back({std::move(enter), std::move(exit)});
+    }
+
+    std::size_t xexecution_context::enter(const xcell_info& info)
+    {
+        std::size_t entered = 0;
+        try
+        {
+            for (; entered < m_hooks.size(); ++entered)
+            {
+                m_hooks[entered].m_enter(info);
+            }
+        }
+        catch (...)
+        {
+            exit(entered);
+            throw;
+        }
+        return entered;
+    }
+
+    void xexecution_context::exit(std::size_t entered)
+    {
+        while (entered != 0)
+        {
+            --entered;
+            m_hooks[entered].m_exit();
+        }
+    }
+
+    xexecution_context& get_execution_context()
+    {
+        // Intentionally leaked since the hooks may hold Python objects
+        static xexecution_context* context = new xexecution_context();
+        return *context;
+    }
+
+    /***********************************
+     * xexecution_scope implementation *
+     ***********************************/
+
+    xexecution_scope::xexecution_scope(const xcell_info& info)
+        : m_context(get_execution_context())
+        , m_entered(m_context.enter(info))
+    {
+    }
+
+    xexecution_scope::~xexecution_scope()
+    {
+        m_context.exit(m_entered);
+    }
+}
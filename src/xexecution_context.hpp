@@ -0,0 +1,78 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_EXECUTION_CONTEXT_HPP
+#define XPYT_EXECUTION_CONTEXT_HPP
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace xpyt
+{
+    struct xcell_info
+    {
+        bool m_silent;
+        bool m_store_history;
+        bool m_allow_stdin;
+    };
+
+    /**
+     * Registry of the patches applied for the execution of a cell, such as
+     * the redirection of input(). The enter callbacks are called in the order
+     * of registration before the cell runs, and the exit callbacks in the
+     * reverse order after it. The callbacks are called with the GIL held.
+     */
+    class xexecution_context
+    {
+    public:
+
+        using enter_callback_type = std::function<void(const xcell_info&)>;
+        using exit_callback_type = std::function<void()>;
+
+        void register_hook(enter_callback_type enter, exit_callback_type exit);
+
+    private:
+
+        struct xhook
+        {
+            enter_callback_type m_enter;
+            exit_callback_type m_exit;
+        };
+
+        std::size_t enter(const xcell_info& info);
+        void exit(std::size_t entered);
+
+        std::vector<xhook> m_hooks;
+
+        friend class xexecution_scope;
+    };
+
+    xexecution_context& get_execution_context();
+
+    // Scope guard calling the hooks of the execution context
+    class xexecution_scope
+    {
+    public:
+
+        explicit xexecution_scope(const xcell_info& info);
+        ~xexecution_scope();
+
+        xexecution_scope(const xexecution_scope&) = delete;
+        xexecution_scope& operator=(const xexecution_scope&) = delete;
+
+    private:
+
+        xexecution_context& m_context;
+        std::size_t m_entered;
+    };
+}
+
+#endif
@@ -0,0 +1,37 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_FILENAME_REGISTRY_HPP
+#define XPYT_FILENAME_REGISTRY_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace xpyt
+{
+    /*********************
+     * filename registry *
+     *********************/
+
+    // Same as register_filename_mapping, returning the filenames evicted
+    // from the registry so that the compiler can forget their sources
+    std::vector<std::string> register_cell_filename(const std::string& filename, int execution_count);
+
+    // Maximum number of registered filenames, 0 meaning no limit
+    void set_filename_mapping_capacity(std::size_t capacity);
+
+    // Files never evicted, e.g. the files in which breakpoints are set.
+    // The predicate is called with the GIL held; an empty one pins none.
+    void set_filename_mapping_pinned(std::function<bool(const std::string&)> pinned);
+}
+
+#endif
@@ -0,0 +1,454 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "pybind11/pybind11.h"
+
+#include "xeus-python/xforkserver.hpp"
+
+#include "xmetrics.hpp"
+#include "xstream.hpp"
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+#ifndef _WIN32
+
+    // A request sent by a client is a sequence of NUL-terminated fields:
+    // the working directory, the connection file and the environment
+    // variables of the client, followed by an empty field. The child
+    // process answers with its pid followed by a newline, and keeps the
+    // connection open until it exits.
+
+    namespace
+    {
+        bool write_all(int fd, const std::string& data)
+        {
+            std::size_t written = 0;
+            while (written < data.size())
+            {
+                ssize_t res = ::write(fd, data.data() + written, data.size() - written);
+                if (res < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                written += static_cast<std::size_t>(res);
+            }
+            return true;
+        }
+
+        bool read_request(int fd, std::vector<std::string>& fields)
+        {
+            std::string current;
+            char buffer[4096];
+            while (true)
+            {
+                ssize_t res = ::read(fd, buffer, sizeof(buffer));
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (res <= 0)
+                {
+                    return false;
+                }
+                for (ssize_t i = 0; i < res; ++i)
+                {
+                    if (buffer[i] != '\0')
+                    {
+                        current += buffer[i];
+                    }
+                    else if (current.empty())
+                    {
+                        return fields.size() >= 2;
+                    }
+                    else
+                    {
+                        fields.push_back(std::move(current));
+                        current.clear();
+                    }
+                }
+            }
+        }
+
+        sockaddr_un make_address(const std::string& socket_path)
+        {
+            sockaddr_un address;
+            if (socket_path.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error("Forkserver socket path is too long: " + socket_path);
+            }
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+            return address;
+        }
+
+        // The socket is only usable by the user running the forkserver: it
+        // is created in a directory that only this user can access, with its
+        // own permissions restricted as well.
+        void make_private_directory(const std::string& socket_path)
+        {
+            std::size_t pos = socket_path.find_last_of('/');
+            std::string directory = pos == std::string::npos ? "." : (pos == 0 ? "/" : socket_path.substr(0, pos));
+            if (::mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+            {
+                throw std::runtime_error("Could not create forkserver directory " + directory + ": " + std::strerror(errno));
+            }
+            struct stat info;
+            if (::lstat(directory.c_str(), &info) != 0)
+            {
+                throw std::runtime_error("Could not access forkserver directory " + directory + ": " + std::strerror(errno));
+            }
+            if (!S_ISDIR(info.st_mode) || info.st_uid != ::geteuid() || (info.st_mode & 0077) != 0)
+            {
+                throw std::runtime_error("Forkserver directory " + directory
+                    + " must be a directory owned by the current user and not accessible to other users");
+            }
+        }
+
+        bool get_peer_uid(int fd, uid_t& uid)
+        {
+#if defined(SO_PEERCRED)
+            struct ucred credentials;
+            socklen_t size = sizeof(credentials);
+            if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0)
+            {
+                return false;
+            }
+            uid = credentials.uid;
+            return true;
+#else
+            gid_t gid;
+            return ::getpeereid(fd, &uid, &gid) == 0;
+#endif
+        }
+
+        // The requests carry the environment of the clients, the server and
+        // its clients must be run by the same user.
+        bool is_same_user(int fd)
+        {
+            uid_t uid;
+            return get_peer_uid(fd, uid) && uid == ::geteuid();
+        }
+
+        // Applies the working directory and the environment of the client,
+        // must be called with the GIL held.
+        void setup_child(const std::vector<std::string>& fields)
+        {
+            if (::chdir(fields[0].c_str()) != 0)
+            {
+                std::clog << "Could not change directory to " << fields[0] << std::endl;
+            }
+
+            py::object py_environ = py::module::import("os").attr("environ");
+            py_environ.attr("clear")();
+            for (std::size_t i = 2; i < fields.size(); ++i)
+            {
+                std::size_t pos = fields[i].find('=');
+                if (pos != std::string::npos && pos != 0)
+                {
+                    py_environ[py::str(fields[i].substr(0, pos))] = py::str(fields[i].substr(pos + 1));
+                }
+            }
+        }
+
+        // The SQLite connection of the history must not be shared with the
+        // forkserver: the inherited connection is closed and the child starts
+        // its own session. The saving thread of the parent does not exist in
+        // the child, its connection is left to the parent.
+        void reset_history()
+        {
+            py::object shell = py::module::import("IPython.core.getipython").attr("get_ipython")();
+            py::object history = shell.attr("history_manager");
+            if (!history.is_none())
+            {
+                py::object db = history.attr("db");
+                if (py::hasattr(db, "close"))
+                {
+                    db.attr("close")();
+                }
+                py::list configurables = shell.attr("configurables");
+                if (configurables.contains(history))
+                {
+                    configurables.attr("remove")(history);
+                }
+            }
+            shell.attr("init_history")();
+        }
+
+        // A client killed without being able to forward the signal
+        // leaves the kernel unmanaged, the kernel is terminated.
+        void watch_client(int fd)
+        {
+            char c;
+            while (true)
+            {
+                ssize_t res = ::read(fd, &c, 1);
+                if (res < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (res <= 0)
+                {
+                    break;
+                }
+            }
+            ::kill(::getpid(), SIGTERM);
+        }
+    }
+
+    std::string run_forkserver(interpreter& interpreter, const std::string& socket_path)
+    {
+        // Outputs are dropped until a kernel is started in a child process
+        interpreter.register_publisher([](auto&&...) {});
+        interpreter.configure();
+
+        sockaddr_un address = make_address(socket_path);
+        make_private_directory(socket_path);
+        int server_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server_fd < 0)
+        {
+            throw std::runtime_error("Could not create forkserver socket: " + std::string(std::strerror(errno)));
+        }
+        ::unlink(socket_path.c_str());
+        // The socket is never created with broader permissions than 0600
+        mode_t previous_umask = ::umask(0177);
+        bool bound = ::bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        ::umask(previous_umask);
+        if (!bound
+            || ::chmod(socket_path.c_str(), 0600) != 0
+            || ::listen(server_fd, SOMAXCONN) != 0)
+        {
+            std::string error = std::strerror(errno);
+            ::close(server_fd);
+            throw std::runtime_error("Could not listen on " + socket_path + ": " + error);
+        }
+
+        // The children are reaped automatically
+        std::signal(SIGCHLD, SIG_IGN);
+
+        std::clog << "xeus-python forkserver listening on " << socket_path << std::endl;
+
+        while (true)
+        {
+            int client_fd = ::accept(server_fd, nullptr, nullptr);
+            if (client_fd < 0)
+            {
+                if (errno != EINTR)
+                {
+                    std::clog << "Forkserver accept failed: " << std::strerror(errno) << std::endl;
+                }
+                continue;
+            }
+
+            if (!is_same_user(client_fd))
+            {
+                std::clog << "Forkserver rejected a client run by another user" << std::endl;
+                ::close(client_fd);
+                continue;
+            }
+
+            std::vector<std::string> fields;
+            if (!read_request(client_fd, fields))
+            {
+                ::close(client_fd);
+                continue;
+            }
+
+            py::gil_scoped_acquire acquire;
+            flush_streams();
+            PyOS_BeforeFork();
+            pid_t pid = ::fork();
+            if (pid == 0)
+            {
+                PyOS_AfterFork_Child();
+                std::signal(SIGCHLD, SIG_DFL);
+                ::close(server_fd);
+
+                setup_child(fields);
+                reset_history();
+                reset_metrics();
+                restart_metrics_dump_after_fork();
+                write_all(client_fd, std::to_string(::getpid()) + '\n');
+                std::thread(watch_client, client_fd).detach();
+                return fields[1];
+            }
+
+            PyOS_AfterFork_Parent();
+            if (pid < 0)
+            {
+                std::clog << "Forkserver fork failed: " << std::strerror(errno) << std::endl;
+            }
+            ::close(client_fd);
+        }
+    }
+
+    namespace
+    {
+        volatile sig_atomic_t kernel_pid = 0;
+
+        void forward_signal(int sig)
+        {
+            if (kernel_pid != 0)
+            {
+                ::kill(static_cast<pid_t>(kernel_pid), sig);
+            }
+        }
+    }
+
+    bool connect_to_forkserver(const std::string& socket_path, const std::string& connection_filename)
+    {
+        sockaddr_un address;
+        try
+        {
+            address = make_address(socket_path);
+        }
+        catch (std::runtime_error& e)
+        {
+            std::clog << e.what() << std::endl;
+            return false;
+        }
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            std::clog << "Could not connect to forkserver " << socket_path << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        if (!is_same_user(fd))
+        {
+            std::clog << "Forkserver " << socket_path << " is run by another user" << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        char cwd[PATH_MAX];
+        std::string filename = connection_filename;
+        char resolved[PATH_MAX];
+        if (::realpath(connection_filename.c_str(), resolved) != nullptr)
+        {
+            filename = resolved;
+        }
+
+        std::string request;
+        request += (::getcwd(cwd, sizeof(cwd)) != nullptr ? cwd : "/");
+        request += '\0';
+        request += filename;
+        request += '\0';
+        for (char** env = environ; *env != nullptr; ++env)
+        {
+            if (**env != '\0')
+            {
+                request += *env;
+                request += '\0';
+            }
+        }
+        request += '\0';
+
+        std::string pid_line;
+        if (write_all(fd, request))
+        {
+            char c;
+            while (::read(fd, &c, 1) == 1 && c != '\n')
+            {
+                pid_line += c;
+            }
+        }
+        if (pid_line.empty())
+        {
+            std::clog << "Forkserver " << socket_path << " did not start the kernel" << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        // A pid which is not positive would forward the signals
+        // to the process group
+        errno = 0;
+        char* end = nullptr;
+        long pid = std::strtol(pid_line.c_str(), &end, 10);
+        if (errno != 0 || end == pid_line.c_str() || *end != '\0' || pid <= 0 || pid > INT_MAX)
+        {
+            std::clog << "Forkserver " << socket_path << " sent an invalid kernel pid: " << pid_line << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        kernel_pid = static_cast<sig_atomic_t>(pid);
+        for (int sig : {SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGUSR1, SIGUSR2})
+        {
+            std::signal(sig, forward_signal);
+        }
+
+        // The connection is closed when the kernel exits
+        char c;
+        while (true)
+        {
+            ssize_t res = ::read(fd, &c, 1);
+            if (res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (res <= 0)
+            {
+                break;
+            }
+        }
+        ::close(fd);
+        return true;
+    }
+
+#else
+
+    std::string run_forkserver(interpreter&, const std::string&)
+    {
+        throw std::runtime_error("The forkserver is not supported on this platform");
+    }
+
+    bool connect_to_forkserver(const std::string&, const std::string&)
+    {
+        return false;
+    }
+
+#endif
+}
@@ -0,0 +1,108 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <memory>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xhistory_manager.hpp"
+
+#include "pybind11_json/pybind11_json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xeus-python/xhistory_manager.hpp"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+namespace xpyt
+{
+    namespace
+    {
+        class xpython_history_manager : public xeus::xhistory_manager
+        {
+        public:
+
+            xpython_history_manager() = default;
+            virtual ~xpython_history_manager() = default;
+
+        private:
+
+            void configure_impl() override;
+            void store_inputs_impl(int session, int line_num, const std::string& input) override;
+            nl::json get_tail_impl(int n, bool raw, bool output) const override;
+            nl::json get_range_impl(int session, int start, int stop, bool raw, bool output) const override;
+            nl::json search_impl(const std::string& pattern, bool raw, bool output, int n, bool unique) const override;
+
+            static py::object history_manager();
+            static nl::json make_reply(const py::object& history);
+        };
+
+        void xpython_history_manager::configure_impl()
+        {
+        }
+
+        void xpython_history_manager::store_inputs_impl(int /*session*/, int /*line_num*/, const std::string& /*input*/)
+        {
+            // The inputs are already stored by the run_cell method of the shell
+        }
+
+        nl::json xpython_history_manager::get_tail_impl(int n, bool raw, bool output) const
+        {
+            py::gil_scoped_acquire acquire;
+            return make_reply(history_manager().attr("get_tail")(n, "raw"_a=raw, "output"_a=output, "include_latest"_a=true));
+        }
+
+        nl::json xpython_history_manager::get_range_impl(int session, int start, int stop, bool raw, bool output) const
+        {
+            py::gil_scoped_acquire acquire;
+            return make_reply(history_manager().attr("get_range")(session, start, stop, "raw"_a=raw, "output"_a=output));
+        }
+
+        nl::json xpython_history_manager::search_impl(const std::string& pattern, bool raw, bool output, int n, bool unique) const
+        {
+            py::gil_scoped_acquire acquire;
+            py::object limit = n > 0 ? py::object(py::int_(n)) : py::object(py::none());
+            return make_reply(history_manager().attr("search")(
+                pattern, "raw"_a=raw, "search_raw"_a=true, "output"_a=output, "n"_a=limit, "unique"_a=unique
+            ));
+        }
+
+        py::object xpython_history_manager::history_manager()
+        {
+            py::object shell = py::module::import("IPython.core.getipython").attr("get_ipython")();
+            return shell.attr("history_manager");
+        }
+
+        nl::json xpython_history_manager::make_reply(const py::object& history)
+        {
+            // The entries are read from the database one at a time, only
+            // the requested ones being kept in the reply.
+            nl::json entries = nl::json::array();
+            for (const py::handle& entry : history)
+            {
+                entries.push_back(nl::json(py::reinterpret_borrow<py::object>(entry)));
+            }
+
+            nl::json reply;
+            reply["history"] = std::move(entries);
+            reply["status"] = "ok";
+            return reply;
+        }
+    }
+
+    std::unique_ptr<xeus::xhistory_manager> make_python_history_manager()
+    {
+        return std::unique_ptr<xeus::xhistory_manager>(new xpython_history_manager());
+    }
+}
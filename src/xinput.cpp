@@ -8,8 +8,13 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 
 #include "xeus/xinterpreter.hpp"
 #include "xeus/xinput.hpp"
@@ -17,21 +22,147 @@
 #include "pybind11/functional.h"
 #include "pybind11/pybind11.h"
 
+#include "xexecution_context.hpp"
 #include "xinput.hpp"
+#include "xinterrupt.hpp"
+#include "xstream.hpp"
 #include "xeus-python/xutils.hpp"
 
 namespace py = pybind11;
 
 namespace xpyt
 {
+    namespace
+    {
+        // The input requests are sent from a worker thread, so that an
+        // interrupt returns from the wait for the reply right away. xeus
+        // receives exactly one reply per request: the reply to an interrupted
+        // request is still received by the worker and dropped, the next
+        // request being sent once it arrived.
+        class xinput_channel
+        {
+        public:
+
+            static xinput_channel& instance();
+
+            std::string request(const std::string& prompt, bool password);
+
+        private:
+
+            xinput_channel() = default;
+
+            void send(std::string prompt, bool password);
+            // Waits with the GIL released until the predicate holds, raises
+            // KeyboardInterrupt if the cell is interrupted meanwhile
+            template <class P>
+            void wait(std::unique_lock<std::mutex>& lock, P predicate);
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::string m_reply;
+            // Whether a request waits for its reply
+            bool m_pending = false;
+            bool m_replied = false;
+            // Whether the pending request was interrupted
+            bool m_stale = false;
+        };
+
+        xinput_channel& xinput_channel::instance()
+        {
+            // Leaked, the worker of an interrupted request may still run at exit
+            static xinput_channel* channel = new xinput_channel();
+            return *channel;
+        }
+
+        std::string xinput_channel::request(const std::string& prompt, bool password)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            wait(lock, [this]() { return !m_pending; });
+
+            m_pending = true;
+            m_replied = false;
+            std::thread(&xinput_channel::send, this, prompt, password).detach();
+            try
+            {
+                wait(lock, [this]() { return m_replied; });
+            }
+            catch (...)
+            {
+                m_stale = true;
+                throw;
+            }
+            m_replied = false;
+            return std::move(m_reply);
+        }
+
+        void xinput_channel::send(std::string prompt, bool password)
+        {
+            std::string value;
+            {
+                // The interrupts are forwarded to the thread running the cell
+                xdeferred_interrupts deferred;
+                value = xeus::blocking_input_request(prompt, password);
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stale)
+                {
+                    m_stale = false;
+                }
+                else
+                {
+                    m_reply = std::move(value);
+                    m_replied = true;
+                }
+                m_pending = false;
+            }
+            m_cv.notify_all();
+        }
+
+        template <class P>
+        void xinput_channel::wait(std::unique_lock<std::mutex>& lock, P predicate)
+        {
+            while (!predicate())
+            {
+                {
+                    py::gil_scoped_release release;
+                    // The signal handler cannot notify the condition variable
+                    m_cv.wait_for(lock, std::chrono::milliseconds(50));
+                }
+                if (!predicate() && execution_interrupted())
+                {
+                    // The handler of Python decides whether the cell is
+                    // interrupted, the lock is released while it runs
+                    lock.unlock();
+                    int handled = PyErr_CheckSignals();
+                    bool undelivered = handled == 0 && execution_interrupted();
+                    if (undelivered)
+                    {
+                        // The interrupt did not reach Python as a signal
+                        acknowledge_interrupt();
+                        PyErr_SetNone(PyExc_KeyboardInterrupt);
+                    }
+                    lock.lock();
+                    if (handled != 0 || undelivered)
+                    {
+                        throw py::error_already_set();
+                    }
+                }
+            }
+        }
+    }
+
     std::string cpp_input(const std::string& prompt)
     {
-        return xeus::blocking_input_request(prompt, false);
+        // The prompt must not be displayed before the pending outputs
+        flush_streams();
+        return xinput_channel::instance().request(prompt, false);
     }
 
     std::string cpp_getpass(const std::string& prompt)
     {
-        return xeus::blocking_input_request(prompt, true);
+        flush_streams();
+        return xinput_channel::instance().request(prompt, true);
     }
 
     void notimplemented(const std::string&)
@@ -39,30 +170,45 @@ namespace xpyt
         throw std::runtime_error("This frontend does not support input requests");
     }
 
-    input_redirection::input_redirection(bool allow_stdin)
+    input_redirection::input_redirection()
+        : m_builtins(py::module::import("builtins"))
+        , m_getpass(py::module::import("getpass"))
+        , m_cpp_input(py::cpp_function(&cpp_input, py::arg("prompt") = ""))
+        , m_cpp_getpass(py::cpp_function(&cpp_getpass, py::arg("prompt") = ""))
+        , m_notimplemented(py::cpp_function(&notimplemented, py::arg("prompt") = ""))
     {
-        // Forward input()
-        py::module builtins = py::module::import("builtins");
-        m_sys_input = builtins.attr("input");
-        builtins.attr("input") = allow_stdin ? py::cpp_function(&cpp_input, py::arg("prompt") = "")
-                                             : py::cpp_function(&notimplemented, py::arg("prompt") = "");
+    }
 
+    void input_redirection::enable(bool allow_stdin)
+    {
+        // Forward input()
+        m_sys_input = m_builtins.attr("input");
+        m_builtins.attr("input") = allow_stdin ? m_cpp_input : m_notimplemented;
 
         // Forward getpass()
-        py::module getpass = py::module::import("getpass");
-        m_sys_getpass = getpass.attr("getpass");
-        getpass.attr("getpass") = allow_stdin ? py::cpp_function(&cpp_getpass, py::arg("prompt") = "")
-                                              : py::cpp_function(&notimplemented, py::arg("prompt") = "");
+        m_sys_getpass = m_getpass.attr("getpass");
+        m_getpass.attr("getpass") = allow_stdin ? m_cpp_getpass : m_notimplemented;
     }
 
-    input_redirection::~input_redirection()
+    void input_redirection::restore()
     {
-        // Restore input()
-        py::module builtins = py::module::import("builtins");
-        builtins.attr("input") = m_sys_input;
+        m_builtins.attr("input") = m_sys_input;
+        m_getpass.attr("getpass") = m_sys_getpass;
+        m_sys_input = py::object();
+        m_sys_getpass = py::object();
+    }
 
-        // Restore getpass()
-        py::module getpass = py::module::import("getpass");
-        getpass.attr("getpass") = m_sys_getpass;
+    void register_input_redirection()
+    {
+        // Intentionally leaked since it holds Python objects
+        static input_redirection* redirection = nullptr;
+        if (redirection == nullptr)
+        {
+            redirection = new input_redirection();
+            get_execution_context().register_hook(
+                [](const xcell_info& info) { redirection->enable(info.m_allow_stdin); },
+                []() { redirection->restore(); }
+            );
+        }
     }
 }
@@ -23,24 +23,37 @@ namespace py = pybind11;
 namespace xpyt
 {
     /**
-     * Input_redirection is a scope guard implementing the redirection of
-     * input() and getpass() to the frontend through an input_request message.
+     * Redirection of input() and getpass() to the frontend through an
+     * input_request message, applied for the execution of each cell.
      *
-     * For Python 2, this also redirects raw_input().
+     * The modules and the replacement functions are created once, so that a
+     * request only swaps the attributes of the modules.
      */
     class input_redirection
     {
     public:
 
-        input_redirection(bool allow_stdin);
-        ~input_redirection();
+        input_redirection();
+
+        void enable(bool allow_stdin);
+        void restore();
 
     private:
 
+        py::module m_builtins;
+        py::module m_getpass;
+
+        py::object m_cpp_input;
+        py::object m_cpp_getpass;
+        py::object m_notimplemented;
+
         py::object m_sys_input;
         py::object m_sys_getpass;
-        py::object m_sys_raw_input;  // Only used for Python 2
     };
+
+    // Registers the input redirection in the execution context, must be
+    // called with the GIL held.
+    void register_input_redirection();
 }
 
 #ifdef __GNUC__
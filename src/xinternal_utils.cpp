@@ -8,7 +8,10 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "nlohmann/json.hpp"
@@ -25,6 +28,8 @@
 
 #ifdef WIN32
 #include "Windows.h"
+#else
+#include <pthread.h>
 #endif
 
 namespace py = pybind11;
@@ -52,12 +57,256 @@ namespace xpyt
         return "\033[0;34m" + text + "\033[0m";
     }
 
-    zmq::message_t pybytes_to_zmq_message(py::bytes bytes)
+    /******************************
+     * xzmq_buffer implementation *
+     ******************************/
+
+    xzmq_buffer::xzmq_buffer(const zmq::message_t& message)
+    {
+        // zmq_msg_copy shares the content of the message instead of copying it
+        m_message.copy(const_cast<zmq::message_t&>(message));
+    }
+
+    py::buffer_info xzmq_buffer::buffer_info()
     {
-        char* buffer;
-        Py_ssize_t length;
-        PyBytes_AsStringAndSize(bytes.ptr(), &buffer, &length);
-        return zmq::message_t(buffer, static_cast<std::size_t>(length));
+        return py::buffer_info(m_message.data(),
+                               sizeof(unsigned char),
+                               py::format_descriptor<unsigned char>::format(),
+                               static_cast<py::ssize_t>(m_message.size()),
+                               true);
+    }
+
+    void register_zmq_buffer_type(py::module& module)
+    {
+        py::class_<xzmq_buffer>(module, "ZMQBuffer", py::buffer_protocol())
+            .def_buffer(&xzmq_buffer::buffer_info);
+    }
+
+    /*************************
+     * zero-copy zmq buffers *
+     *************************/
+
+    namespace
+    {
+        // Below this size, copying the content is cheaper than
+        // the bookkeeping of a zero-copy message.
+        constexpr std::size_t zero_copy_threshold = 65536;
+
+        // Python buffers of the messages zmq is done with. zmq releases the
+        // messages from its own threads, where taking the GIL could stall
+        // the IO, so the views are handed to a timer thread that releases
+        // them with the GIL held as soon as it gets it.
+        std::mutex& get_released_buffers_mutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        std::vector<Py_buffer*>& get_released_buffers()
+        {
+            static std::vector<Py_buffer*> buffers;
+            return buffers;
+        }
+
+        void release_sent_buffers()
+        {
+            std::vector<Py_buffer*> buffers;
+            {
+                std::lock_guard<std::mutex> lock(get_released_buffers_mutex());
+                std::swap(buffers, get_released_buffers());
+            }
+            for (Py_buffer* view : buffers)
+            {
+                PyBuffer_Release(view);
+                delete view;
+            }
+        }
+
+        xgil_timer& get_buffer_release_timer()
+        {
+            static xgil_timer* timer = new xgil_timer(&release_sent_buffers);
+            return *timer;
+        }
+
+        void release_pybuffer(void* /*data*/, void* hint)
+        {
+            {
+                std::lock_guard<std::mutex> lock(get_released_buffers_mutex());
+                get_released_buffers().push_back(static_cast<Py_buffer*>(hint));
+            }
+            get_buffer_release_timer().schedule(xgil_timer::clock_type::duration::zero());
+        }
+
+        zmq::message_t pybuffer_to_zmq_message(const py::handle& buffer)
+        {
+            if (!PyObject_CheckBuffer(buffer.ptr()))
+            {
+                throw py::type_error("comm buffers must support the buffer protocol");
+            }
+
+            Py_buffer* view = new Py_buffer;
+            if (PyObject_GetBuffer(buffer.ptr(), view, PyBUF_ANY_CONTIGUOUS) != 0)
+            {
+                // Non contiguous buffer, e.g. a numpy slice
+                PyErr_Clear();
+                delete view;
+                py::bytes bytes = py::memoryview(py::reinterpret_borrow<py::object>(buffer)).attr("tobytes")();
+                return pybuffer_to_zmq_message(bytes);
+            }
+
+            std::size_t size = static_cast<std::size_t>(view->len);
+            if (size < zero_copy_threshold)
+            {
+                zmq::message_t message(view->buf, size);
+                PyBuffer_Release(view);
+                delete view;
+                return message;
+            }
+
+            // The view holds a reference on the Python object until zmq releases the message
+            return zmq::message_t(view->buf, size, release_pybuffer, view);
+        }
+    }
+
+
+    /*********************************
+     * xpublish_guard implementation *
+     *********************************/
+
+    namespace
+    {
+        std::mutex& get_publish_mutex()
+        {
+            static std::mutex publish_mutex;
+            return publish_mutex;
+        }
+    }
+
+    xpublish_guard::xpublish_guard()
+        : m_lock(get_publish_mutex())
+        , p_thread_state(PyGILState_Check() ? PyEval_SaveThread() : nullptr)
+    {
+    }
+
+    xpublish_guard::~xpublish_guard()
+    {
+        m_lock.unlock();
+        if (p_thread_state != nullptr)
+        {
+            PyEval_RestoreThread(p_thread_state);
+        }
+    }
+
+    /*****************************
+     * xgil_timer implementation *
+     *****************************/
+
+    namespace
+    {
+        std::mutex& get_gil_timer_registry_mutex()
+        {
+            static std::mutex registry_mutex;
+            return registry_mutex;
+        }
+
+        // The timers are leaked, the registry only grows
+        std::vector<xgil_timer*>& get_gil_timer_registry()
+        {
+            static std::vector<xgil_timer*> registry;
+            return registry;
+        }
+    }
+
+    xgil_timer::xgil_timer(callback_type callback)
+        : m_callback(std::move(callback))
+        , p_state(new xstate())
+    {
+#ifndef _WIN32
+        static bool atfork_registered = (pthread_atfork(&xgil_timer::prepare_fork,
+                                                        &xgil_timer::resume_after_fork,
+                                                        &xgil_timer::reset_after_fork) == 0);
+        (void)atfork_registered;
+#endif
+        std::lock_guard<std::mutex> lock(get_gil_timer_registry_mutex());
+        get_gil_timer_registry().push_back(this);
+    }
+
+    void xgil_timer::prepare_fork()
+    {
+        get_gil_timer_registry_mutex().lock();
+    }
+
+    void xgil_timer::resume_after_fork()
+    {
+        get_gil_timer_registry_mutex().unlock();
+    }
+
+    void xgil_timer::reset_after_fork()
+    {
+        // The threads may have left the mutexes of the previous states locked,
+        // they are leaked. A scheduled call was meant for the parent process.
+        for (xgil_timer* timer : get_gil_timer_registry())
+        {
+            timer->p_state = new xstate();
+        }
+        get_gil_timer_registry_mutex().unlock();
+    }
+
+    void xgil_timer::schedule(clock_type::duration delay)
+    {
+        xstate& state = *p_state;
+        {
+            std::lock_guard<std::mutex> lock(state.m_mutex);
+            if (state.m_scheduled)
+            {
+                return;
+            }
+            state.m_deadline = clock_type::now() + delay;
+            state.m_scheduled = true;
+            if (!state.m_started)
+            {
+                state.m_started = true;
+                std::thread(&xgil_timer::run, this, &state).detach();
+            }
+        }
+        state.m_cv.notify_one();
+    }
+
+    void xgil_timer::cancel()
+    {
+        xstate& state = *p_state;
+        {
+            std::lock_guard<std::mutex> lock(state.m_mutex);
+            if (!state.m_scheduled)
+            {
+                return;
+            }
+            state.m_scheduled = false;
+        }
+        state.m_cv.notify_one();
+    }
+
+    void xgil_timer::run(xstate* state)
+    {
+        std::unique_lock<std::mutex> lock(state->m_mutex);
+        while (true)
+        {
+            state->m_cv.wait(lock, [state]() { return state->m_scheduled; });
+            state->m_cv.wait_until(lock, state->m_deadline, [state]() { return !state->m_scheduled; });
+            // Cancelled, or scheduled again with a later deadline
+            if (!state->m_scheduled || clock_type::now() < state->m_deadline)
+            {
+                continue;
+            }
+            state->m_scheduled = false;
+            lock.unlock();
+            if (Py_IsInitialized())
+            {
+                py::gil_scoped_acquire acquire;
+                m_callback();
+            }
+            lock.lock();
+        }
     }
 
     py::list zmq_buffers_to_pylist(const std::vector<zmq::message_t>& buffers)
@@ -65,8 +314,7 @@ namespace xpyt
         py::list bufferlist;
         for (const zmq::message_t& buffer : buffers)
         {
-            const char* buf = buffer.data<const char>();
-            bufferlist.attr("append")(py::memoryview(py::bytes(buf)));
+            bufferlist.append(py::memoryview(py::cast(xzmq_buffer(buffer))));
         }
         return bufferlist;
     }
@@ -83,15 +331,7 @@ namespace xpyt
 
         for (py::handle buffer : bufferlist)
         {
-            if (py::isinstance<py::memoryview>(buffer))
-            {
-                py::bytes bytes = buffer.attr("tobytes")();
-                buffers.push_back(pybytes_to_zmq_message(bytes));
-            }
-            else
-            {
-                buffers.push_back(pybytes_to_zmq_message(buffer.cast<py::bytes>()));
-            }
+            buffers.push_back(pybuffer_to_zmq_message(buffer));
         }
         return buffers;
     }
@@ -12,6 +12,10 @@
 #ifndef XPYT_INTERNAL_UTILS_HPP
 #define XPYT_INTERNAL_UTILS_HPP
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <vector>
 
 #include "xeus/xcomm.hpp"
@@ -29,11 +33,104 @@ namespace xpyt
     std::string green_text(const std::string& text);
     std::string blue_text(const std::string& text);
 
+    /**
+     * Read-only view on a zmq message exposed through the buffer protocol.
+     * The message content is shared, not copied, and is kept alive as long
+     * as a Python object references the view.
+     */
+    class xzmq_buffer
+    {
+    public:
+
+        explicit xzmq_buffer(const zmq::message_t& message);
+
+        py::buffer_info buffer_info();
+
+    private:
+
+        zmq::message_t m_message;
+    };
+
+    void register_zmq_buffer_type(py::module& module);
+
     py::list zmq_buffers_to_pylist(const std::vector<zmq::message_t>& buffers);
+    // The buffers larger than 64 KiB are not copied: the messages point to
+    // the memory of the Python objects, which are locked (a bytearray cannot
+    // be resized) until zmq has sent them. Changing their content before
+    // that changes the sent bytes.
     std::vector<zmq::message_t> pylist_to_zmq_buffers(const py::object& bufferlist);
 
     py::object cppmessage_to_pymessage(const xeus::xmessage& msg);
 
+    /**
+     * Scope guard releasing the GIL while a message is published, so that the
+     * other Python threads keep running during the ZeroMQ calls. A mutex taken
+     * before the GIL is released serializes the publishing threads, and keeps
+     * the messages in the order in which their content was produced. The
+     * mutex is released before the GIL is acquired again.
+     */
+    class xpublish_guard
+    {
+    public:
+
+        xpublish_guard();
+        ~xpublish_guard();
+
+        xpublish_guard(const xpublish_guard&) = delete;
+        xpublish_guard& operator=(const xpublish_guard&) = delete;
+
+    private:
+
+        std::unique_lock<std::mutex> m_lock;
+        PyThreadState* p_thread_state;
+    };
+
+    /**
+     * Background thread calling a function with the GIL held when a deadline
+     * is reached, used to send the outputs kept in a buffer. The thread never
+     * takes the GIL while holding its own mutex. In a forked child, the thread
+     * of the parent does not exist: the state of the timers is replaced and
+     * their thread is started again by the next call.
+     *
+     * The timers must be leaked, as the other objects of the kernel used by
+     * a detached thread: the thread may still run during the destruction of
+     * the static objects at exit, and must never outlive them.
+     */
+    class xgil_timer
+    {
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+        using callback_type = std::function<void()>;
+
+        explicit xgil_timer(callback_type callback);
+
+        // Schedules a call after delay, unless a call is already scheduled
+        void schedule(clock_type::duration delay);
+        // Cancels the scheduled call, e.g. once the buffer has been sent
+        void cancel();
+
+    private:
+
+        struct xstate
+        {
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            clock_type::time_point m_deadline;
+            bool m_scheduled = false;
+            bool m_started = false;
+        };
+
+        static void prepare_fork();
+        static void resume_after_fork();
+        static void reset_after_fork();
+
+        void run(xstate* state);
+
+        callback_type m_callback;
+        xstate* p_state;
+    };
+
     std::string get_tmp_prefix();
     std::string get_tmp_suffix();
     std::string get_cell_tmp_file(const std::string& content);
@@ -9,6 +9,7 @@
 ****************************************************************************/
 
 #include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <string>
@@ -31,10 +32,20 @@
 
 #include "xcomm.hpp"
 #include "xcompiler.hpp"
+#include "xcompleter.hpp"
 #include "xdisplay.hpp"
+#include "xexecution_context.hpp"
 #include "xinput.hpp"
 #include "xinternal_utils.hpp"
+#include "xinterrupt.hpp"
+#include "xlog_sink.hpp"
+#include "xmetrics.hpp"
+#include "xoutput_spill.hpp"
+#include "xreply_cache.hpp"
+#include "xresource_usage.hpp"
+#include "xrich_inspect.hpp"
 #include "xstream.hpp"
+#include "xeus_python_module.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -42,6 +53,79 @@ using namespace pybind11::literals;
 
 namespace xpyt
 {
+    namespace
+    {
+        // Replies to is_complete_request keyed by the input transformers and
+        // the code, the transformers being registered by any code, e.g. from
+        // a background thread or a task of the asyncio loop. The size bounds
+        // the memory held by the code of large cells.
+        xreply_cache& get_is_complete_cache()
+        {
+            static xreply_cache cache(256, 4 * 1024 * 1024);
+            return cache;
+        }
+
+        // Replies to inspect_request keyed by the detail level and the token.
+        // The namespace can be modified by any code, hence a reply is only
+        // served if the token still resolves to the same object, and only the
+        // replies on modules, classes and functions are cached, the other
+        // objects being mutable.
+        xreply_cache& get_inspect_cache()
+        {
+            static xreply_cache cache(64);
+            return cache;
+        }
+
+        // The objects of the cached inspect replies, kept alive so that their
+        // identity is not reused. Intentionally leaked, the objects must not
+        // be released after the finalization of the interpreter.
+        py::dict& get_inspected_objects()
+        {
+            static py::dict* objects = new py::dict();
+            return *objects;
+        }
+
+        void clear_inspect_cache()
+        {
+            get_inspect_cache().clear();
+            get_inspected_objects().clear();
+        }
+
+        bool is_cacheable_inspection(const py::object& inspect, const py::object& obj)
+        {
+            return inspect.attr("ismodule")(obj).cast<bool>()
+                || inspect.attr("isclass")(obj).cast<bool>()
+                || inspect.attr("isroutine")(obj).cast<bool>();
+        }
+
+        // Identities of the input transformers
+        std::string get_transformers_key(const py::object& shell, const py::object& transformer_manager)
+        {
+            std::string key;
+            const char* manager_lists[] = {"cleanup_transforms", "line_transforms", "token_transformers"};
+            for (const char* name : manager_lists)
+            {
+                py::object transforms = py::getattr(transformer_manager, name, py::none());
+                if (!transforms.is_none())
+                {
+                    for (py::handle transform : transforms)
+                    {
+                        key += std::to_string(reinterpret_cast<std::uintptr_t>(transform.ptr())) + ',';
+                    }
+                }
+                key += ';';
+            }
+            py::object post = py::getattr(shell, "input_transformers_post", py::none());
+            if (!post.is_none())
+            {
+                for (py::handle transform : post)
+                {
+                    key += std::to_string(reinterpret_cast<std::uintptr_t>(transform.ptr())) + ',';
+                }
+            }
+            return key + ':';
+        }
+    }
 
     interpreter::interpreter(bool redirect_output_enabled/*=true*/, bool redirect_display_enabled/*=true*/)
         : m_redirect_display_enabled{redirect_display_enabled}
@@ -59,6 +143,12 @@ namespace xpyt
 
     void interpreter::configure_impl()
     {
+        // The forkserver configures the interpreter before the kernel is created
+        if (m_ipython_shell_app)
+        {
+            return;
+        }
+
         if (m_release_gil_at_startup)
         {
             // The GIL is not held by default by the interpreter, so every time we need to execute Python code we
@@ -69,33 +159,65 @@ namespace xpyt
         py::gil_scoped_acquire acquire;
 
         py::module sys = py::module::import("sys");
-        py::module logging = py::module::import("logging");
 
         // Monkey patching "from ipykernel.comm import Comm"
         sys.attr("modules")["ipykernel.comm"] = get_comm_module();
 
+        sys.attr("modules")["xeus_python"] = get_xeus_python_module();
+
         py::module display_module = get_display_module();
         py::module traceback_module = get_traceback_module();
         py::module stream_module = get_stream_module();
 
         py::dict scope;
         scope["CommManager"] = get_comm_module().attr("CommManager");
+        scope["set_comm_batch_interval"] = get_comm_module().attr("set_batch_interval");
         scope["set_last_error"] = traceback_module.attr("set_last_error");
+        scope["set_traceback_options"] = traceback_module.attr("set_options");
+        scope["set_filename_mapping_capacity"] = traceback_module.attr("set_filename_mapping_capacity");
+        scope["xeus_python"] = get_xeus_python_module();
 
         scope["XDisplayPublisher"] = display_module.attr("XDisplayPublisher");
         scope["XDisplayHook"] = display_module.attr("XDisplayHook");
+        scope["set_display_throttle"] = display_module.attr("set_throttle");
 
         scope["XCachingCompiler"] = get_compiler_module().attr("XCachingCompiler");
+        scope["set_lazy_cell_filenames"] = get_compiler_module().attr("set_lazy_filenames");
+
+        scope["set_stream_buffering"] = stream_module.attr("set_buffering");
+        scope["set_log_options"] = stream_module.attr("set_log_options");
 
         scope["get_parent_header"] = py::cpp_function([]() { return py::dict(py::arg("header")=xeus::get_interpreter().parent_header().get<py::object>()); });
 
         exec(py::str(R"(
+import asyncio
 import sys
+import threading
 
 from IPython.core.interactiveshell import InteractiveShell
 from IPython.core.shellapp import InteractiveShellApp
 from IPython.core.application import BaseIPythonApplication
 from IPython.core import page, payloadpage
+from IPython.core.error import UsageError
+from IPython.display import display
+
+from traitlets import Bool, Enum, Float, Integer, Unicode, observe
+
+
+def _spilled_output_target(comm, msg):
+    # Sends the requested range of a spilled output as a binary buffer
+    @comm.on_msg
+    def _fetch(msg):
+        request = msg['content']['data']
+        output_id = str(request['id'])
+        key = request.get('key', '')
+        offset = request.get('offset', 0)
+        try:
+            data = xeus_python.read_spilled_output(output_id, key, offset, request.get('length', -1))
+        except Exception as e:
+            comm.send(data={'id': output_id, 'key': key, 'error': str(e)})
+            return
+        comm.send(data={'id': output_id, 'key': key, 'offset': offset, 'size': len(data)}, buffers=[data])
 
 
 class XKernel():
@@ -110,14 +232,374 @@ class XKernel():
         return self.get_parent()
 
 
+class XEventLoopRunner():
+    """Persistent asyncio event loop, run by a background thread between the
+    cells and by the shell thread while a cell runs on it."""
+
+    def __init__(self):
+        self.loop = asyncio.new_event_loop()
+        self._resume = threading.Event()
+        self._suspended = threading.Event()
+        self._suspended.set()
+        self._lock = threading.Lock()
+        self._stop_requested = False
+        self._running = False
+        self._thread = threading.Thread(target=self._run, name='xpython-event-loop', daemon=True)
+        self._thread.start()
+
+    def _run(self):
+        asyncio.set_event_loop(self.loop)
+        while True:
+            self._resume.wait()
+            self._resume.clear()
+            self.loop.run_forever()
+            self._suspended.set()
+
+    def _stop(self):
+        with self._lock:
+            if self._stop_requested:
+                self._stop_requested = False
+                self.loop.stop()
+
+    def resume(self):
+        if not self._running:
+            self._running = True
+            self._suspended.clear()
+            self._resume.set()
+
+    def suspend(self, timeout=None):
+        """Stops the loop run by the background thread. Returns False if the
+        loop did not stop within timeout, e.g. when a task blocks it, the loop
+        being left running."""
+        if not self._running:
+            return True
+        with self._lock:
+            self._stop_requested = True
+        self.loop.call_soon_threadsafe(self._stop)
+        if not self._suspended.wait(timeout):
+            with self._lock:
+                if self._stop_requested:
+                    self._stop_requested = False
+                    return False
+            # The loop was stopped in the meantime
+            self._suspended.wait()
+        self._running = False
+        return True
+
+    def run_until_complete(self, coro):
+        return self.loop.run_until_complete(coro)
+
+
 class XPythonShell(InteractiveShell):
+    stream_buffer_size = Integer(65536, config=True, help=
+        """Size in bytes above which buffered stdout/stderr outputs are sent
+        to the frontend. Set to 0 to send every write immediately."""
+    )
+
+    stream_flush_interval = Float(0.2, config=True, help=
+        """Maximum time in seconds an output is kept in the stdout/stderr buffers."""
+    )
+
+    traceback_max_frames = Integer(0, config=True, help=
+        """Maximum number of frames displayed in error tracebacks, the
+        outermost and innermost ones being kept. Set to 0 for no limit."""
+    )
+
+    traceback_highlighter = Enum(['pygments', 'builtin', 'none'], 'pygments', config=True, help=
+        """Syntax highlighter used for the code lines of error tracebacks."""
+    )
+
+    cell_filename_cache_size = Integer(1000, config=True, help=
+        """Maximum number of cells whose source is kept for tracebacks and
+        the debugger. Set to 0 to keep all of them."""
+    )
+
+    lazy_cell_filenames = Bool(False, config=True, help=
+        """Whether the filenames of the cells are made from a counter until
+        the debugger is started, instead of the hash of their content. The
+        cells run before are written to their hashed files in the background
+        when the debugger starts."""
+    )
+
+    debugger_lazy_variables = Bool(False, config=True, help=
+        """Whether the debugger inspects the variables lazily, sending a
+        truncated repr of the values and loading the content of the
+        containers on demand, instead of their full JSON conversion."""
+    )
+
+    debugger_variable_repr_size = Integer(256, config=True, help=
+        """Maximum size of the repr of the variables inspected lazily."""
+    )
+
+    display_throttle = Bool(False, config=True, help=
+        """Whether the updates of the displays with a display_id, and the
+        displays following a clear_output(wait=True), are throttled, only the
+        latest pending bundle being sent at most display_max_fps times per
+        second and at the end of the cell."""
+    )
+
+    display_max_fps = Float(30.0, config=True, help=
+        """Maximum number of times per second a throttled display is sent."""
+    )
+
+    output_max_message_size = Integer(0, config=True, help=
+        """Maximum size in bytes of a stream output or of a display, the
+        larger outputs being written to a spill file and replaced with a
+        truncated preview. Set to 0 to disable the limit."""
+    )
+
+    output_max_cell_size = Integer(0, config=True, help=
+        """Maximum size in bytes of the outputs of a cell, the further
+        outputs being written to spill files. Set to 0 to disable the
+        limit."""
+    )
+
+    output_preview_size = Integer(4096, config=True, help=
+        """Size in bytes of the preview of the spilled outputs."""
+    )
+
+    output_max_spill_size = Integer(1024 * 1024 * 1024, config=True, help=
+        """Maximum size in bytes of the spill files, the least recently
+        used spilled outputs being removed. Set to 0 to disable the
+        limit."""
+    )
+
+    comm_batch_interval = Float(0.0, config=True, help=
+        """Time in seconds during which the state updates sent by a comm are
+        batched, consecutive updates being merged into a single message.
+        Set to 0 to send every update immediately."""
+    )
+
+    subinterpreter_cells = Bool(False, config=True, help=
+        """Whether the cells starting with "%%subinterp <name>" are run in
+        the named sub-interpreter, which has its own GIL. Requires Python 3.12
+        and a build with XPYT_ENABLE_SUBINTERPRETERS."""
+    )
+
+    interrupt_escalation_delay = Float(0.0, config=True, help=
+        """Time in seconds after which an interrupted cell whose interrupt
+        has not reached the SIGINT handler of Python gets a KeyboardInterrupt
+        injected in its thread, bypassing the SIGINT handler. The exception
+        is only raised once the thread runs Python code again, not in the
+        middle of a native call. 0 disables the injection."""
+    )
+
+    cell_timeout = Float(0.0, config=True, help=
+        """Time in seconds after which a running cell is interrupted. Set to
+        0 to disable the timeout."""
+    )
+
+    event_loop = Enum(['none', 'asyncio'], 'none', config=True, help=
+        """Event loop integration. With "asyncio", the cells run on a
+        persistent asyncio event loop which keeps running the tasks in a
+        background thread between the requests."""
+    )
+
+    event_loop_suspend_timeout = Float(10.0, config=True, help=
+        """Time in seconds a cell waits for the asyncio event loop to be
+        handed back by the background thread, the cell failing if a task
+        blocks the loop longer. Set to 0 to wait indefinitely."""
+    )
+
+    log_sink_level = Integer(0, config=True, help=
+        """Minimum level of the messages logged by the kernel, the messages
+        below it being discarded before being formatted."""
+    )
+
+    log_sample_rate = Integer(1, config=True, help=
+        """Only one in log_sample_rate messages below the WARNING level is
+        logged by the kernel."""
+    )
+
+    metrics_enabled = Bool(False, config=True, help=
+        """Whether the time spent in the requests and in the main sections
+        of the kernel is measured, see xeus_python.metrics()."""
+    )
+
+    metrics_dump_path = Unicode('', config=True, help=
+        """File to which the metrics are periodically written, "{pid}"
+        being replaced with the process id. Empty to disable the dumps."""
+    )
+
+    metrics_dump_interval = Float(10.0, config=True, help=
+        """Interval in seconds between two dumps of the metrics."""
+    )
+
+    metrics_dump_format = Enum(['json', 'prometheus'], 'json', config=True, help=
+        """Format of the metrics dumps, the "prometheus" text format being
+        suitable for the textfile collector of the node exporter."""
+    )
+
+    resource_accounting = Enum(['none', 'basic', 'allocations'], 'none', config=True, help=
+        """Accounting of the resources used by the cells, sent in the
+        resource_usage field of the execute replies and kept in the history
+        of xeus_python.resource_usage(). "basic" measures the wall and CPU
+        times and the resident memory, "allocations" also traces the top
+        allocation sites of the cells with tracemalloc, which slows down
+        the allocations."""
+    )
+
+    resource_history_size = Integer(100, config=True, help=
+        """Number of cells whose resource usage is kept in the history."""
+    )
+
+    resource_top_allocations = Integer(10, config=True, help=
+        """Number of allocation sites reported with the "allocations"
+        accounting."""
+    )
+
+    input_history_size = Integer(1000, config=True, help=
+        """Number of the latest cell inputs kept in memory in In, _ih and
+        the _iN variables, the older ones being replaced with empty strings.
+        They remain in the history database. Set to 0 to keep all of them."""
+    )
+
     def __init__(self, *args, **kwargs):
         super(XPythonShell, self).__init__(*args, **kwargs)
         self.kernel = XKernel()
+        # Created on the first cell so that the forkserver never forks a
+        # running event loop
+        self._event_loop_runner = None
+        self._update_stream_buffering()
+        self._update_traceback_options()
+        set_filename_mapping_capacity(self.cell_filename_cache_size)
+        set_lazy_cell_filenames(self.lazy_cell_filenames)
+        self._update_metrics()
+        # Lines below it have been trimmed, line 0 is a placeholder
+        self._input_history_trimmed = 1
+        self.events.register('post_run_cell', self._trim_input_history)
+        set_display_throttle(self.display_throttle, self.display_max_fps)
+        self._update_output_budget()
+        set_log_options(self.log_sink_level, self.log_sample_rate)
+        self._update_resource_accounting()
+        xeus_python.set_interrupt_options(self.interrupt_escalation_delay, self.cell_timeout)
+        self.kernel.comm_manager.register_target('xeus_python.spilled_output', _spilled_output_target)
+        set_comm_batch_interval(self.comm_batch_interval)
+        self.register_magic_function(self._subinterp_magic, 'cell', 'subinterp')
+
+    @observe('stream_buffer_size', 'stream_flush_interval')
+    def _stream_buffering_changed(self, change):
+        self._update_stream_buffering()
+
+    def _update_stream_buffering(self):
+        set_stream_buffering(self.stream_buffer_size, self.stream_flush_interval)
+
+    @observe('traceback_max_frames', 'traceback_highlighter')
+    def _traceback_options_changed(self, change):
+        self._update_traceback_options()
+
+    def _update_traceback_options(self):
+        set_traceback_options(self.traceback_max_frames, self.traceback_highlighter)
+
+    @observe('cell_filename_cache_size')
+    def _cell_filename_cache_size_changed(self, change):
+        set_filename_mapping_capacity(change['new'])
+
+    @observe('lazy_cell_filenames')
+    def _lazy_cell_filenames_changed(self, change):
+        set_lazy_cell_filenames(change['new'])
+
+    @observe('display_throttle', 'display_max_fps')
+    def _display_throttle_changed(self, change):
+        set_display_throttle(self.display_throttle, self.display_max_fps)
+
+    @observe('output_max_message_size', 'output_max_cell_size', 'output_preview_size', 'output_max_spill_size')
+    def _output_budget_changed(self, change):
+        self._update_output_budget()
+
+    def _update_output_budget(self):
+        xeus_python.set_output_budget(self.output_max_message_size, self.output_max_cell_size,
+                                      self.output_preview_size, self.output_max_spill_size)
+
+    @observe('log_sink_level', 'log_sample_rate')
+    def _log_options_changed(self, change):
+        set_log_options(self.log_sink_level, self.log_sample_rate)
+
+    @observe('comm_batch_interval')
+    def _comm_batch_interval_changed(self, change):
+        set_comm_batch_interval(change['new'])
+
+    @observe('metrics_enabled', 'metrics_dump_path', 'metrics_dump_interval', 'metrics_dump_format')
+    def _metrics_changed(self, change):
+        self._update_metrics()
+
+    @observe('interrupt_escalation_delay', 'cell_timeout')
+    def _interrupt_options_changed(self, change):
+        xeus_python.set_interrupt_options(self.interrupt_escalation_delay, self.cell_timeout)
+
+    @observe('resource_accounting', 'resource_history_size', 'resource_top_allocations')
+    def _resource_accounting_changed(self, change):
+        self._update_resource_accounting()
+
+    def _update_resource_accounting(self):
+        xeus_python.set_resource_accounting(self.resource_accounting, self.resource_history_size, self.resource_top_allocations)
+
+    def _update_metrics(self):
+        xeus_python.enable_metrics(self.metrics_enabled)
+        xeus_python.set_metrics_dump(self.metrics_dump_path, self.metrics_dump_interval, self.metrics_dump_format)
+
+    def _trim_input_history(self, result=None):
+        size = self.input_history_size
+        history_manager = self.history_manager
+        if size <= 0 or history_manager is None:
+            return
+        end = len(history_manager.input_hist_parsed) - size
+        for line in range(self._input_history_trimmed, end):
+            history_manager.input_hist_parsed[line] = ''
+            history_manager.input_hist_raw[line] = ''
+            self.user_ns.pop('_i%d' % line, None)
+            self.user_ns_hidden.pop('_i%d' % line, None)
+        self._input_history_trimmed = max(self._input_history_trimmed, end)
+
+    def execute_cell(self, raw_cell, store_history=False, silent=False):
+        if self.event_loop == 'none':
+            return self.run_cell(raw_cell, store_history=store_history, silent=silent)
+
+        if self._event_loop_runner is None:
+            self._event_loop_runner = XEventLoopRunner()
+        runner = self._event_loop_runner
+        if not runner.suspend(self.event_loop_suspend_timeout or None):
+            try:
+                raise RuntimeError('The asyncio event loop is blocked by a task, the cell was not run')
+            except RuntimeError:
+                self.showtraceback()
+            return None
+
+        # The coroutines of the cells awaiting at the top level are run on the
+        # persistent loop by run_cell, instead of a temporary one
+        asyncio.set_event_loop(runner.loop)
+        loop_runner = self.loop_runner
+        self.loop_runner = runner.run_until_complete
+        try:
+            return self.run_cell(raw_cell, store_history=store_history, silent=silent)
+        finally:
+            self.loop_runner = loop_runner
+            if self.event_loop == 'asyncio':
+                runner.resume()
+
+    def _subinterp_magic(self, line, cell):
+        """Runs the cell in the named sub-interpreter and waits for it, its
+        outputs being sent as the streams of the cell. With --background, the
+        kernel moves on to the next request and the outputs are sent to a
+        display of the cell."""
+        if not self.subinterpreter_cells:
+            raise UsageError('The sub-interpreters are disabled, see XPythonShell.subinterpreter_cells')
+        if not xeus_python.subinterpreters_supported():
+            raise UsageError('The sub-interpreters require Python 3.12 and a build with XPYT_ENABLE_SUBINTERPRETERS')
+        args = line.split()
+        background = '--background' in args
+        names = [arg for arg in args if arg != '--background']
+        name = names[0] if names else 'default'
+        xeus_python.run_in_subinterpreter(name, cell, background)
+        if not background:
+            xeus_python.wait_subinterpreter(name)
 
     def enable_gui(self, gui=None):
-        """Not implemented yet."""
-        pass
+        """Only the asyncio event loop is supported."""
+        if gui == 'asyncio':
+            self.event_loop = 'asyncio'
+        elif gui is None and self.event_loop == 'asyncio':
+            self.event_loop = 'none'
 
     def init_hooks(self):
         super(XPythonShell, self).init_hooks()
@@ -155,6 +637,7 @@ class XPythonShellApp(BaseIPythonApplication, InteractiveShellApp):
 
     def init_shell(self):
         self.shell = XPythonShell.instance(
+            parent=self,
             display_pub_class=XDisplayPublisher,
             displayhook_class=XDisplayHook,
             compiler_class=XCachingCompiler,
@@ -172,50 +655,100 @@ class XPythonShellApp(BaseIPythonApplication, InteractiveShellApp):
 
         m_displayhook = m_ipython_shell.attr("displayhook");
 
+        m_completer = get_completer_module().attr("XCompleter")("shell"_a=m_ipython_shell, "parent"_a=m_ipython_shell);
+
+        m_token_at_cursor = py::module::import("IPython.utils.tokenutil").attr("token_at_cursor");
+        m_inspect = py::module::import("inspect");
+
         m_logger = m_ipython_shell_app.attr("log");
         m_terminal_stream = stream_module.attr("TerminalStream")();
 
         // Needed for redirecting logging to the terminal
         m_logger.attr("handlers") = py::list(0);
-        m_logger.attr("addHandler")(logging.attr("StreamHandler")(m_terminal_stream));
+        m_logger.attr("addHandler")(stream_module.attr("XLogHandler")());
 
         m_ipython_shell.attr("compile").attr("filename_mapper") = traceback_module.attr("register_filename_mapping");
+
+        register_input_redirection();
+
+        // Python has installed its SIGINT handler
+        install_interrupt_handler();
     }
 
-    nl::json interpreter::execute_request_impl(int /*execution_count*/,
+    nl::json interpreter::execute_request_impl(int execution_count,
                                                const std::string& code,
                                                bool silent,
                                                bool store_history,
                                                nl::json user_expressions,
                                                bool allow_stdin)
     {
-        py::gil_scoped_acquire acquire;
+        xmetric_timer request_timer(xmetric::execute_request);
+
+        xtimed_gil_acquire acquire(xmetric::execute_gil);
+        xrunning_cell_guard running_cell;
+
+        // The cell may change the objects of the cached inspections
+        clear_inspect_cache();
         nl::json kernel_res;
 
+        reset_cell_output_budget();
+
         py::module traceback = get_traceback_module();
 
-        // Scope guard performing the temporary monkey patching of input and
-        // getpass with a function sending input_request messages.
-        auto input_guard = input_redirection(allow_stdin);
+        // Scope guard applying the per-cell patches, such as the redirection
+        // of input and getpass to input_request messages.
+        xexecution_scope execution_scope({silent, store_history, allow_stdin});
+
+        xresource_scope resource_scope(execution_count);
+        {
+            xmetric_timer run_cell_timer(xmetric::run_cell);
+            try
+            {
+                xinterrupt_scope interrupt_scope;
+                m_ipython_shell.attr("execute_cell")(code, "store_history"_a=store_history, "silent"_a=silent);
+            }
+            catch (py::error_already_set& e)
+            {
+                // Interrupted outside of the code of the cell, which IPython
+                // does not catch
+                if (!e.matches(PyExc_KeyboardInterrupt))
+                {
+                    throw;
+                }
+                m_ipython_shell.attr("showtraceback")(py::make_tuple(e.type(), e.value(), e.trace()));
+            }
+        }
+        nl::json resource_usage = resource_scope.stop();
 
-        py::object ipython_res = m_ipython_shell.attr("run_cell")(code, "store_history"_a=store_history, "silent"_a=silent);
+        // Send the outputs, comm updates and displays still buffered before
+        // the reply and the error message
+        flush_streams();
+        flush_comms();
+        flush_displays();
 
         // Get payload
-        kernel_res["payload"] = m_ipython_shell.attr("payload_manager").attr("read_payload")();
-        m_ipython_shell.attr("payload_manager").attr("clear_payload")();
+        {
+            xmetric_timer payload_timer(xmetric::payload);
+            kernel_res["payload"] = m_ipython_shell.attr("payload_manager").attr("read_payload")();
+            m_ipython_shell.attr("payload_manager").attr("clear_payload")();
+        }
 
         if (traceback.attr("get_last_error")().is_none())
         {
+            xmetric_timer user_expressions_timer(xmetric::user_expressions);
             kernel_res["status"] = "ok";
             kernel_res["user_expressions"] = m_ipython_shell.attr("user_expressions")(user_expressions);
         }
         else
         {
             py::list pyerror = traceback.attr("get_last_error")();
+            xmetric_timer traceback_timer(xmetric::traceback);
             xerror error = extract_error(pyerror[0], pyerror[1], pyerror[2]);
+            traceback_timer.stop();
 
             if (!silent)
             {
+                xpublish_guard guard;
                 publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
             }
 
@@ -227,6 +760,12 @@ class XPythonShellApp(BaseIPythonApplication, InteractiveShellApp):
             traceback.attr("reset_last_error")();
         }
 
+        // The content of the reply, the kernel core sending empty metadata
+        if (!resource_usage.is_null())
+        {
+            kernel_res["resource_usage"] = std::move(resource_usage);
+        }
+
         return kernel_res;
     }
 
@@ -234,44 +773,15 @@ class XPythonShellApp(BaseIPythonApplication, InteractiveShellApp):
         const std::string& code,
         int cursor_pos)
     {
-        py::gil_scoped_acquire acquire;
+        xmetric_timer request_timer(xmetric::complete_request);
+        xtimed_gil_acquire acquire(xmetric::complete_gil);
         nl::json kernel_res;
 
-        py::module completer = py::module::import("IPython.core.completer");
+        py::tuple result = m_completer.attr("complete")(code, cursor_pos);
 
-        py::dict scope;
-        scope["provisionalcompleter"] = completer.attr("provisionalcompleter");
-        scope["rectify_completions"] = completer.attr("rectify_completions");
-        scope["shell"] = m_ipython_shell;
-        scope["code"] = code;
-        scope["cursor_pos"] = cursor_pos;
-        exec(py::str(R"(
-with provisionalcompleter():
-    raw_completions = shell.Completer.completions(code, cursor_pos)
-    completions = list(rectify_completions(code, raw_completions))
-
-    comps = []
-    for comp in completions:
-        comps.append(dict(
-            start=comp.start,
-            end=comp.end,
-            text=comp.text,
-            type=comp.type,
-        ))
-
-if completions:
-    cursor_start = completions[0].start
-    cursor_end = completions[0].end
-    matches = [c.text for c in completions]
-else:
-    cursor_start = cursor_pos
-    cursor_end = cursor_pos
-    matches = []
-        )"), scope);
-
-        kernel_res["matches"] = scope["matches"];
-        kernel_res["cursor_end"] = scope["cursor_end"];
-        kernel_res["cursor_start"] = scope["cursor_start"];
+        kernel_res["matches"] = result[0];
+        kernel_res["cursor_end"] = result[2];
+        kernel_res["cursor_start"] = result[1];
         kernel_res["metadata"] = nl::json::object();
         kernel_res["status"] = "ok";
 
@@ -282,13 +792,28 @@ else:
                                                int cursor_pos,
                                                int detail_level)
     {
-        py::gil_scoped_acquire acquire;
+        xmetric_timer request_timer(xmetric::inspect_request);
+        xtimed_gil_acquire acquire(xmetric::inspect_gil);
         nl::json kernel_res;
         nl::json data = nl::json::object();
         bool found = false;
 
-        py::module tokenutil = py::module::import("IPython.utils.tokenutil");
-        py::str name = tokenutil.attr("token_at_cursor")(code, cursor_pos);
+        py::str name = m_token_at_cursor(code, cursor_pos);
+
+        py::object info = m_ipython_shell.attr("_object_find")(name);
+        py::object obj = info.attr("found").cast<bool>() ? info.attr("obj") : py::object(py::none());
+
+        xreply_cache& cache = get_inspect_cache();
+        py::dict& objects = get_inspected_objects();
+        std::string key = std::to_string(detail_level) + ':' + static_cast<std::string>(name);
+        py::str object_key(key);
+        if (objects.contains(object_key) && py::object(objects[object_key]).is(obj))
+        {
+            if (const nl::json* reply = cache.find(key))
+            {
+                return *reply;
+            }
+        }
 
         try
         {
@@ -307,12 +832,24 @@ else:
         kernel_res["metadata"] = nl::json::object();
         kernel_res["found"] = found;
         kernel_res["status"] = "ok";
+        if (found && !obj.is_none() && is_cacheable_inspection(m_inspect, obj))
+        {
+            // The objects of the evicted replies are released with the others
+            if (py::len(objects) >= 2 * 64)
+            {
+                clear_inspect_cache();
+            }
+            cache.insert(key, kernel_res);
+            objects[object_key] = obj;
+        }
         return kernel_res;
     }
 
     nl::json interpreter::is_complete_request_impl(const std::string& code)
     {
-        py::gil_scoped_acquire acquire;
+        xmetric_timer request_timer(xmetric::is_complete_request);
+
+        xtimed_gil_acquire acquire(xmetric::is_complete_gil);
         nl::json kernel_res;
 
         py::object transformer_manager = py::getattr(m_ipython_shell, "input_transformer_manager", py::none());
@@ -321,6 +858,13 @@ else:
             transformer_manager = m_ipython_shell.attr("input_splitter");
         }
 
+        xreply_cache& cache = get_is_complete_cache();
+        std::string key = get_transformers_key(m_ipython_shell, transformer_manager) + code;
+        if (const nl::json* reply = cache.find(key))
+        {
+            return *reply;
+        }
+
         py::list result = transformer_manager.attr("check_complete")(code);
         auto status = result[0].cast<std::string>();
 
@@ -329,11 +873,13 @@ else:
         {
             kernel_res["indent"] = std::string(result[1].cast<std::size_t>(), ' ');
         }
+        cache.insert(key, kernel_res);
         return kernel_res;
     }
 
     nl::json interpreter::kernel_info_request_impl()
     {
+        xmetric_timer request_timer(xmetric::kernel_info_request);
         nl::json result;
         result["implementation"] = "xeus-python";
         result["implementation_version"] = XPYT_VERSION;
@@ -383,11 +929,14 @@ else:
 
     void interpreter::shutdown_request_impl()
     {
+        // The logs of the kernel are written by a background thread
+        flush_log_sink(1.);
     }
 
     nl::json interpreter::internal_request_impl(const nl::json& content)
     {
-        py::gil_scoped_acquire acquire;
+        xmetric_timer request_timer(xmetric::internal_request);
+        xtimed_gil_acquire acquire(xmetric::internal_gil);
         std::string code = content.value("code", "");
         nl::json reply;
         try
@@ -400,7 +949,11 @@ else:
         {
             xerror error = extract_error(e);
 
-            publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
+            flush_streams();
+            {
+                xpublish_guard guard;
+                publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
+            }
             error.m_traceback.resize(1);
             error.m_traceback[0] = code;
 
@@ -0,0 +1,420 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "pybind11/pybind11.h"
+
+#include "xinterrupt.hpp"
+#include "xlog_sink.hpp"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        using interrupt_clock = std::chrono::steady_clock;
+
+        class xinterrupter
+        {
+        public:
+
+            static xinterrupter& instance();
+
+            void install_handler();
+            void set_options(double escalation_delay, double cell_timeout);
+
+            void begin();
+            void end();
+
+            void interrupt();
+            bool interrupted() const;
+            void acknowledge();
+            void record_signal();
+
+        private:
+
+            xinterrupter() = default;
+
+            static xinterrupter*& instance_ptr();
+#ifndef _WIN32
+            static void handle_signal(int sig, siginfo_t* info, void* context);
+            static void reset_after_fork();
+#endif
+
+            void run();
+            void escalate(std::uint64_t generation);
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::chrono::duration<double> m_escalation_delay = std::chrono::duration<double>(0.);
+            std::chrono::duration<double> m_cell_timeout = std::chrono::duration<double>(0.);
+            interrupt_clock::time_point m_deadline = interrupt_clock::time_point::max();
+            bool m_started = false;
+
+            // Read by the signal handler, the thread ids being written
+            // before m_executing is set
+            std::atomic<bool> m_executing = {false};
+            std::atomic<std::uint64_t> m_interrupt_count = {0};
+            std::atomic<std::uint64_t> m_generation = {0};
+            unsigned long m_python_thread = 0;
+            // Whether the interrupts are delivered as SIGINT to the thread
+            // running the cell, the exception being injected right away
+            // otherwise
+            bool m_signals = false;
+#ifndef _WIN32
+            pthread_t m_thread;
+            struct sigaction m_previous_action;
+#endif
+        };
+
+        xinterrupter& xinterrupter::instance()
+        {
+            return *instance_ptr();
+        }
+
+        xinterrupter*& xinterrupter::instance_ptr()
+        {
+            // Leaked, the signal handler and the escalation thread may run during the exit
+            static xinterrupter* interrupter = new xinterrupter();
+            return interrupter;
+        }
+
+#ifndef _WIN32
+        void xinterrupter::handle_signal(int sig, siginfo_t* info, void* context)
+        {
+            int saved_errno = errno;
+            xinterrupter& self = instance();
+            if (self.m_executing.load())
+            {
+                self.m_interrupt_count.fetch_add(1);
+                if (!pthread_equal(pthread_self(), self.m_thread))
+                {
+                    pthread_kill(self.m_thread, sig);
+                    errno = saved_errno;
+                    return;
+                }
+            }
+
+            const struct sigaction& previous = self.m_previous_action;
+            if (previous.sa_flags & SA_SIGINFO)
+            {
+                previous.sa_sigaction(sig, info, context);
+            }
+            else if (previous.sa_handler == SIG_DFL)
+            {
+                signal(sig, SIG_DFL);
+                raise(sig);
+            }
+            else if (previous.sa_handler != SIG_IGN)
+            {
+                previous.sa_handler(sig);
+            }
+            errno = saved_errno;
+        }
+
+        void xinterrupter::reset_after_fork()
+        {
+            // The thread does not survive the fork and its mutex may be locked
+            xinterrupter& old_interrupter = instance();
+            xinterrupter* interrupter = new xinterrupter();
+            interrupter->m_escalation_delay = old_interrupter.m_escalation_delay;
+            interrupter->m_cell_timeout = old_interrupter.m_cell_timeout;
+            interrupter->m_signals = old_interrupter.m_signals;
+            interrupter->m_previous_action = old_interrupter.m_previous_action;
+            instance_ptr() = interrupter;
+        }
+#endif
+
+        void xinterrupter::install_handler()
+        {
+#ifndef _WIN32
+            // Python only handles the signals in the main thread
+            py::module threading = py::module::import("threading");
+            if (m_signals || !threading.attr("main_thread")().is(threading.attr("current_thread")()))
+            {
+                return;
+            }
+
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_sigaction = &xinterrupter::handle_signal;
+            action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            // The interrupts handled by Python were delivered to the cell and
+            // are not escalated. The handler of Python is wrapped before the
+            // signal handler is installed on top of the one of Python.
+            py::module signal_module = py::module::import("signal");
+            py::object python_handler = signal_module.attr("getsignal")(SIGINT);
+            if (PyCallable_Check(python_handler.ptr()))
+            {
+                signal_module.attr("signal")(SIGINT, py::cpp_function([python_handler](py::args args) {
+                    instance().acknowledge();
+                    return python_handler(*args);
+                }));
+            }
+
+            if (sigaction(SIGINT, &action, &m_previous_action) == 0)
+            {
+                m_signals = true;
+                static bool atfork_registered = (pthread_atfork(nullptr, nullptr, &xinterrupter::reset_after_fork) == 0);
+                (void)atfork_registered;
+            }
+#endif
+        }
+
+        void xinterrupter::set_options(double escalation_delay, double cell_timeout)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_escalation_delay = std::chrono::duration<double>(escalation_delay);
+            m_cell_timeout = std::chrono::duration<double>(cell_timeout);
+        }
+
+        void xinterrupter::begin()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_python_thread = PyThread_get_thread_ident();
+#ifndef _WIN32
+                m_thread = pthread_self();
+#endif
+                m_interrupt_count.store(0);
+                m_deadline = m_cell_timeout.count() > 0.
+                    ? interrupt_clock::now() + std::chrono::duration_cast<interrupt_clock::duration>(m_cell_timeout)
+                    : interrupt_clock::time_point::max();
+                m_executing.store(true);
+                if (!m_started)
+                {
+                    m_started = true;
+                    std::thread(&xinterrupter::run, this).detach();
+                }
+            }
+            m_cv.notify_one();
+        }
+
+        void xinterrupter::end()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_executing.store(false);
+                ++m_generation;
+                m_deadline = interrupt_clock::time_point::max();
+            }
+            // An exception injected once the cell returned must not be
+            // raised in the next ones
+            PyThreadState_SetAsyncExc(m_python_thread, nullptr);
+        }
+
+        void xinterrupter::interrupt()
+        {
+            if (!m_executing.load())
+            {
+                return;
+            }
+            m_interrupt_count.fetch_add(1);
+#ifndef _WIN32
+            if (m_signals)
+            {
+                pthread_kill(m_thread, SIGINT);
+            }
+#endif
+        }
+
+        bool xinterrupter::interrupted() const
+        {
+            return m_executing.load() && m_interrupt_count.load() != 0;
+        }
+
+        void xinterrupter::record_signal()
+        {
+            if (m_executing.load())
+            {
+                m_interrupt_count.fetch_add(1);
+            }
+        }
+
+        void xinterrupter::acknowledge()
+        {
+            // The interrupts of the cell are only delivered in its thread
+            if (m_executing.load() && PyThread_get_thread_ident() == m_python_thread)
+            {
+                m_interrupt_count.store(0);
+                PyThreadState_SetAsyncExc(m_python_thread, nullptr);
+            }
+        }
+
+        void xinterrupter::run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            std::uint64_t noticed_count = 0;
+            std::uint64_t noticed_generation = 0;
+            interrupt_clock::time_point interrupt_time;
+            bool escalated = false;
+            while (true)
+            {
+                if (!m_executing.load())
+                {
+                    m_cv.wait(lock);
+                    continue;
+                }
+
+                // The signal handler cannot notify the condition variable
+                m_cv.wait_for(lock, std::chrono::milliseconds(50));
+                if (!m_executing.load())
+                {
+                    continue;
+                }
+
+                std::uint64_t generation = m_generation.load();
+                interrupt_clock::time_point now = interrupt_clock::now();
+                if (now >= m_deadline)
+                {
+                    m_deadline = interrupt_clock::time_point::max();
+                    std::ostringstream message;
+                    message << "The cell is interrupted after running for " << m_cell_timeout.count() << " seconds";
+                    lock.unlock();
+                    write_log(xlog_target::terminal, log_level_warning, message.str());
+                    interrupt();
+                    lock.lock();
+                    continue;
+                }
+
+                std::uint64_t count = m_interrupt_count.load();
+                if (count == 0)
+                {
+                    // No interrupt or all of them were delivered
+                    noticed_count = 0;
+                    continue;
+                }
+                if (count != noticed_count || generation != noticed_generation)
+                {
+                    noticed_count = count;
+                    noticed_generation = generation;
+                    interrupt_time = now;
+                    escalated = false;
+                }
+
+                bool escalate_now = !m_signals
+                    || (m_escalation_delay.count() > 0. && now - interrupt_time >= m_escalation_delay);
+                if (!escalated && escalate_now)
+                {
+                    escalated = true;
+                    lock.unlock();
+                    escalate(generation);
+                    lock.lock();
+                }
+            }
+        }
+
+        void xinterrupter::escalate(std::uint64_t generation)
+        {
+            if (!Py_IsInitialized())
+            {
+                return;
+            }
+            py::gil_scoped_acquire acquire;
+            // The cell cannot end while the GIL is held
+            if (m_executing.load() && m_generation.load() == generation)
+            {
+                PyThreadState_SetAsyncExc(m_python_thread, PyExc_KeyboardInterrupt);
+            }
+        }
+    }
+
+    void install_interrupt_handler()
+    {
+        xinterrupter::instance().install_handler();
+    }
+
+    void set_interrupt_options(double escalation_delay, double cell_timeout)
+    {
+        xinterrupter::instance().set_options(escalation_delay, cell_timeout);
+    }
+
+    void interrupt_execution()
+    {
+        xinterrupter::instance().interrupt();
+    }
+
+    bool execution_interrupted()
+    {
+        return xinterrupter::instance().interrupted();
+    }
+
+    void acknowledge_interrupt()
+    {
+        xinterrupter::instance().acknowledge();
+    }
+
+    /***************************************
+     * xdeferred_interrupts implementation *
+     ***************************************/
+
+    xdeferred_interrupts::xdeferred_interrupts()
+    {
+#ifndef _WIN32
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &set, &m_previous_mask);
+#endif
+    }
+
+    xdeferred_interrupts::~xdeferred_interrupts()
+    {
+#ifndef _WIN32
+        // The signals forwarded meanwhile are consumed, the interrupts being
+        // reported by execution_interrupted
+        if (!sigismember(&m_previous_mask, SIGINT))
+        {
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGINT);
+            sigset_t pending;
+            int sig = 0;
+            // A signal sent to the process stays pending when the other
+            // threads block it as well, the handler never saw it
+            while (sigpending(&pending) == 0 && sigismember(&pending, SIGINT) && sigwait(&set, &sig) == 0)
+            {
+                xinterrupter::instance().record_signal();
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &m_previous_mask, nullptr);
+#endif
+    }
+
+    /***********************************
+     * xinterrupt_scope implementation *
+     ***********************************/
+
+    xinterrupt_scope::xinterrupt_scope()
+    {
+        xinterrupter::instance().begin();
+    }
+
+    xinterrupt_scope::~xinterrupt_scope()
+    {
+        xinterrupter::instance().end();
+    }
+}
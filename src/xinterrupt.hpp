@@ -0,0 +1,93 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_INTERRUPT_HPP
+#define XPYT_INTERRUPT_HPP
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+namespace xpyt
+{
+    /*************
+     * interrupt *
+     *************/
+
+    // Installs a SIGINT handler forwarding the interrupts received by any
+    // thread to the thread running the cell, so that its blocking system
+    // calls return and the handler of Python is called there. Must be
+    // called with the GIL held, once Python has installed its own handler.
+    void install_interrupt_handler();
+
+    // If the cell is still running escalation_delay seconds after being
+    // interrupted and the interrupt was not delivered to the handler of
+    // Python, KeyboardInterrupt is injected in its thread with
+    // PyThreadState_SetAsyncExc. It is raised once the thread runs Python
+    // code again. The cells running longer than cell_timeout seconds are
+    // interrupted. 0 disables the escalation or the timeout, both are
+    // disabled by default.
+    void set_interrupt_options(double escalation_delay, double cell_timeout);
+
+    // Interrupts the running cell, can be called from any thread
+    void interrupt_execution();
+
+    // Whether the running cell has been interrupted and the interrupt not
+    // delivered yet, e.g. during a blocking input request
+    bool execution_interrupted();
+
+    // Marks the interrupts of the running cell as delivered, so that they
+    // are not escalated. Must be called with the GIL held, by the thread
+    // running the cell.
+    void acknowledge_interrupt();
+
+    /************************
+     * xdeferred_interrupts *
+     ************************/
+
+    // Blocks the interrupt signals in the current thread until its
+    // destruction, the interrupts received meanwhile being reported by
+    // execution_interrupted.
+    class xdeferred_interrupts
+    {
+    public:
+
+        xdeferred_interrupts();
+        ~xdeferred_interrupts();
+
+        xdeferred_interrupts(const xdeferred_interrupts&) = delete;
+        xdeferred_interrupts& operator=(const xdeferred_interrupts&) = delete;
+
+    private:
+
+#ifndef _WIN32
+        sigset_t m_previous_mask;
+#endif
+    };
+
+    /********************
+     * xinterrupt_scope *
+     ********************/
+
+    // Marks the current thread as running a cell until its destruction.
+    // Must be used with the GIL held.
+    class xinterrupt_scope
+    {
+    public:
+
+        xinterrupt_scope();
+        ~xinterrupt_scope();
+
+        xinterrupt_scope(const xinterrupt_scope&) = delete;
+        xinterrupt_scope& operator=(const xinterrupt_scope&) = delete;
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xkernel.hpp"
+#include "xeus/xkernel_configuration.hpp"
+#include "xeus/xserver.hpp"
+
+#include "xeus-python/xdebugger.hpp"
+#include "xeus-python/xhistory_manager.hpp"
+#include "xeus-python/xlauncher.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    using kernel_ptr = std::unique_ptr<xeus::xkernel>;
+
+    kernel_ptr make_python_kernel(const std::string& connection_filename,
+                                  std::unique_ptr<interpreter> interpreter,
+                                  std::unique_ptr<xeus::xlogger> logger,
+                                  nl::json debugger_config)
+    {
+        if (!connection_filename.empty())
+        {
+            xeus::xconfiguration config = xeus::load_configuration(connection_filename);
+            return kernel_ptr(new xeus::xkernel(config,
+                                                xeus::get_user_name(),
+                                                std::move(interpreter),
+                                                make_python_history_manager(),
+                                                std::move(logger),
+                                                xeus::make_xserver_shell_main,
+                                                make_python_debugger,
+                                                std::move(debugger_config)));
+        }
+        else
+        {
+            return kernel_ptr(new xeus::xkernel(xeus::get_user_name(),
+                                                std::move(interpreter),
+                                                make_python_history_manager(),
+                                                std::move(logger),
+                                                xeus::make_xserver_shell_main,
+                                                make_python_debugger,
+                                                std::move(debugger_config)));
+        }
+    }
+
+    void print_startup_message(xeus::xkernel& kernel, const std::string& connection_filename)
+    {
+        if (!connection_filename.empty())
+        {
+            std::clog <<
+                "Starting xeus-python kernel...\n\n"
+                "If you want to connect to this kernel from an other client, you can use"
+                " the " + connection_filename + " file."
+                << std::endl;
+        }
+        else
+        {
+            const auto& config = kernel.get_config();
+            std::clog <<
+                "Starting xeus-python kernel...\n\n"
+                "If you want to connect to this kernel from an other client, just copy"
+                " and paste the following content inside of a `kernel.json` file. And then run for example:\n\n"
+                "# jupyter console --existing kernel.json\n\n"
+                "kernel.json\n```\n{\n"
+                "    \"transport\": \"" + config.m_transport + "\",\n"
+                "    \"ip\": \"" + config.m_ip + "\",\n"
+                "    \"control_port\": " + config.m_control_port + ",\n"
+                "    \"shell_port\": " + config.m_shell_port + ",\n"
+                "    \"stdin_port\": " + config.m_stdin_port + ",\n"
+                "    \"iopub_port\": " + config.m_iopub_port + ",\n"
+                "    \"hb_port\": " + config.m_hb_port + ",\n"
+                "    \"signature_scheme\": \"" + config.m_signature_scheme + "\",\n"
+                "    \"key\": \"" + config.m_key + "\"\n"
+                "}\n```"
+                << std::endl;
+        }
+    }
+}
@@ -0,0 +1,334 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "xlog_sink.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /*************************
+     * xlog_sink declaration *
+     *************************/
+
+    namespace
+    {
+        struct xlog_entry
+        {
+            xlog_target m_target = xlog_target::terminal;
+            std::string m_message;
+        };
+
+        // Bounded multi-producer ring buffer, each slot holding a sequence
+        // number telling whether it is free or filled for a given position.
+        // The single consumer is the writer thread.
+        class xlog_sink
+        {
+        public:
+
+            static xlog_sink& instance();
+
+            bool push(xlog_entry entry);
+            void wait_until_written(std::chrono::duration<double> timeout);
+
+            void set_file(const std::string& path);
+
+            std::atomic<int> m_level{0};
+            std::atomic<std::size_t> m_sample_rate{1};
+            std::atomic<std::uint64_t> m_sample_counter{0};
+            std::atomic<std::uint64_t> m_written{0};
+            std::atomic<std::uint64_t> m_dropped{0};
+            std::atomic<std::uint64_t> m_sampled_out{0};
+
+        private:
+
+            struct xslot
+            {
+                std::atomic<std::size_t> m_sequence;
+                xlog_entry m_entry;
+            };
+
+            static constexpr std::size_t capacity = 4096;
+
+            xlog_sink();
+
+            static xlog_sink*& instance_ptr();
+            static void reset_after_fork();
+
+            bool pop(xlog_entry& entry);
+            bool empty() const;
+            void start();
+            void run();
+            void write(const xlog_entry& entry);
+
+            std::unique_ptr<xslot[]> p_slots;
+            std::atomic<std::size_t> m_enqueue_pos{0};
+            std::atomic<std::size_t> m_dequeue_pos{0};
+            std::atomic<bool> m_sleeping{false};
+            std::once_flag m_started;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::condition_variable m_written_cv;
+            std::string m_file_path;
+            std::ofstream m_file;
+            std::uint64_t m_reported_drops = 0;
+        };
+
+        /****************************
+         * xlog_sink implementation *
+         ****************************/
+
+        xlog_sink::xlog_sink()
+            : p_slots(new xslot[capacity])
+        {
+            for (std::size_t i = 0; i < capacity; ++i)
+            {
+                p_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        xlog_sink& xlog_sink::instance()
+        {
+            return *instance_ptr();
+        }
+
+        xlog_sink*& xlog_sink::instance_ptr()
+        {
+            // Leaked, the writer thread may still log during the exit
+            static xlog_sink* sink = new xlog_sink();
+            return sink;
+        }
+
+        void xlog_sink::reset_after_fork()
+        {
+            // The writer thread of the parent does not exist in the child
+            // process, the sink is replaced with the same settings.
+            xlog_sink& old_sink = instance();
+            xlog_sink* sink = new xlog_sink();
+            sink->m_level.store(old_sink.m_level.load());
+            sink->m_sample_rate.store(old_sink.m_sample_rate.load());
+            sink->m_file_path = old_sink.m_file_path;
+            instance_ptr() = sink;
+        }
+
+        bool xlog_sink::push(xlog_entry entry)
+        {
+            std::call_once(m_started, &xlog_sink::start, this);
+
+            std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            xslot* slot = nullptr;
+            while (true)
+            {
+                slot = &p_slots[pos % capacity];
+                std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0)
+                {
+                    if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // The buffer is full
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            slot->m_entry = std::move(entry);
+            slot->m_sequence.store(pos + 1, std::memory_order_release);
+
+            if (m_sleeping.exchange(false))
+            {
+                m_cv.notify_one();
+            }
+            return true;
+        }
+
+        bool xlog_sink::pop(xlog_entry& entry)
+        {
+            std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            xslot& slot = p_slots[pos % capacity];
+            std::size_t sequence = slot.m_sequence.load(std::memory_order_acquire);
+            if (sequence != pos + 1)
+            {
+                return false;
+            }
+            entry = std::move(slot.m_entry);
+            slot.m_entry.m_message.clear();
+            slot.m_sequence.store(pos + capacity, std::memory_order_release);
+            m_dequeue_pos.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool xlog_sink::empty() const
+        {
+            return m_dequeue_pos.load(std::memory_order_acquire) == m_enqueue_pos.load(std::memory_order_acquire);
+        }
+
+        void xlog_sink::start()
+        {
+#ifndef _WIN32
+            static bool atfork_registered = (pthread_atfork(nullptr, nullptr, &xlog_sink::reset_after_fork) == 0);
+            (void)atfork_registered;
+#endif
+            std::thread(&xlog_sink::run, this).detach();
+        }
+
+        void xlog_sink::set_file(const std::string& path)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_file_path = path;
+        }
+
+        void xlog_sink::wait_until_written(std::chrono::duration<double> timeout)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_written_cv.wait_for(lock, timeout, [this]() { return empty(); });
+        }
+
+        void xlog_sink::run()
+        {
+            xlog_entry entry;
+            while (true)
+            {
+                bool written = false;
+                while (pop(entry))
+                {
+                    write(entry);
+                    written = true;
+                }
+
+                std::uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+                if (dropped != m_reported_drops)
+                {
+                    std::cout << "[" << dropped - m_reported_drops << " log messages dropped]" << std::endl;
+                    m_reported_drops = dropped;
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (written)
+                {
+                    std::cout.flush();
+                    if (m_file.is_open())
+                    {
+                        m_file.flush();
+                    }
+                    m_written_cv.notify_all();
+                }
+
+                // A message pushed after this check wakes the thread up, the
+                // timeout bounding the delay of a missed notification
+                m_sleeping.store(true);
+                if (empty())
+                {
+                    m_cv.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                m_sleeping.store(false);
+            }
+        }
+
+        void xlog_sink::write(const xlog_entry& entry)
+        {
+            if (entry.m_target == xlog_target::terminal)
+            {
+                std::cout << entry.m_message;
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_file.is_open() && !m_file_path.empty())
+                {
+                    m_file.open(m_file_path, std::ios::app);
+                }
+                m_file << entry.m_message;
+            }
+            m_written.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void set_log_sink_options(int level, std::size_t sample_rate)
+    {
+        xlog_sink& sink = xlog_sink::instance();
+        sink.m_level.store(level);
+        sink.m_sample_rate.store(sample_rate != 0 ? sample_rate : 1);
+    }
+
+    void set_log_file(const std::string& path)
+    {
+        xlog_sink::instance().set_file(path);
+    }
+
+    bool log_level_enabled(int level)
+    {
+        return level >= xlog_sink::instance().m_level.load(std::memory_order_relaxed);
+    }
+
+    void write_log(xlog_target target, int level, std::string message)
+    {
+        xlog_sink& sink = xlog_sink::instance();
+        if (level < sink.m_level.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        std::size_t sample_rate = sink.m_sample_rate.load(std::memory_order_relaxed);
+        if (level < log_level_warning && sample_rate > 1
+            && sink.m_sample_counter.fetch_add(1, std::memory_order_relaxed) % sample_rate != 0)
+        {
+            sink.m_sampled_out.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        xlog_entry entry;
+        entry.m_target = target;
+        entry.m_message = std::move(message);
+        sink.push(std::move(entry));
+    }
+
+    void flush_log_sink(double timeout)
+    {
+        xlog_sink::instance().wait_until_written(std::chrono::duration<double>(timeout));
+    }
+
+    nl::json log_sink_stats()
+    {
+        xlog_sink& sink = xlog_sink::instance();
+        return {
+            {"written", sink.m_written.load()},
+            {"dropped", sink.m_dropped.load()},
+            {"sampled_out", sink.m_sampled_out.load()}
+        };
+    }
+}
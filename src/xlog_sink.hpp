@@ -0,0 +1,56 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_LOG_SINK_HPP
+#define XPYT_LOG_SINK_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /************
+     * log sink *
+     ************/
+
+    // Asynchronous sink of the logs of the kernel: the messages are pushed
+    // in a lock-free ring buffer, and written to the terminal or to the log
+    // file by a background thread. The messages pushed while the buffer is
+    // full are dropped and counted. The levels are the ones of the Python
+    // logging module.
+
+    enum class xlog_target
+    {
+        terminal,
+        file
+    };
+
+    constexpr int log_level_info = 20;
+    constexpr int log_level_warning = 30;
+
+    // Messages below level are discarded, and one in sample_rate
+    // messages below the warning level is kept
+    void set_log_sink_options(int level, std::size_t sample_rate);
+    void set_log_file(const std::string& path);
+
+    bool log_level_enabled(int level);
+    void write_log(xlog_target target, int level, std::string message);
+
+    // Waits until the pending messages are written, at most timeout seconds
+    void flush_log_sink(double timeout);
+
+    nl::json log_sink_stats();
+}
+
+#endif
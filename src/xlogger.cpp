@@ -0,0 +1,153 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xlogger.hpp"
+#include "xeus/xmessage.hpp"
+
+#include "xeus-python/xlogger.hpp"
+
+#include "xlog_sink.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /*****************************
+     * xasync_logger declaration *
+     *****************************/
+
+    namespace
+    {
+        class xasync_logger : public xeus::xlogger
+        {
+        public:
+
+            xasync_logger(xlogger::level log_level, xlog_target target, std::unique_ptr<xlogger> next);
+            virtual ~xasync_logger() = default;
+
+        private:
+
+            void log_received_message_impl(const xeus::xmessage& message, xlogger::channel c) const override;
+            void log_sent_message_impl(const xeus::xmessage& message, xlogger::channel c) const override;
+            void log_iopub_message_impl(const xeus::xpub_message& message) const override;
+            void log_message_impl(const std::string& socket_info, const nl::json& json_message) const override;
+
+            template <class M>
+            void log(const std::string& socket_info, const M& message) const;
+
+            static std::string channel_name(xlogger::channel c);
+
+            xlogger::level m_level;
+            xlog_target m_target;
+            std::unique_ptr<xlogger> p_next;
+        };
+
+        /********************************
+         * xasync_logger implementation *
+         ********************************/
+
+        xasync_logger::xasync_logger(xlogger::level log_level, xlog_target target, std::unique_ptr<xlogger> next)
+            : m_level(log_level)
+            , m_target(target)
+            , p_next(std::move(next))
+        {
+        }
+
+        void xasync_logger::log_received_message_impl(const xeus::xmessage& message, xlogger::channel c) const
+        {
+            log("XEUS: received message on " + channel_name(c) + " socket", message);
+            if (p_next)
+            {
+                p_next->log_received_message(message, c);
+            }
+        }
+
+        void xasync_logger::log_sent_message_impl(const xeus::xmessage& message, xlogger::channel c) const
+        {
+            log("XEUS: sent message on " + channel_name(c) + " socket", message);
+            if (p_next)
+            {
+                p_next->log_sent_message(message, c);
+            }
+        }
+
+        void xasync_logger::log_iopub_message_impl(const xeus::xpub_message& message) const
+        {
+            log("XEUS: sent message on iopub socket", message);
+            if (p_next)
+            {
+                p_next->log_iopub_message(message);
+            }
+        }
+
+        void xasync_logger::log_message_impl(const std::string& socket_info, const nl::json& json_message) const
+        {
+            if (m_level != xlogger::none && log_level_enabled(log_level_info))
+            {
+                write_log(m_target, log_level_info, socket_info + "\n" + json_message.dump(4) + "\n");
+            }
+            if (p_next)
+            {
+                p_next->log_message(socket_info, json_message);
+            }
+        }
+
+        template <class M>
+        void xasync_logger::log(const std::string& socket_info, const M& message) const
+        {
+            // The messages are formatted only if the sink keeps them
+            if (m_level == xlogger::none || !log_level_enabled(log_level_info))
+            {
+                return;
+            }
+
+            std::string text = socket_info + ": " + message.header().value("msg_type", "") + "\n";
+            if (m_level >= xlogger::content)
+            {
+                text += "content: " + message.content().dump(4) + "\n";
+            }
+            if (m_level >= xlogger::full)
+            {
+                text += "header: " + message.header().dump(4) + "\n";
+                text += "parent header: " + message.parent_header().dump(4) + "\n";
+                text += "metadata: " + message.metadata().dump(4) + "\n";
+            }
+            write_log(m_target, log_level_info, std::move(text));
+        }
+
+        std::string xasync_logger::channel_name(xlogger::channel c)
+        {
+            static const char* names[] = {"shell", "control", "stdin"};
+            std::size_t index = static_cast<std::size_t>(c);
+            return index < sizeof(names) / sizeof(names[0]) ? names[index] : "unknown";
+        }
+    }
+
+    std::unique_ptr<xeus::xlogger> make_async_console_logger(xeus::xlogger::level log_level,
+                                                             std::unique_ptr<xeus::xlogger> next)
+    {
+        return std::unique_ptr<xeus::xlogger>(new xasync_logger(log_level, xlog_target::terminal, std::move(next)));
+    }
+
+    std::unique_ptr<xeus::xlogger> make_async_file_logger(xeus::xlogger::level log_level,
+                                                          const std::string& file_name,
+                                                          std::unique_ptr<xeus::xlogger> next)
+    {
+        set_log_file(file_name);
+        return std::unique_ptr<xeus::xlogger>(new xasync_logger(log_level, xlog_target::file, std::move(next)));
+    }
+}
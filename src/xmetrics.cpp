@@ -0,0 +1,372 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xsystem.hpp"
+
+#include "xmetrics.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    namespace
+    {
+        const char* metric_names[] = {
+            "execute_request",
+            "complete_request",
+            "inspect_request",
+            "is_complete_request",
+            "kernel_info_request",
+            "internal_request",
+            "execute_gil",
+            "complete_gil",
+            "inspect_gil",
+            "is_complete_gil",
+            "internal_gil",
+            "run_cell",
+            "payload",
+            "user_expressions",
+            "traceback",
+            "publish_stream",
+            "display_data",
+            "execution_result",
+            "comm_send"
+        };
+
+        constexpr std::size_t metric_count = static_cast<std::size_t>(xmetric::count);
+        static_assert(sizeof(metric_names) / sizeof(metric_names[0]) == metric_count,
+                      "every metric must have a name");
+
+        // Upper bounds of the histogram buckets in nanoseconds, the last
+        // bucket holding the samples above the last bound.
+        constexpr std::array<std::uint64_t, 19> bucket_bounds = {{
+            10000, 25000, 50000,
+            100000, 250000, 500000,
+            1000000, 2500000, 5000000,
+            10000000, 25000000, 50000000,
+            100000000, 250000000, 500000000,
+            1000000000, 2500000000, 5000000000,
+            10000000000
+        }};
+
+        struct xmetric_data
+        {
+            std::atomic<std::uint64_t> m_count;
+            std::atomic<std::uint64_t> m_total_ns;
+            std::atomic<std::uint64_t> m_max_ns;
+            std::array<std::atomic<std::uint64_t>, bucket_bounds.size() + 1> m_buckets;
+        };
+
+        std::atomic<bool>& get_metrics_flag()
+        {
+            static std::atomic<bool> enabled(false);
+            return enabled;
+        }
+
+        std::array<xmetric_data, metric_count>& get_metrics_data()
+        {
+            // Zero-initialized as a static object
+            static std::array<xmetric_data, metric_count> data;
+            return data;
+        }
+    }
+
+    bool metrics_enabled()
+    {
+        return get_metrics_flag().load(std::memory_order_relaxed);
+    }
+
+    void set_metrics_enabled(bool enabled)
+    {
+        get_metrics_flag().store(enabled, std::memory_order_relaxed);
+    }
+
+    void reset_metrics()
+    {
+        for (xmetric_data& data : get_metrics_data())
+        {
+            data.m_count.store(0, std::memory_order_relaxed);
+            data.m_total_ns.store(0, std::memory_order_relaxed);
+            data.m_max_ns.store(0, std::memory_order_relaxed);
+            for (auto& bucket : data.m_buckets)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void record_metric(xmetric metric, std::chrono::nanoseconds duration)
+    {
+        std::uint64_t ns = static_cast<std::uint64_t>(duration.count());
+        xmetric_data& data = get_metrics_data()[static_cast<std::size_t>(metric)];
+        data.m_count.fetch_add(1, std::memory_order_relaxed);
+        data.m_total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        std::uint64_t max_ns = data.m_max_ns.load(std::memory_order_relaxed);
+        while (ns > max_ns && !data.m_max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed))
+        {
+        }
+
+        std::size_t bucket = 0;
+        while (bucket < bucket_bounds.size() && ns > bucket_bounds[bucket])
+        {
+            ++bucket;
+        }
+        data.m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    nl::json metrics_to_json()
+    {
+        nl::json res = nl::json::object();
+        res["enabled"] = metrics_enabled();
+        nl::json& metrics = res["metrics"] = nl::json::object();
+        const auto& all_data = get_metrics_data();
+        for (std::size_t i = 0; i < metric_count; ++i)
+        {
+            const xmetric_data& data = all_data[i];
+            std::uint64_t count = data.m_count.load(std::memory_order_relaxed);
+            double total = static_cast<double>(data.m_total_ns.load(std::memory_order_relaxed)) * 1e-9;
+
+            nl::json buckets = nl::json::array();
+            std::uint64_t cumulative = 0;
+            for (std::size_t j = 0; j < data.m_buckets.size(); ++j)
+            {
+                cumulative += data.m_buckets[j].load(std::memory_order_relaxed);
+                nl::json bound = j < bucket_bounds.size() ? nl::json(static_cast<double>(bucket_bounds[j]) * 1e-9) : nl::json("+Inf");
+                buckets.push_back({bound, cumulative});
+            }
+
+            metrics[metric_names[i]] = {
+                {"count", count},
+                {"total_s", total},
+                {"mean_s", count != 0 ? total / static_cast<double>(count) : 0.},
+                {"max_s", static_cast<double>(data.m_max_ns.load(std::memory_order_relaxed)) * 1e-9},
+                {"buckets", std::move(buckets)}
+            };
+        }
+        return res;
+    }
+
+    std::string metrics_to_prometheus()
+    {
+        std::ostringstream out;
+        out << "# HELP xeus_python_duration_seconds Time spent in the instrumented sections of the kernel.\n";
+        out << "# TYPE xeus_python_duration_seconds histogram\n";
+        const auto& all_data = get_metrics_data();
+        for (std::size_t i = 0; i < metric_count; ++i)
+        {
+            const xmetric_data& data = all_data[i];
+            std::string label = std::string("section=\"") + metric_names[i] + "\"";
+            std::uint64_t cumulative = 0;
+            for (std::size_t j = 0; j < data.m_buckets.size(); ++j)
+            {
+                cumulative += data.m_buckets[j].load(std::memory_order_relaxed);
+                out << "xeus_python_duration_seconds_bucket{" << label << ",le=\"";
+                if (j < bucket_bounds.size())
+                {
+                    out << static_cast<double>(bucket_bounds[j]) * 1e-9;
+                }
+                else
+                {
+                    out << "+Inf";
+                }
+                out << "\"} " << cumulative << '\n';
+            }
+            out << "xeus_python_duration_seconds_sum{" << label << "} "
+                << static_cast<double>(data.m_total_ns.load(std::memory_order_relaxed)) * 1e-9 << '\n';
+            out << "xeus_python_duration_seconds_count{" << label << "} "
+                << data.m_count.load(std::memory_order_relaxed) << '\n';
+        }
+        return out.str();
+    }
+
+    /***********************
+     * metrics dump thread *
+     ***********************/
+
+    namespace
+    {
+        class xmetrics_dumper
+        {
+        public:
+
+            static xmetrics_dumper& instance();
+            static void restart_after_fork();
+
+            void configure(const std::string& path, double interval, const std::string& format);
+
+        private:
+
+            xmetrics_dumper() = default;
+
+            static xmetrics_dumper*& instance_ptr();
+
+            void run();
+            void dump(const std::string& path, const std::string& format) const;
+
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::string m_path;
+            std::string m_format;
+            std::chrono::duration<double> m_interval;
+            bool m_started = false;
+        };
+
+        xmetrics_dumper& xmetrics_dumper::instance()
+        {
+            return *instance_ptr();
+        }
+
+        xmetrics_dumper*& xmetrics_dumper::instance_ptr()
+        {
+            // Leaked, the dump thread keeps running until the exit
+            static xmetrics_dumper* dumper = new xmetrics_dumper();
+            return dumper;
+        }
+
+        void xmetrics_dumper::restart_after_fork()
+        {
+            xmetrics_dumper& old_dumper = instance();
+            xmetrics_dumper* dumper = new xmetrics_dumper();
+            instance_ptr() = dumper;
+            if (!old_dumper.m_path.empty())
+            {
+                dumper->configure(old_dumper.m_path, old_dumper.m_interval.count(), old_dumper.m_format);
+            }
+        }
+
+        void xmetrics_dumper::configure(const std::string& path, double interval, const std::string& format)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_path = path;
+                m_format = format;
+                m_interval = std::chrono::duration<double>(interval > 0. ? interval : 1.);
+                if (!m_started && !m_path.empty())
+                {
+                    m_started = true;
+                    std::thread(&xmetrics_dumper::run, this).detach();
+                }
+            }
+            m_cv.notify_one();
+        }
+
+        void xmetrics_dumper::run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                m_cv.wait_for(lock, m_interval);
+                if (m_path.empty() || !metrics_enabled())
+                {
+                    continue;
+                }
+                std::string path = m_path;
+                std::string format = m_format;
+                lock.unlock();
+                dump(path, format);
+                lock.lock();
+            }
+        }
+
+        void xmetrics_dumper::dump(const std::string& path, const std::string& format) const
+        {
+            std::string target = path;
+            std::size_t pos = target.find("{pid}");
+            if (pos != std::string::npos)
+            {
+                target.replace(pos, 5, std::to_string(xeus::get_current_pid()));
+            }
+
+            // Written in a temporary file first so that readers
+            // never see a partially written file
+            std::string tmp_target = target + ".tmp";
+            {
+                std::ofstream out(tmp_target);
+                if (format == "prometheus")
+                {
+                    out << metrics_to_prometheus();
+                }
+                else
+                {
+                    out << metrics_to_json().dump();
+                }
+            }
+            if (std::rename(tmp_target.c_str(), target.c_str()) != 0)
+            {
+                std::clog << "Could not write the metrics to " << target << std::endl;
+            }
+        }
+    }
+
+    void set_metrics_dump(const std::string& path, double interval, const std::string& format)
+    {
+        xmetrics_dumper::instance().configure(path, interval, format);
+    }
+
+    void restart_metrics_dump_after_fork()
+    {
+        xmetrics_dumper::restart_after_fork();
+    }
+
+    /********************************
+     * xmetric_timer implementation *
+     ********************************/
+
+    xmetric_timer::xmetric_timer(xmetric metric)
+        : m_metric(metric)
+        , m_running(metrics_enabled())
+    {
+        if (m_running)
+        {
+            m_start = clock_type::now();
+        }
+    }
+
+    xmetric_timer::~xmetric_timer()
+    {
+        stop();
+    }
+
+    void xmetric_timer::stop()
+    {
+        if (m_running)
+        {
+            m_running = false;
+            record_metric(m_metric, std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - m_start));
+        }
+    }
+
+    /*************************************
+     * xtimed_gil_acquire implementation *
+     *************************************/
+
+    xtimed_gil_acquire::xtimed_gil_acquire(xmetric metric)
+        : m_timer(metric)
+        , m_acquire()
+    {
+        m_timer.stop();
+    }
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_METRICS_HPP
+#define XPYT_METRICS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /***********
+     * metrics *
+     ***********/
+
+    // Instrumented sections of the kernel. The *_gil metrics measure
+    // the time spent waiting for the GIL at the beginning of a request.
+    enum class xmetric : std::size_t
+    {
+        execute_request,
+        complete_request,
+        inspect_request,
+        is_complete_request,
+        kernel_info_request,
+        internal_request,
+        execute_gil,
+        complete_gil,
+        inspect_gil,
+        is_complete_gil,
+        internal_gil,
+        run_cell,
+        payload,
+        user_expressions,
+        traceback,
+        publish_stream,
+        display_data,
+        execution_result,
+        comm_send,
+        count
+    };
+
+    bool metrics_enabled();
+    void set_metrics_enabled(bool enabled);
+    void reset_metrics();
+
+    void record_metric(xmetric metric, std::chrono::nanoseconds duration);
+
+    nl::json metrics_to_json();
+    std::string metrics_to_prometheus();
+
+    // Writes the metrics to path every interval seconds, in the "json" or
+    // "prometheus" format. "{pid}" in the path is replaced with the process
+    // id. An empty path stops the dumps.
+    void set_metrics_dump(const std::string& path, double interval, const std::string& format);
+
+    // The dump thread does not survive a fork, it is restarted in the child
+    void restart_metrics_dump_after_fork();
+
+    /*****************
+     * xmetric_timer *
+     *****************/
+
+    // Records the time spent between its construction and its destruction,
+    // or the call to stop. Does nothing when the metrics are disabled.
+    class xmetric_timer
+    {
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+
+        explicit xmetric_timer(xmetric metric);
+        ~xmetric_timer();
+
+        xmetric_timer(const xmetric_timer&) = delete;
+        xmetric_timer& operator=(const xmetric_timer&) = delete;
+
+        void stop();
+
+    private:
+
+        clock_type::time_point m_start;
+        xmetric m_metric;
+        bool m_running;
+    };
+
+    /**********************
+     * xtimed_gil_acquire *
+     **********************/
+
+    // gil_scoped_acquire recording the time spent waiting for the GIL
+    class xtimed_gil_acquire
+    {
+    public:
+
+        explicit xtimed_gil_acquire(xmetric metric);
+
+    private:
+
+        xmetric_timer m_timer;
+        py::gil_scoped_acquire m_acquire;
+    };
+}
+
+#endif
@@ -0,0 +1,147 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <fstream>
+#include <string>
+
+#include "pybind11/pybind11.h"
+
+#include "xtl/xsystem.hpp"
+
+#include "xeus-python/xeus_python_config.hpp"
+#include "xeus-python/xutils.hpp"
+
+#include "xmodule_bundle.hpp"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    std::string get_module_bundle_path()
+    {
+#if defined(XPYT_MODULE_BUNDLE_RELPATH)
+        return xtl::prefix_path() + XPYT_STRINGIFY(XPYT_MODULE_BUNDLE_RELPATH);
+#else
+        return std::string();
+#endif
+    }
+
+    bool install_module_bundle(const std::string& path)
+    {
+        if (path.empty() || !std::ifstream(path))
+        {
+            return false;
+        }
+
+        py::dict scope;
+        exec(py::str(R"(
+import marshal
+import os
+import sys
+from importlib.machinery import ModuleSpec, PathFinder
+from importlib.util import MAGIC_NUMBER
+
+
+class XBundleLoader:
+    def __init__(self, code):
+        self._code = code
+
+    def create_module(self, spec):
+        return None
+
+    def exec_module(self, module):
+        code, self._code = self._code, None
+        exec(marshal.loads(code), module.__dict__)
+
+
+class XBundleFinder:
+    """Serves the modules of the bundle from memory. The modules keep the
+    path of their sources, the data files and the modules missing from the
+    bundle being still found on the filesystem.
+
+    The modules of a top-level package are only served if the current path
+    resolves the package to the bundled source, and if that source has the
+    size and modification time recorded in the bundle. Otherwise, e.g. when
+    PYTHONPATH, a virtual environment or the user site provides another
+    copy, or when the package was updated, they are imported from the
+    filesystem."""
+
+    def __init__(self, modules, fingerprints):
+        self._modules = modules
+        self._fingerprints = fingerprints
+        self._valid = {}
+
+    def _is_valid(self, top):
+        valid = self._valid.get(top)
+        if valid is None:
+            valid = self._check_fingerprint(top)
+            self._valid[top] = valid
+        return valid
+
+    def _check_fingerprint(self, top):
+        fingerprint = self._fingerprints.get(top)
+        if fingerprint is None:
+            return False
+        origin, mtime, size = fingerprint
+        spec = PathFinder.find_spec(top)
+        if spec is None or not spec.origin or os.path.normcase(os.path.abspath(spec.origin)) != origin:
+            return False
+        try:
+            stat = os.stat(origin)
+        except OSError:
+            return False
+        return stat.st_mtime_ns == mtime and stat.st_size == size
+
+    def find_spec(self, fullname, path=None, target=None):
+        entry = self._modules.get(fullname)
+        if entry is None or not self._is_valid(fullname.partition('.')[0]):
+            return None
+        is_package, origin, code = entry
+        if path is not None:
+            # A submodule, resolved in the search locations of its parent
+            location = os.path.dirname(origin)
+            if is_package:
+                location = os.path.dirname(location)
+            if location not in path:
+                return None
+        del self._modules[fullname]
+        spec = ModuleSpec(fullname, XBundleLoader(code), origin=origin, is_package=is_package)
+        spec.has_location = True
+        if is_package:
+            spec.submodule_search_locations = [os.path.dirname(origin)]
+        return spec
+
+    def invalidate_caches(self):
+        self._valid.clear()
+
+
+def install_module_bundle(path):
+    # The whole bundle is read at once, the modules being
+    # unmarshalled when they are imported
+    with open(path, 'rb') as f:
+        bundle = marshal.load(f)
+    if bundle.get('magic') != MAGIC_NUMBER or 'fingerprints' not in bundle:
+        return False
+    finder = XBundleFinder(bundle['modules'], bundle['fingerprints'])
+    index = sys.meta_path.index(PathFinder) if PathFinder in sys.meta_path else len(sys.meta_path)
+    sys.meta_path.insert(index, finder)
+    return True
+        )"), scope);
+
+        try
+        {
+            return scope["install_module_bundle"](path).cast<bool>();
+        }
+        catch (py::error_already_set&)
+        {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_MODULE_BUNDLE_HPP
+#define XPYT_MODULE_BUNDLE_HPP
+
+#include <string>
+
+namespace xpyt
+{
+    // Path of the bundle of the modules imported at startup,
+    // installed with the executable
+    std::string get_module_bundle_path();
+
+    // Adds an import hook serving the modules of the bundle from memory.
+    // Returns false if the bundle is missing or was built for another
+    // Python version. Must be called with the GIL held.
+    bool install_module_bundle(const std::string& path);
+}
+
+#endif
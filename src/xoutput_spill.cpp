@@ -0,0 +1,586 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xsystem.hpp"
+
+#include "pybind11/pybind11.h"
+#include "pybind11_json/pybind11_json.hpp"
+
+#include "xinternal_utils.hpp"
+#include "xoutput_spill.hpp"
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    namespace
+    {
+        struct xoutput_budget
+        {
+            std::size_t m_max_message_size = 0;
+            std::size_t m_max_cell_size = 0;
+            std::size_t m_preview_size = 4096;
+            std::size_t m_max_spill_size = 1024 * 1024 * 1024;
+        };
+
+        struct xspilled_part
+        {
+            std::string m_key;
+            std::string m_path;
+            std::size_t m_size;
+        };
+
+        // Spill file of a stream which exceeded the budget of the cell,
+        // kept open until the end of the cell
+        struct xstream_overflow
+        {
+            std::string m_output_id;
+            std::ofstream m_file;
+        };
+
+        // Output published by the current cell, the streams which exceeded
+        // the budget of the cell being appended to their spill file.
+        struct xcell_output_usage
+        {
+            std::size_t m_size = 0;
+            std::map<std::string, xstream_overflow> m_stream_overflows;
+        };
+
+        xoutput_budget& get_output_budget()
+        {
+            static xoutput_budget budget;
+            return budget;
+        }
+
+        xcell_output_usage& get_cell_output_usage()
+        {
+            static xcell_output_usage usage;
+            return usage;
+        }
+
+        bool is_stream_overflow(const std::string& output_id)
+        {
+            for (const auto& overflow : get_cell_output_usage().m_stream_overflows)
+            {
+                if (overflow.second.m_output_id == output_id)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // The spilled outputs, with the ids from the least recently
+        // used to the most recently used one
+        struct xspill_registry
+        {
+            std::map<std::string, std::vector<xspilled_part>> m_outputs;
+            std::list<std::string> m_recency;
+            std::size_t m_total_size = 0;
+        };
+
+        xspill_registry& get_spill_registry()
+        {
+            static xspill_registry registry;
+            return registry;
+        }
+
+        std::map<std::string, std::vector<xspilled_part>>& get_spilled_output_registry()
+        {
+            return get_spill_registry().m_outputs;
+        }
+
+        void touch_spilled_output(const std::string& output_id)
+        {
+            std::list<std::string>& recency = get_spill_registry().m_recency;
+            recency.remove(output_id);
+            recency.push_back(output_id);
+        }
+
+        void remove_spilled_output(const std::string& output_id)
+        {
+            xspill_registry& registry = get_spill_registry();
+            auto output = registry.m_outputs.find(output_id);
+            if (output != registry.m_outputs.end())
+            {
+                for (const xspilled_part& part : output->second)
+                {
+                    std::remove(part.m_path.c_str());
+                    registry.m_total_size -= part.m_size;
+                }
+                registry.m_outputs.erase(output);
+            }
+            registry.m_recency.remove(output_id);
+        }
+
+        // Removes the least recently used outputs until the spill files fit
+        // in the budget. The most recent output and the outputs the streams
+        // of the current cell are appended to are kept.
+        void enforce_spill_size()
+        {
+            std::size_t max_size = get_output_budget().m_max_spill_size;
+            xspill_registry& registry = get_spill_registry();
+            if (max_size == 0 || registry.m_recency.empty())
+            {
+                return;
+            }
+
+            auto it = registry.m_recency.begin();
+            auto last = std::prev(registry.m_recency.end());
+            while (registry.m_total_size > max_size && it != last)
+            {
+                std::string output_id = *it++;
+                if (!is_stream_overflow(output_id))
+                {
+                    remove_spilled_output(output_id);
+                }
+            }
+        }
+
+        bool budget_enabled()
+        {
+            const xoutput_budget& budget = get_output_budget();
+            return budget.m_max_message_size != 0 || budget.m_max_cell_size != 0;
+        }
+
+        std::string new_spilled_output()
+        {
+            static bool directory_created = xeus::create_directory(get_tmp_prefix());
+            (void)directory_created;
+            // The spill files are removed when the interpreter is finalized
+            static bool cleanup_registered = (py::module::import("atexit").attr("register")(py::cpp_function(&clear_spilled_outputs)), true);
+            (void)cleanup_registered;
+            static std::size_t counter = 0;
+            std::string output_id = std::to_string(++counter);
+            get_spilled_output_registry()[output_id];
+            touch_spilled_output(output_id);
+            return output_id;
+        }
+
+        // Creates a new part of the output, its content being written to
+        // out by write which returns its size. The file is left open.
+        template <class F>
+        std::string add_spilled_part(const std::string& output_id, const std::string& key, std::ofstream& out, F write)
+        {
+            std::vector<xspilled_part>& parts = get_spilled_output_registry()[output_id];
+            std::string path = get_tmp_prefix() + "output_" + output_id + "_" + std::to_string(parts.size()) + ".spill";
+            out.open(path, std::ios::binary | std::ios::trunc);
+            std::size_t size = write(out);
+            out.flush();
+            if (!out)
+            {
+                std::clog << "Could not write the output to " << path << std::endl;
+                out.close();
+                std::remove(path.c_str());
+                return "<unavailable>";
+            }
+            parts.push_back({key, path, size});
+            get_spill_registry().m_total_size += size;
+            return path;
+        }
+
+        void append_spilled_part(xstream_overflow& overflow, const std::string& message)
+        {
+            std::vector<xspilled_part>& parts = get_spilled_output_registry()[overflow.m_output_id];
+            if (parts.empty() || !overflow.m_file.is_open())
+            {
+                return;
+            }
+
+            // Flushed so that the content can be read while the cell runs
+            overflow.m_file.write(message.data(), static_cast<std::streamsize>(message.size()));
+            overflow.m_file.flush();
+            if (!overflow.m_file)
+            {
+                std::clog << "Could not write the output to " << parts.back().m_path << std::endl;
+                overflow.m_file.close();
+                return;
+            }
+            parts.back().m_size += message.size();
+            get_spill_registry().m_total_size += message.size();
+            touch_spilled_output(overflow.m_output_id);
+            enforce_spill_size();
+        }
+
+        // Truncates text without splitting a UTF-8 sequence
+        std::string truncate_utf8(const char* text, std::size_t text_size, std::size_t size)
+        {
+            if (text_size <= size)
+            {
+                return std::string(text, text_size);
+            }
+            while (size > 0 && (static_cast<unsigned char>(text[size]) & 0xC0) == 0x80)
+            {
+                --size;
+            }
+            return std::string(text, size);
+        }
+
+        // UTF-8 content of a Python string. For ASCII strings, e.g. the
+        // base64 encoded images, it is the buffer of the string itself.
+        const char* get_utf8(py::handle str, std::size_t& size)
+        {
+            Py_ssize_t length = 0;
+            const char* utf8 = PyUnicode_AsUTF8AndSize(str.ptr(), &length);
+            if (utf8 == nullptr)
+            {
+                throw py::error_already_set();
+            }
+            size = static_cast<std::size_t>(length);
+            return utf8;
+        }
+
+        // Counts the characters of a serialization instead of storing them
+        class xcounting_buffer : public std::streambuf
+        {
+        public:
+
+            std::size_t size() const
+            {
+                return m_size;
+            }
+
+        protected:
+
+            int_type overflow(int_type c) override
+            {
+                if (!traits_type::eq_int_type(c, traits_type::eof()))
+                {
+                    ++m_size;
+                }
+                return traits_type::not_eof(c);
+            }
+
+            std::streamsize xsputn(const char*, std::streamsize count) override
+            {
+                m_size += static_cast<std::size_t>(count);
+                return count;
+            }
+
+        private:
+
+            std::size_t m_size = 0;
+        };
+
+        std::size_t get_serialized_size(const nl::json& value)
+        {
+            xcounting_buffer buffer;
+            std::ostream out(&buffer);
+            out << value;
+            return buffer.size();
+        }
+
+        // Size of the preview of an output exceeding the budget
+        std::size_t get_preview_size(bool cell_exceeded)
+        {
+            const xoutput_budget& budget = get_output_budget();
+            std::size_t preview_size = budget.m_preview_size;
+            if (cell_exceeded)
+            {
+                std::size_t used = std::min(get_cell_output_usage().m_size, budget.m_max_cell_size);
+                preview_size = std::min(preview_size, budget.m_max_cell_size - used);
+            }
+            return preview_size;
+        }
+
+        bool exceeds_budget(std::size_t size, bool& cell_exceeded)
+        {
+            const xoutput_budget& budget = get_output_budget();
+            cell_exceeded = budget.m_max_cell_size != 0 && get_cell_output_usage().m_size + size > budget.m_max_cell_size;
+            return cell_exceeded || (budget.m_max_message_size != 0 && size > budget.m_max_message_size);
+        }
+    }
+
+    void set_output_budget(std::size_t max_message_size, std::size_t max_cell_size, std::size_t preview_size, std::size_t max_spill_size)
+    {
+        xoutput_budget& budget = get_output_budget();
+        budget.m_max_message_size = max_message_size;
+        budget.m_max_cell_size = max_cell_size;
+        budget.m_preview_size = preview_size;
+        budget.m_max_spill_size = max_spill_size;
+        enforce_spill_size();
+    }
+
+    void reset_cell_output_budget()
+    {
+        xcell_output_usage& usage = get_cell_output_usage();
+        usage.m_size = 0;
+        usage.m_stream_overflows.clear();
+    }
+
+    bool spill_stream_output(const std::string& name, const std::string& message, std::string& text)
+    {
+        if (!budget_enabled())
+        {
+            return false;
+        }
+
+        xcell_output_usage& usage = get_cell_output_usage();
+        auto overflow = usage.m_stream_overflows.find(name);
+        if (overflow != usage.m_stream_overflows.end())
+        {
+            append_spilled_part(overflow->second, message);
+            text.clear();
+            return true;
+        }
+
+        bool cell_exceeded = false;
+        if (!exceeds_budget(message.size(), cell_exceeded))
+        {
+            usage.m_size += message.size();
+            return false;
+        }
+
+        auto write = [&message](std::ofstream& out)
+        {
+            out.write(message.data(), static_cast<std::streamsize>(message.size()));
+            return message.size();
+        };
+
+        // The file of a stream exceeding the budget of the cell is kept
+        // open for the further output of the cell
+        std::size_t preview_size = get_preview_size(cell_exceeded);
+        std::string output_id = new_spilled_output();
+        std::string path;
+        if (cell_exceeded)
+        {
+            xstream_overflow& stream_overflow = usage.m_stream_overflows[name];
+            stream_overflow.m_output_id = output_id;
+            path = add_spilled_part(output_id, name, stream_overflow.m_file, write);
+        }
+        else
+        {
+            std::ofstream out;
+            path = add_spilled_part(output_id, name, out, write);
+        }
+        enforce_spill_size();
+
+        text = truncate_utf8(message.data(), message.size(), preview_size);
+        if (!text.empty() && text.back() != '\n')
+        {
+            text += '\n';
+        }
+        if (cell_exceeded)
+        {
+            text += "[Output budget of the cell exceeded, the further " + name + " output is written to "
+                + path + " (spilled output " + output_id + ")]\n";
+        }
+        else
+        {
+            text += "[" + std::to_string(message.size()) + " bytes of output written to "
+                + path + " (spilled output " + output_id + ")]\n";
+        }
+        usage.m_size += text.size();
+        return true;
+    }
+
+    bool spill_mime_bundle(const py::object& data, nl::json& cpp_data, nl::json& metadata)
+    {
+        if (!budget_enabled() || !py::isinstance<py::dict>(data) || py::len(data) == 0)
+        {
+            cpp_data = data;
+            return false;
+        }
+
+        // The size is computed before the bundle is converted, from the
+        // UTF-8 content of the strings and from the serialized size of the
+        // other values, e.g. the JSON mimetypes, which are converted once
+        py::dict bundle = py::reinterpret_borrow<py::dict>(data);
+        std::map<std::string, std::pair<nl::json, std::size_t>> values;
+        std::size_t size = 0;
+        for (auto item : bundle)
+        {
+            std::size_t value_size = 0;
+            if (PyUnicode_Check(item.second.ptr()))
+            {
+                get_utf8(item.second, value_size);
+            }
+            else
+            {
+                std::pair<nl::json, std::size_t>& value = values[py::str(item.first)];
+                value.first = py::reinterpret_borrow<py::object>(item.second);
+                value_size = value.second = get_serialized_size(value.first);
+            }
+            size += value_size;
+        }
+
+        xcell_output_usage& usage = get_cell_output_usage();
+        bool cell_exceeded = false;
+        if (!exceeds_budget(size, cell_exceeded))
+        {
+            usage.m_size += size;
+            cpp_data = nl::json::object();
+            for (auto item : bundle)
+            {
+                std::string key = py::str(item.first);
+                auto value = values.find(key);
+                if (value != values.end())
+                {
+                    cpp_data[key] = std::move(value->second.first);
+                }
+                else
+                {
+                    std::size_t value_size = 0;
+                    const char* utf8 = get_utf8(item.second, value_size);
+                    cpp_data[key] = std::string(utf8, value_size);
+                }
+            }
+            return false;
+        }
+
+        // The content is written from the Python strings, and the other
+        // values are serialized to the file as they are written
+        std::size_t preview_size = get_preview_size(cell_exceeded);
+        std::string output_id = new_spilled_output();
+        nl::json parts = nl::json::array();
+        std::string files;
+        std::string preview;
+        for (auto item : bundle)
+        {
+            std::string key = py::str(item.first);
+            std::ofstream out;
+            std::string path;
+            std::size_t value_size = 0;
+            auto value = values.find(key);
+            if (value != values.end())
+            {
+                value_size = value->second.second;
+                path = add_spilled_part(output_id, key, out, [&value](std::ofstream& file)
+                {
+                    file << value->second.first;
+                    return value->second.second;
+                });
+            }
+            else
+            {
+                const char* utf8 = get_utf8(item.second, value_size);
+                path = add_spilled_part(output_id, key, out, [utf8, value_size](std::ofstream& file)
+                {
+                    file.write(utf8, static_cast<std::streamsize>(value_size));
+                    return value_size;
+                });
+                if (key == "text/plain")
+                {
+                    preview = truncate_utf8(utf8, value_size, preview_size);
+                    if (!preview.empty() && preview.back() != '\n')
+                    {
+                        preview += '\n';
+                    }
+                }
+            }
+            parts.push_back({{"mimetype", key}, {"path", path}, {"size", value_size}});
+            files += (files.empty() ? "" : ", ") + key + " in " + path;
+        }
+        enforce_spill_size();
+
+        preview += "[" + std::to_string(size) + " bytes of output written to spill files: "
+            + files + " (spilled output " + output_id + ")]";
+        usage.m_size += preview.size();
+
+        cpp_data = nl::json::object();
+        cpp_data["text/plain"] = std::move(preview);
+        if (!metadata.is_object())
+        {
+            metadata = nl::json::object();
+        }
+        metadata["xeus_python_spilled_output"] = {
+            {"id", output_id},
+            {"size", size},
+            {"parts", std::move(parts)}
+        };
+        return true;
+    }
+
+    py::bytes read_spilled_output(const std::string& output_id, const std::string& key, std::size_t offset, long long length)
+    {
+        const auto& registry = get_spilled_output_registry();
+        auto output = registry.find(output_id);
+        if (output == registry.end())
+        {
+            throw std::invalid_argument("Unknown spilled output: " + output_id);
+        }
+
+        touch_spilled_output(output_id);
+        const std::vector<xspilled_part>& parts = output->second;
+        auto part = std::find_if(parts.begin(), parts.end(), [&key](const xspilled_part& p) { return key.empty() || p.m_key == key; });
+        if (part == parts.end())
+        {
+            throw std::invalid_argument("No " + key + " content in the spilled output " + output_id);
+        }
+
+        if (offset >= part->m_size)
+        {
+            return py::bytes();
+        }
+        std::size_t count = part->m_size - offset;
+        if (length >= 0)
+        {
+            count = std::min(count, static_cast<std::size_t>(length));
+        }
+
+        std::string buffer(count, '\0');
+        std::ifstream in(part->m_path, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(offset));
+        in.read(&buffer[0], static_cast<std::streamsize>(count));
+        if (!in)
+        {
+            throw std::runtime_error("Could not read " + part->m_path);
+        }
+        return py::bytes(buffer);
+    }
+
+    nl::json spilled_outputs()
+    {
+        nl::json res = nl::json::object();
+        for (const auto& output : get_spilled_output_registry())
+        {
+            nl::json& parts = res[output.first] = nl::json::array();
+            for (const xspilled_part& part : output.second)
+            {
+                parts.push_back({{"key", part.m_key}, {"path", part.m_path}, {"size", part.m_size}});
+            }
+        }
+        return res;
+    }
+
+    void clear_spilled_outputs()
+    {
+        xspill_registry& registry = get_spill_registry();
+        for (const auto& output : registry.m_outputs)
+        {
+            for (const xspilled_part& part : output.second)
+            {
+                std::remove(part.m_path.c_str());
+            }
+        }
+        registry.m_outputs.clear();
+        registry.m_recency.clear();
+        registry.m_total_size = 0;
+        get_cell_output_usage().m_stream_overflows.clear();
+    }
+}
@@ -0,0 +1,59 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_OUTPUT_SPILL_HPP
+#define XPYT_OUTPUT_SPILL_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /****************
+     * output spill *
+     ****************/
+
+    // The outputs exceeding the budgets are written to spill files, a
+    // truncated preview being published instead. The least recently used
+    // outputs are removed when the spill files exceed max_spill_size, and
+    // all of them when the interpreter is finalized. A size of 0 disables
+    // the corresponding budget. All these functions must be called with the
+    // GIL held.
+
+    void set_output_budget(std::size_t max_message_size, std::size_t max_cell_size, std::size_t preview_size, std::size_t max_spill_size);
+
+    // Called at the beginning of each cell
+    void reset_cell_output_budget();
+
+    // Returns true if the stream output has been spilled, text being set to
+    // the preview to publish; an empty preview must not be published.
+    bool spill_stream_output(const std::string& name, const std::string& message, std::string& text);
+
+    // Converts the mime bundle data to cpp_data. Returns true if it has
+    // been spilled, cpp_data being the preview and metadata pointing to
+    // the spill files; the spilled content is never converted to JSON.
+    bool spill_mime_bundle(const py::object& data, nl::json& cpp_data, nl::json& metadata);
+
+    // Reads length bytes of a spilled output from offset, the whole
+    // remaining content if length is negative.
+    py::bytes read_spilled_output(const std::string& output_id, const std::string& key, std::size_t offset, long long length);
+
+    nl::json spilled_outputs();
+    void clear_spilled_outputs();
+}
+
+#endif
@@ -8,31 +8,333 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 
+#include "nlohmann/json.hpp"
+#include "zmq.hpp"
+#include "zmq_addon.hpp"
+
+#include "xeus/xauthentication.hpp"
+#include "xeus/xguid.hpp"
 #include "xeus/xkernel.hpp"
 #include "xeus/xkernel_configuration.hpp"
-#include "xeus/xserver.hpp"
+#include "xeus/xmessage.hpp"
 
 #include "pybind11/pybind11.h"
 
 #include "xeus-python/xinterpreter.hpp"
-#include "xeus-python/xdebugger.hpp"
+#include "xeus-python/xlauncher.hpp"
+#include "xeus-python/xlogger.hpp"
 
 namespace py = pybind11;
+namespace nl = nlohmann;
 
-void launch(const std::string& connection_filename)
+namespace
 {
-    // Instantiating the xeus xinterpreter
+    using kernel_ptr = std::unique_ptr<xeus::xkernel>;
     using interpreter_ptr = std::unique_ptr<xpyt::interpreter>;
-    interpreter_ptr interpreter = interpreter_ptr(new xpyt::interpreter());
 
-    using history_manager_ptr = std::unique_ptr<xeus::xhistory_manager>;
-    history_manager_ptr hist = xeus::make_in_memory_history_manager();
+    // Interpreter of a kernel started from a thread which does not hold the GIL
+    class xembedded_interpreter : public xpyt::interpreter
+    {
+    public:
+
+        explicit xembedded_interpreter(bool redirect_output)
+            : xpyt::interpreter(redirect_output)
+        {
+            m_release_gil_at_startup = false;
+        }
+    };
+
+    kernel_ptr make_kernel(const std::string& connection_filename,
+                           interpreter_ptr interpreter,
+                           std::unique_ptr<xeus::xlogger> logger)
+    {
+        nl::json debugger_config;
+        debugger_config["python"] = py::module::import("sys").attr("executable").cast<std::string>();
+        debugger_config["prestart"] = false;
+        return xpyt::make_python_kernel(connection_filename, std::move(interpreter), std::move(logger), std::move(debugger_config));
+    }
+
+    std::string get_end_point(const xeus::xconfiguration& config, const std::string& port)
+    {
+        char separator = config.m_transport == "tcp" ? ':' : '-';
+        return config.m_transport + "://" + config.m_ip + separator + port;
+    }
+
+    // Sent on the control channel like any client would, so that the
+    // kernel stops from its own threads
+    void send_shutdown_request(zmq::socket_t& socket, const xeus::xconfiguration& config)
+    {
+        auto auth = xeus::make_xauthentication(config.m_signature_scheme, config.m_key);
+        nl::json header = xeus::make_header("shutdown_request", xeus::get_user_name(), xeus::new_xguid());
+        nl::json content;
+        content["restart"] = false;
+        xeus::xmessage message(xeus::xmessage::guid_list(),
+                               std::move(header),
+                               nl::json::object(),
+                               nl::json::object(),
+                               std::move(content),
+                               xeus::buffer_sequence());
+        zmq::multipart_t wire_msg;
+        std::move(message).serialize(wire_msg, *auth);
+        wire_msg.send(socket);
+    }
+
+    // Only one kernel can run in a process, the interpreter being registered globally
+    std::atomic<bool>& get_kernel_running()
+    {
+        static std::atomic<bool> running(false);
+        return running;
+    }
+
+    /******************************
+     * xkernel_handle declaration *
+     ******************************/
+
+    // Kernel started by start_kernel. The kernel runs on a native thread,
+    // holding a reference on the handle until it stops, so that the Python
+    // handle can be dropped while the kernel is running. The thread is joined
+    // by stop(), which is called when the host interpreter is finalized if
+    // the kernel is still running.
+    class xkernel_handle : public std::enable_shared_from_this<xkernel_handle>
+    {
+    public:
+
+        xkernel_handle(const std::string& connection_filename, bool redirect_output);
+        ~xkernel_handle();
+
+        void start(bool background);
+        bool wait(const py::object& timeout);
+        void stop(const py::object& timeout);
+        bool is_alive();
+        py::dict connection_info() const;
 
+    private:
+
+        void run();
+        void restore_host_state();
+
+        kernel_ptr p_kernel;
+        xeus::xconfiguration m_config;
+        py::object m_stdout;
+        py::object m_stderr;
+        py::object m_displayhook;
+        py::object m_excepthook;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_running = false;
+        std::thread m_thread;
+    };
+
+    // The kernel running in the background, stopped at exit
+    std::weak_ptr<xkernel_handle>& get_background_kernel()
+    {
+        static std::weak_ptr<xkernel_handle> handle;
+        return handle;
+    }
+
+    void stop_background_kernel()
+    {
+        std::shared_ptr<xkernel_handle> handle = get_background_kernel().lock();
+        if (handle && handle->is_alive())
+        {
+            handle->stop(py::float_(10.));
+            if (handle->is_alive())
+            {
+                std::clog << "The xeus-python kernel did not stop before the interpreter was finalized" << std::endl;
+            }
+        }
+    }
+
+    /*********************************
+     * xkernel_handle implementation *
+     *********************************/
+
+    xkernel_handle::xkernel_handle(const std::string& connection_filename, bool redirect_output)
+    {
+        // The interpreter redirects the streams and the display hook
+        // of the host, which are restored when the kernel stops
+        py::module sys = py::module::import("sys");
+        m_stdout = sys.attr("stdout");
+        m_stderr = sys.attr("stderr");
+        m_displayhook = sys.attr("displayhook");
+        m_excepthook = sys.attr("excepthook");
+
+        // The sockets are bound here, the kernel only has to be started
+        p_kernel = make_kernel(connection_filename, interpreter_ptr(new xembedded_interpreter(redirect_output)), nullptr);
+        m_config = p_kernel->get_config();
+    }
+
+    xkernel_handle::~xkernel_handle()
+    {
+        // The last reference may be released by the kernel thread itself
+        if (m_thread.joinable())
+        {
+            if (m_thread.get_id() == std::this_thread::get_id())
+            {
+                m_thread.detach();
+            }
+            else
+            {
+                m_thread.join();
+            }
+        }
+    }
+
+    void xkernel_handle::start(bool background)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = true;
+        }
+        if (background)
+        {
+            // The callbacks of atexit are run by the host before it is
+            // finalized, while the thread can still take the GIL
+            static bool stop_registered = (py::module::import("atexit").attr("register")(py::cpp_function(&stop_background_kernel)), true);
+            (void)stop_registered;
+            get_background_kernel() = shared_from_this();
+
+            auto self = shared_from_this();
+            m_thread = std::thread([self]() { self->run(); });
+        }
+        else
+        {
+            py::gil_scoped_release release;
+            run();
+        }
+    }
+
+    void xkernel_handle::run()
+    {
+        try
+        {
+            p_kernel->start();
+        }
+        catch (std::exception& e)
+        {
+            std::clog << "The xeus-python kernel stopped with an error: " << e.what() << std::endl;
+        }
+
+        {
+            py::gil_scoped_acquire acquire;
+            try
+            {
+                restore_host_state();
+            }
+            catch (py::error_already_set& e)
+            {
+                std::clog << "Could not restore the state of the host: " << e.what() << std::endl;
+            }
+            // The interpreter holds Python objects
+            p_kernel.reset();
+        }
+
+        get_kernel_running() = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_cv.notify_all();
+    }
+
+    void xkernel_handle::restore_host_state()
+    {
+        py::module sys = py::module::import("sys");
+        sys.attr("stdout") = m_stdout;
+        sys.attr("stderr") = m_stderr;
+        sys.attr("displayhook") = m_displayhook;
+        sys.attr("excepthook") = m_excepthook;
+        m_stdout = py::object();
+        m_stderr = py::object();
+        m_displayhook = py::object();
+        m_excepthook = py::object();
+
+        // A kernel started later creates its own shell
+        py::module::import("IPython.core.interactiveshell").attr("InteractiveShell").attr("clear_instance")();
+    }
+
+    bool xkernel_handle::wait(const py::object& timeout)
+    {
+        bool has_timeout = !timeout.is_none();
+        double seconds = has_timeout ? timeout.cast<double>() : 0.;
+
+        py::gil_scoped_release release;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto stopped = [this]() { return !m_running; };
+        if (has_timeout)
+        {
+            return m_cv.wait_for(lock, std::chrono::duration<double>(seconds), stopped);
+        }
+        m_cv.wait(lock, stopped);
+        return true;
+    }
+
+    void xkernel_handle::stop(const py::object& timeout)
+    {
+        if (!is_alive())
+        {
+            return;
+        }
+
+        // The socket is closed once the kernel has stopped, or dropped
+        // with the request if the timeout expired first
+        zmq::context_t context;
+        zmq::socket_t socket(context, zmq::socket_type::dealer);
+        socket.setsockopt(ZMQ_LINGER, 0);
+        socket.connect(get_end_point(m_config, m_config.m_control_port));
+        send_shutdown_request(socket, m_config);
+        bool stopped = wait(timeout);
+
+        // After run() has released the objects of the kernel, the thread
+        // only has to exit
+        if (stopped)
+        {
+            std::thread thread = std::move(m_thread);
+            if (thread.joinable())
+            {
+                py::gil_scoped_release release;
+                thread.join();
+            }
+        }
+    }
+
+    bool xkernel_handle::is_alive()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_running;
+    }
+
+    py::dict xkernel_handle::connection_info() const
+    {
+        py::dict info;
+        info["transport"] = m_config.m_transport;
+        info["ip"] = m_config.m_ip;
+        info["control_port"] = std::stoi(m_config.m_control_port);
+        info["shell_port"] = std::stoi(m_config.m_shell_port);
+        info["stdin_port"] = std::stoi(m_config.m_stdin_port);
+        info["iopub_port"] = std::stoi(m_config.m_iopub_port);
+        info["hb_port"] = std::stoi(m_config.m_hb_port);
+        info["signature_scheme"] = m_config.m_signature_scheme;
+        info["key"] = m_config.m_key;
+        return info;
+    }
+}
+
+void launch(const std::string& connection_filename)
+{
 #ifdef XEUS_PYTHON_PYPI_WARNING
     std::clog <<
         "WARNING: this instance of xeus-python has been installed from a PyPI wheel.\n"
@@ -40,61 +342,57 @@ void launch(const std::string& connection_filename)
         << std::endl;
 #endif
 
+    std::unique_ptr<xeus::xlogger> logger = nullptr;
     if (!connection_filename.empty())
     {
-        xeus::xconfiguration config = xeus::load_configuration(connection_filename);
-
-        xeus::xkernel kernel(config,
-                             xeus::get_user_name(),
-                             std::move(interpreter),
-                             std::move(hist),
-                             xeus::make_console_logger(xeus::xlogger::msg_type,
-                                                       xeus::make_file_logger(xeus::xlogger::content, "xeus.log")),
-                             xeus::make_xserver_shell_main,
-                             xpyt::make_python_debugger);
-
-        std::clog <<
-            "Starting xeus-python kernel...\n\n"
-            "If you want to connect to this kernel from an other client, you can use"
-            " the " + connection_filename + " file."
-            << std::endl;
-
-        kernel.start();
-    }
-    else
-    {
-        xeus::xkernel kernel(xeus::get_user_name(),
-                             std::move(interpreter),
-                             std::move(hist),
-                             nullptr,
-                             xeus::make_xserver_shell_main,
-                             xpyt::make_python_debugger);
-
-        const auto& config = kernel.get_config();
-        std::clog <<
-            "Starting xeus-python kernel...\n\n"
-            "If you want to connect to this kernel from an other client, just copy"
-            " and paste the following content inside of a `kernel.json` file. And then run for example:\n\n"
-            "# jupyter console --existing kernel.json\n\n"
-            "kernel.json\n```\n{\n"
-            "    \"transport\": \"" + config.m_transport + "\",\n"
-            "    \"ip\": \"" + config.m_ip + "\",\n"
-            "    \"control_port\": " + config.m_control_port + ",\n"
-            "    \"shell_port\": " + config.m_shell_port + ",\n"
-            "    \"stdin_port\": " + config.m_stdin_port + ",\n"
-            "    \"iopub_port\": " + config.m_iopub_port + ",\n"
-            "    \"hb_port\": " + config.m_hb_port + ",\n"
-            "    \"signature_scheme\": \"" + config.m_signature_scheme + "\",\n"
-            "    \"key\": \"" + config.m_key + "\"\n"
-            "}\n```"
-            << std::endl;
-
-        kernel.start();
+        logger = xpyt::make_async_console_logger(xeus::xlogger::msg_type,
+                                                 xpyt::make_async_file_logger(xeus::xlogger::content, "xeus.log"));
+    }
+    kernel_ptr kernel = make_kernel(connection_filename, interpreter_ptr(new xpyt::interpreter()), std::move(logger));
+    xpyt::print_startup_message(*kernel, connection_filename);
+    kernel->start();
+}
+
+std::shared_ptr<xkernel_handle> start_kernel(const std::string& connection_filename, bool background, bool redirect_output)
+{
+    if (get_kernel_running().exchange(true))
+    {
+        throw std::runtime_error("A xeus-python kernel is already running in this process");
+    }
+
+    std::shared_ptr<xkernel_handle> handle;
+    try
+    {
+        handle = std::make_shared<xkernel_handle>(connection_filename, redirect_output);
+    }
+    catch (...)
+    {
+        get_kernel_running() = false;
+        throw;
     }
+    handle->start(background);
+    return handle;
 }
 
 PYBIND11_MODULE(xpython_extension, m)
 {
     m.doc() = "Xeus-python kernel launcher";
     m.def("launch", launch, py::arg("connection_filename") = "", "Launch the Jupyter kernel");
+
+    py::class_<xkernel_handle, std::shared_ptr<xkernel_handle>>(m, "KernelHandle")
+        .def("wait", &xkernel_handle::wait, py::arg("timeout") = 10.,
+             "Waits until the kernel stops, returns False if the timeout expired first.")
+        .def("stop", &xkernel_handle::stop, py::arg("timeout") = 10.,
+             "Sends a shutdown request to the kernel and waits until it stops, or until the timeout expires.")
+        .def("is_alive", &xkernel_handle::is_alive)
+        .def_property_readonly("connection_info", &xkernel_handle::connection_info);
+
+    m.def("start_kernel",
+          start_kernel,
+          py::arg("connection_filename") = "",
+          py::arg("background") = true,
+          py::arg("redirect_output") = true,
+          "Starts a Jupyter kernel sharing the interpreter of the calling process. With background=True, "
+          "the kernel runs on native threads and a handle is returned immediately."
+    );
 }
@@ -0,0 +1,86 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "xreply_cache.hpp"
+
+namespace xpyt
+{
+    /*******************************
+     * xreply_cache implementation *
+     *******************************/
+
+    xreply_cache::xreply_cache(std::size_t capacity, std::size_t max_size)
+        : m_capacity(capacity)
+        , m_max_size(max_size)
+    {
+    }
+
+    const nl::json* xreply_cache::find(const std::string& key)
+    {
+        auto it = m_index.find(std::hash<std::string>()(key));
+        if (it == m_index.end() || it->second->m_key != key)
+        {
+            return nullptr;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return &(it->second->m_reply);
+    }
+
+    void xreply_cache::insert(const std::string& key, nl::json reply)
+    {
+        std::size_t size = m_max_size != 0 ? key.size() + reply.dump().size() : 0;
+        if (m_max_size != 0 && size > m_max_size)
+        {
+            return;
+        }
+
+        // An entry with the same hash is replaced, whether its key is equal
+        std::size_t hash = std::hash<std::string>()(key);
+        auto it = m_index.find(hash);
+        if (it != m_index.end())
+        {
+            erase(it->second);
+        }
+        m_entries.push_front({key, std::move(reply), size, hash});
+        m_index[hash] = m_entries.begin();
+        m_size += size;
+        evict();
+    }
+
+    void xreply_cache::clear()
+    {
+        m_entries.clear();
+        m_index.clear();
+        m_size = 0;
+    }
+
+    void xreply_cache::erase(list_type::iterator it)
+    {
+        m_size -= it->m_size;
+        m_index.erase(it->m_hash);
+        m_entries.erase(it);
+    }
+
+    void xreply_cache::evict()
+    {
+        while (m_entries.size() > m_capacity || (m_max_size != 0 && m_size > m_max_size))
+        {
+            erase(std::prev(m_entries.end()));
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_REPLY_CACHE_HPP
+#define XPYT_REPLY_CACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /**
+     * Least recently used cache of request replies, used for the requests
+     * sent by the editors on each key stroke or cursor move. The entries are
+     * indexed by the hash of their key, the key itself being stored once and
+     * only compared on a hash match. A non-zero max_size also bounds the
+     * total size of the keys and of the serialized replies. The cache is not
+     * thread-safe.
+     */
+    class xreply_cache
+    {
+    public:
+
+        explicit xreply_cache(std::size_t capacity, std::size_t max_size = 0);
+
+        // Returns nullptr if there is no reply for the key
+        const nl::json* find(const std::string& key);
+        void insert(const std::string& key, nl::json reply);
+        void clear();
+
+    private:
+
+        struct entry_type
+        {
+            std::string m_key;
+            nl::json m_reply;
+            std::size_t m_size;
+            std::size_t m_hash;
+        };
+
+        using list_type = std::list<entry_type>;
+
+        void erase(list_type::iterator it);
+        void evict();
+
+        std::size_t m_capacity;
+        std::size_t m_max_size;
+        std::size_t m_size = 0;
+        list_type m_entries;
+        std::unordered_map<std::size_t, list_type::iterator> m_index;
+    };
+}
+
+#endif
@@ -0,0 +1,330 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef PSAPI_VERSION
+#define PSAPI_VERSION 2
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xresource_usage.hpp"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        constexpr int level_none = 0;
+        constexpr int level_basic = 1;
+        constexpr int level_allocations = 2;
+
+        // Only accessed with the GIL held
+        struct xaccounting_options
+        {
+            int m_level = level_none;
+            std::size_t m_history_size = 100;
+            std::size_t m_top_allocations = 10;
+            // Whether tracemalloc was started by the accounting
+            bool m_tracemalloc_started = false;
+        };
+
+        xaccounting_options& get_accounting_options()
+        {
+            static xaccounting_options options;
+            return options;
+        }
+
+        std::deque<nl::json>& get_usage_history()
+        {
+            static std::deque<nl::json> history;
+            return history;
+        }
+
+        double process_cpu_time()
+        {
+#ifdef _WIN32
+            FILETIME creation_time, exit_time, kernel_time, user_time;
+            if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+            {
+                return 0.;
+            }
+            auto to_seconds = [](const FILETIME& t)
+            {
+                ULARGE_INTEGER value;
+                value.LowPart = t.dwLowDateTime;
+                value.HighPart = t.dwHighDateTime;
+                return static_cast<double>(value.QuadPart) * 1e-7;
+            };
+            return to_seconds(kernel_time) + to_seconds(user_time);
+#else
+            struct rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) != 0)
+            {
+                return 0.;
+            }
+            return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+        }
+
+        // Resident set size in bytes, -1 when not available
+        long long current_rss()
+        {
+#if defined(_WIN32)
+            PROCESS_MEMORY_COUNTERS counters;
+            if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            {
+                return -1;
+            }
+            return static_cast<long long>(counters.WorkingSetSize);
+#elif defined(__APPLE__)
+            mach_task_basic_info_data_t info;
+            mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+            if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+            {
+                return -1;
+            }
+            return static_cast<long long>(info.resident_size);
+#else
+            // Cheaper than parsing /proc/self/status
+            long long pages = -1;
+            if (std::FILE* statm = std::fopen("/proc/self/statm", "r"))
+            {
+                long long size = 0;
+                if (std::fscanf(statm, "%lld %lld", &size, &pages) != 2)
+                {
+                    pages = -1;
+                }
+                std::fclose(statm);
+            }
+            return pages < 0 ? -1 : pages * static_cast<long long>(sysconf(_SC_PAGESIZE));
+#endif
+        }
+
+        // High-water mark of the resident set size of the process in bytes
+        long long peak_rss()
+        {
+#ifdef _WIN32
+            PROCESS_MEMORY_COUNTERS counters;
+            if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            {
+                return -1;
+            }
+            return static_cast<long long>(counters.PeakWorkingSetSize);
+#else
+            struct rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) != 0)
+            {
+                return -1;
+            }
+#ifdef __APPLE__
+            return static_cast<long long>(usage.ru_maxrss);
+#else
+            return static_cast<long long>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+        }
+
+        double unix_time()
+        {
+            using namespace std::chrono;
+            return duration_cast<duration<double>>(system_clock::now().time_since_epoch()).count();
+        }
+
+        py::object take_allocation_snapshot()
+        {
+            py::module tracemalloc = py::module::import("tracemalloc");
+            xaccounting_options& options = get_accounting_options();
+            if (!tracemalloc.attr("is_tracing")().cast<bool>())
+            {
+                tracemalloc.attr("start")();
+                options.m_tracemalloc_started = true;
+            }
+            py::object snapshot = tracemalloc.attr("take_snapshot")();
+            // The traces of tracemalloc itself are left out
+            py::list filters;
+            filters.append(tracemalloc.attr("Filter")(false, tracemalloc.attr("__file__")));
+            return snapshot.attr("filter_traces")(filters);
+        }
+
+        nl::json top_allocations(const py::object& start_snapshot, std::size_t count)
+        {
+            nl::json res = nl::json::array();
+            py::list stats = take_allocation_snapshot().attr("compare_to")(start_snapshot, "lineno");
+            for (const py::handle& stat : stats)
+            {
+                if (res.size() == count)
+                {
+                    break;
+                }
+                long long size_diff = stat.attr("size_diff").cast<long long>();
+                if (size_diff <= 0)
+                {
+                    continue;
+                }
+                py::object frame = stat.attr("traceback")[py::int_(0)];
+                res.push_back({
+                    {"filename", frame.attr("filename").cast<std::string>()},
+                    {"lineno", frame.attr("lineno").cast<int>()},
+                    {"size_diff", size_diff},
+                    {"count_diff", stat.attr("count_diff").cast<long long>()}
+                });
+            }
+            return res;
+        }
+    }
+
+    void set_resource_accounting(const std::string& level,
+                                 std::size_t history_size,
+                                 std::size_t top_allocations)
+    {
+        xaccounting_options& options = get_accounting_options();
+        if (level == "none")
+        {
+            options.m_level = level_none;
+        }
+        else if (level == "basic")
+        {
+            options.m_level = level_basic;
+        }
+        else if (level == "allocations")
+        {
+            options.m_level = level_allocations;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown resource accounting level: " + level);
+        }
+
+        // The tracing slows down the allocations, it is only kept with the level requiring it
+        if (options.m_level != level_allocations && options.m_tracemalloc_started)
+        {
+            py::module::import("tracemalloc").attr("stop")();
+            options.m_tracemalloc_started = false;
+        }
+
+        options.m_history_size = history_size;
+        options.m_top_allocations = top_allocations;
+        auto& history = get_usage_history();
+        while (history.size() > history_size)
+        {
+            history.pop_front();
+        }
+    }
+
+    nl::json resource_usage_history(std::size_t count)
+    {
+        const auto& history = get_usage_history();
+        std::size_t first = (count == 0 || count >= history.size()) ? 0 : history.size() - count;
+        return nl::json(history.begin() + static_cast<std::ptrdiff_t>(first), history.end());
+    }
+
+    void clear_resource_usage_history()
+    {
+        get_usage_history().clear();
+    }
+
+    /**********************************
+     * xresource_scope implementation *
+     **********************************/
+
+    xresource_scope::xresource_scope(int execution_count)
+        : m_execution_count(execution_count)
+        , m_level(get_accounting_options().m_level)
+        , m_start_time(0.)
+        , m_start_cpu(0.)
+        , m_start_rss(-1)
+        , m_start_peak_rss(-1)
+    {
+        if (m_level == level_none)
+        {
+            return;
+        }
+        if (m_level == level_allocations)
+        {
+            m_start_snapshot = take_allocation_snapshot();
+        }
+        m_start_time = unix_time();
+        m_start_rss = current_rss();
+        m_start_peak_rss = peak_rss();
+        m_start_cpu = process_cpu_time();
+        m_start = clock_type::now();
+    }
+
+    nl::json xresource_scope::stop()
+    {
+        if (m_level == level_none)
+        {
+            return nl::json();
+        }
+
+        double wall = std::chrono::duration_cast<std::chrono::duration<double>>(clock_type::now() - m_start).count();
+        double cpu = process_cpu_time() - m_start_cpu;
+        long long rss = current_rss();
+        long long peak = peak_rss();
+        m_level = level_none;
+
+        nl::json usage = {
+            {"execution_count", m_execution_count},
+            {"started", m_start_time},
+            {"wall_time", wall},
+            {"cpu_time", cpu},
+            {"rss", rss},
+            {"rss_delta", (rss < 0 || m_start_rss < 0) ? 0 : rss - m_start_rss},
+            {"peak_rss", peak},
+            {"peak_rss_delta", (peak < 0 || m_start_peak_rss < 0) ? 0 : peak - m_start_peak_rss}
+        };
+
+        xaccounting_options& options = get_accounting_options();
+        if (m_start_snapshot && options.m_level == level_allocations)
+        {
+            usage["top_allocations"] = top_allocations(m_start_snapshot, options.m_top_allocations);
+        }
+        m_start_snapshot = py::object();
+
+        auto& history = get_usage_history();
+        std::size_t history_size = options.m_history_size;
+        if (history_size != 0)
+        {
+            if (history.size() == history_size)
+            {
+                history.pop_front();
+            }
+            history.push_back(usage);
+        }
+        return usage;
+    }
+}
@@ -0,0 +1,77 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_RESOURCE_USAGE_HPP
+#define XPYT_RESOURCE_USAGE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /******************
+     * resource usage *
+     ******************/
+
+    // Level of the accounting of the resources used by the cells: "none",
+    // "basic" for the wall and CPU times and the resident memory, and
+    // "allocations" for the top allocation sites traced by tracemalloc.
+    // The history keeps the usage of the last history_size cells.
+    void set_resource_accounting(const std::string& level,
+                                 std::size_t history_size,
+                                 std::size_t top_allocations);
+
+    // The usage of the last count cells, all of them if count is 0
+    nl::json resource_usage_history(std::size_t count);
+    void clear_resource_usage_history();
+
+    /*******************
+     * xresource_scope *
+     *******************/
+
+    // Measures the resources used between its construction and the call
+    // to stop, which records them in the history. Does nothing when the
+    // accounting is disabled. Must be used with the GIL held.
+    class xresource_scope
+    {
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+
+        explicit xresource_scope(int execution_count);
+
+        xresource_scope(const xresource_scope&) = delete;
+        xresource_scope& operator=(const xresource_scope&) = delete;
+
+        // Returns the usage, null when the accounting is disabled
+        nl::json stop();
+
+    private:
+
+        int m_execution_count;
+        int m_level;
+        clock_type::time_point m_start;
+        double m_start_time;
+        double m_start_cpu;
+        long long m_start_rss;
+        long long m_start_peak_rss;
+        py::object m_start_snapshot;
+    };
+}
+
+#endif
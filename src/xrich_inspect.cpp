@@ -0,0 +1,175 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11_json/pybind11_json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xreply_cache.hpp"
+#include "xrich_inspect.hpp"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        // At most 64 representations and 32 MiB, the plots
+        // and tables of a variable explorer being large
+        xreply_cache& get_rich_inspect_cache()
+        {
+            static xreply_cache cache(64, 32 * 1024 * 1024);
+            return cache;
+        }
+
+        std::atomic<std::size_t>& get_rich_inspect_generation()
+        {
+            static std::atomic<std::size_t> generation(0);
+            return generation;
+        }
+
+        std::atomic<bool>& get_cell_running()
+        {
+            static std::atomic<bool> running(false);
+            return running;
+        }
+
+        std::atomic<bool>& get_all_threads_stopped()
+        {
+            static std::atomic<bool> stopped(false);
+            return stopped;
+        }
+
+        // The objects of the cached representations, per variable name. Leaked
+        // so that they are not released after the interpreter is finalized.
+        std::map<std::string, py::object>& get_inspected_objects()
+        {
+            static std::map<std::string, py::object>* objects = new std::map<std::string, py::object>();
+            return *objects;
+        }
+
+        void clear_invalidated_cache()
+        {
+            static std::size_t cache_generation = 0;
+            std::size_t generation = get_rich_inspect_generation().load();
+            if (generation != cache_generation)
+            {
+                get_rich_inspect_cache().clear();
+                get_inspected_objects().clear();
+                cache_generation = generation;
+            }
+        }
+
+        std::map<std::string, nl::json>& get_pending_inspections()
+        {
+            static std::map<std::string, nl::json> pending;
+            return pending;
+        }
+
+        nl::json format_rich_representation(const py::object& value)
+        {
+            py::object formatter = py::module::import("IPython.core.getipython").attr("get_ipython")().attr("display_formatter");
+            py::tuple bundle = formatter.attr("format")(value);
+            py::dict repr_data = bundle[0];
+            py::dict repr_metadata = bundle[1];
+
+            nl::json body = {
+                {"data", nl::json::object()},
+                {"metadata", nl::json::object()}
+            };
+            for (const auto& item : repr_data)
+            {
+                std::string data_key = py::str(item.first);
+                body["data"][data_key] = item.second;
+                if (repr_metadata.contains(item.first))
+                {
+                    body["metadata"][data_key] = repr_metadata[item.first];
+                }
+            }
+            return body;
+        }
+    }
+
+    nl::json rich_inspect_variable(const std::string& name, const py::object& value)
+    {
+        if (get_cell_running().load() && !get_all_threads_stopped().load())
+        {
+            return format_rich_representation(value);
+        }
+
+        clear_invalidated_cache();
+        xreply_cache& cache = get_rich_inspect_cache();
+        auto& objects = get_inspected_objects();
+
+        // The object is kept alive by the map, so an identity match means
+        // the name is still bound to the object whose representation is cached
+        auto it = objects.find(name);
+        if (it != objects.end() && it->second.is(value))
+        {
+            if (const nl::json* body = cache.find(name))
+            {
+                return *body;
+            }
+        }
+
+        nl::json body = format_rich_representation(value);
+        cache.insert(name, body);
+        objects[name] = value;
+        return body;
+    }
+
+    void store_rich_inspection(const std::string& token, const std::string& name, const py::object& value)
+    {
+        get_pending_inspections()[token] = rich_inspect_variable(name, value);
+    }
+
+    nl::json pop_rich_inspection(const std::string& token)
+    {
+        auto& pending = get_pending_inspections();
+        auto it = pending.find(token);
+        if (it == pending.end())
+        {
+            return nl::json();
+        }
+        nl::json body = std::move(it->second);
+        pending.erase(it);
+        return body;
+    }
+
+    void invalidate_rich_inspect_cache()
+    {
+        ++get_rich_inspect_generation();
+    }
+
+    void set_all_threads_stopped(bool stopped)
+    {
+        get_all_threads_stopped() = stopped;
+    }
+
+    xrunning_cell_guard::xrunning_cell_guard()
+    {
+        get_cell_running() = true;
+        invalidate_rich_inspect_cache();
+        clear_invalidated_cache();
+    }
+
+    xrunning_cell_guard::~xrunning_cell_guard()
+    {
+        get_cell_running() = false;
+    }
+}
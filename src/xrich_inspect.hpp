@@ -0,0 +1,66 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_RICH_INSPECT_HPP
+#define XPYT_RICH_INSPECT_HPP
+
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /****************
+     * rich inspect *
+     ****************/
+
+    // Rich representations of the variables inspected by the debugger,
+    // formatted by the display formatter of the shell and cached per
+    // variable name, the cache keeping the inspected objects alive so that
+    // their identity is not reused. The cache is invalidated when a cell
+    // starts or the debugger steps, and bypassed while a cell runs unless
+    // the debugger has stopped all the threads, since the objects may be
+    // modified. Except for the invalidation and the state updates, these
+    // functions must be called with the GIL held.
+
+    // Returns the body of the richInspectVariables response
+    nl::json rich_inspect_variable(const std::string& name, const py::object& value);
+
+    // Called in the frame of a stopped thread, the body being retrieved
+    // by the debugger with pop_rich_inspection
+    void store_rich_inspection(const std::string& token, const std::string& name, const py::object& value);
+    nl::json pop_rich_inspection(const std::string& token);
+
+    // Does not require the GIL
+    void invalidate_rich_inspect_cache();
+
+    // Called by the debugger client on the stopped and continued events
+    void set_all_threads_stopped(bool stopped);
+
+    // Marks a cell as running for its lifetime. Must be created with the
+    // GIL held, the objects of the cache being released.
+    class xrunning_cell_guard
+    {
+    public:
+
+        xrunning_cell_guard();
+        ~xrunning_cell_guard();
+
+        xrunning_cell_guard(const xrunning_cell_guard&) = delete;
+        xrunning_cell_guard& operator=(const xrunning_cell_guard&) = delete;
+    };
+}
+
+#endif
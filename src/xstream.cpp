@@ -8,23 +8,51 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include "xeus/xinterpreter.hpp"
 
 #include "pybind11/functional.h"
 #include "pybind11/pybind11.h"
 
+#include "xeus-python/xutils.hpp"
+
+#include "xdisplay.hpp"
 #include "xstream.hpp"
 #include "xinternal_utils.hpp"
+#include "xlog_sink.hpp"
+#include "xmetrics.hpp"
+#include "xoutput_spill.hpp"
 
 namespace py = pybind11;
 
 namespace xpyt
 {
 
+    /*********************************
+     * xstream_buffering declaration *
+     *********************************/
+
+    // Buffering settings shared by all the output streams. A max_size of 0
+    // disables the buffering: every write is then published immediately.
+    struct xstream_buffering
+    {
+        std::size_t m_max_size = 65536;
+        std::chrono::milliseconds m_flush_interval = std::chrono::milliseconds(200);
+    };
+
+    xstream_buffering& get_stream_buffering()
+    {
+        static xstream_buffering buffering;
+        return buffering;
+    }
+
     /***********************
      * xstream declaration *
      ***********************/
@@ -40,11 +68,65 @@ namespace xpyt
         void flush();
         bool isatty();
 
+        bool has_buffered_content() const;
+
     private:
 
         std::string m_stream_name;
+        std::string m_buffer;
     };
 
+    // Publishes the message, or its preview if it exceeds the output budget
+    void publish_stream_message(const std::string& name, const std::string& message)
+    {
+        if (hold_stream_output(name, message))
+        {
+            return;
+        }
+        std::string preview;
+        const std::string& text = spill_stream_output(name, message, preview) ? preview : message;
+        if (!text.empty())
+        {
+            xmetric_timer timer(xmetric::publish_stream);
+            xpublish_guard guard;
+            xeus::get_interpreter().publish_stream(name, text);
+        }
+    }
+
+    // Live output streams, only accessed with the GIL held.
+    std::vector<xstream*>& get_stream_registry()
+    {
+        static std::vector<xstream*> registry;
+        return registry;
+    }
+
+    // Flushes the output streams when the oldest buffered write is older
+    // than the flush interval
+    xgil_timer& get_stream_flush_timer()
+    {
+        static xgil_timer* timer = new xgil_timer(&flush_streams);
+        return *timer;
+    }
+
+    // Flushes the streams holding buffered content, except the given one.
+    // The publishing releases the GIL, the references keep the streams alive
+    // and the registry may change meanwhile.
+    void flush_other_streams(const xstream* except)
+    {
+        std::vector<py::object> streams;
+        for (xstream* stream : get_stream_registry())
+        {
+            if (stream != except && stream->has_buffered_content())
+            {
+                streams.push_back(py::cast(stream, py::return_value_policy::reference));
+            }
+        }
+        for (py::object& stream : streams)
+        {
+            stream.cast<xstream*>()->flush();
+        }
+    }
+
     /**************************
      * xstream implementation *
      **************************/
@@ -52,19 +134,49 @@ namespace xpyt
     xstream::xstream(std::string stream_name)
         : m_stream_name(stream_name)
     {
+        get_stream_registry().push_back(this);
     }
 
     xstream::~xstream()
     {
+        auto& registry = get_stream_registry();
+        registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
     }
 
     void xstream::write(const std::string& message)
     {
-        xeus::get_interpreter().publish_stream(m_stream_name, message);
+        const xstream_buffering& buffering = get_stream_buffering();
+
+        // Flushing the other streams first preserves the ordering
+        // of interleaved stdout and stderr outputs.
+        flush_other_streams(this);
+
+        if (buffering.m_max_size == 0)
+        {
+            publish_stream_message(m_stream_name, message);
+            return;
+        }
+
+        bool was_empty = m_buffer.empty();
+        m_buffer += message;
+        if (m_buffer.size() >= buffering.m_max_size)
+        {
+            flush();
+        }
+        else if (was_empty)
+        {
+            get_stream_flush_timer().schedule(buffering.m_flush_interval);
+        }
     }
 
     void xstream::flush()
     {
+        if (!m_buffer.empty())
+        {
+            std::string message;
+            std::swap(message, m_buffer);
+            publish_stream_message(m_stream_name, message);
+        }
     }
 
     bool xstream::isatty()
@@ -72,6 +184,27 @@ namespace xpyt
         return false;
     }
 
+    bool xstream::has_buffered_content() const
+    {
+        return !m_buffer.empty();
+    }
+
+    void flush_streams()
+    {
+        // Cancelled first, a write made while the GIL is released by the
+        // publishing schedules the timer again
+        get_stream_flush_timer().cancel();
+        flush_other_streams(nullptr);
+    }
+
+    void set_stream_buffering(std::size_t max_size, double flush_interval)
+    {
+        flush_streams();
+        xstream_buffering& buffering = get_stream_buffering();
+        buffering.m_max_size = max_size;
+        buffering.m_flush_interval = std::chrono::milliseconds(static_cast<long long>(flush_interval * 1000));
+    }
+
     /********************************
      * xterminal_stream declaration *
      ********************************/
@@ -101,7 +234,7 @@ namespace xpyt
 
     void xterminal_stream::write(const std::string& message)
     {
-        std::cout << message;
+        write_log(xlog_target::terminal, log_level_info, message);
     }
 
     void xterminal_stream::flush()
@@ -122,11 +255,52 @@ namespace xpyt
             .def("flush", &xstream::flush)
             .def("isatty", &xstream::isatty);
 
+        stream_module.def("flush_streams", flush_streams);
+
+        stream_module.def("set_buffering",
+            set_stream_buffering,
+            py::arg("max_size"),
+            py::arg("flush_interval")
+        );
+
         py::class_<xterminal_stream>(stream_module, "TerminalStream")
             .def(py::init<>())
             .def("write", &xterminal_stream::write)
             .def("flush", &xterminal_stream::flush);
 
+        stream_module.def("write_log",
+            [](int level, std::string message) { write_log(xlog_target::terminal, level, std::move(message)); },
+            py::arg("level"),
+            py::arg("message")
+        );
+
+        stream_module.def("log_enabled", log_level_enabled, py::arg("level"));
+
+        stream_module.def("set_log_options",
+            set_log_sink_options,
+            py::arg("level"),
+            py::arg("sample_rate")
+        );
+
+        exec(py::str(R"(
+import logging
+
+class XLogHandler(logging.Handler):
+    """Sends the log records to the asynchronous log sink of the kernel,
+    the records discarded by the sink being never formatted."""
+
+    def handle(self, record):
+        if not log_enabled(record.levelno):
+            return False
+        return super(XLogHandler, self).handle(record)
+
+    def emit(self, record):
+        try:
+            write_log(record.levelno, self.format(record) + '\n')
+        except Exception:
+            self.handleError(record)
+        )"), stream_module.attr("__dict__"));
+
         return stream_module;
     }
 
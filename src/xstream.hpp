@@ -11,6 +11,8 @@
 #ifndef XPYT_STREAM_HPP
 #define XPYT_STREAM_HPP
 
+#include <string>
+
 #include "pybind11/pybind11.h"
 
 namespace py = pybind11;
@@ -18,6 +20,14 @@ namespace py = pybind11;
 namespace xpyt
 {
     py::module get_stream_module();
+
+    // Sends the content buffered by the output streams. Must be called with
+    // the GIL held.
+    void flush_streams();
+
+    // Publishes a stream message, or its preview if it exceeds the output
+    // budget. Must be called with the GIL held.
+    void publish_stream_message(const std::string& name, const std::string& message);
 }
 
 #endif
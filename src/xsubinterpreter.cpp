@@ -0,0 +1,681 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xinterpreter.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xinternal_utils.hpp"
+#include "xstream.hpp"
+#include "xsubinterpreter.hpp"
+
+#if defined(XPYT_ENABLE_SUBINTERPRETERS) && PY_VERSION_HEX < 0x030C0000
+#error "XPYT_ENABLE_SUBINTERPRETERS requires Python 3.12"
+#endif
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+#ifdef XPYT_ENABLE_SUBINTERPRETERS
+
+    /*******************
+     * xsubinterpreter *
+     *******************/
+
+    namespace
+    {
+        const char* subinterpreter_bootstrap = R"(
+import ast
+import io
+import sys
+import traceback
+
+
+class _XStream(io.TextIOBase):
+    def __init__(self, name):
+        self.name = name
+
+    def writable(self):
+        return True
+
+    def write(self, text):
+        _xpyt_write(self.name, text)
+        return len(text)
+
+
+sys.stdout = _XStream('stdout')
+sys.stderr = _XStream('stderr')
+
+
+def _xpyt_run(code, filename):
+    ns = sys.modules['__main__'].__dict__
+    try:
+        tree = ast.parse(code, filename, 'exec')
+        expr = None
+        if tree.body and isinstance(tree.body[-1], ast.Expr):
+            expr = ast.Expression(tree.body.pop().value)
+        exec(compile(tree, filename, 'exec'), ns)
+        if expr is not None:
+            value = eval(compile(expr, filename, 'eval'), ns)
+            if value is not None:
+                sys.stdout.write(repr(value) + '\n')
+    except BaseException:
+        etype, value, tb = sys.exc_info()
+        sys.stderr.write(''.join(traceback.format_exception(etype, value, tb.tb_next)))
+)";
+
+        // Text written to a stream by the cells of a sub-interpreter
+        struct xsubinterpreter_output
+        {
+            std::string m_stream_name;
+            std::string m_text;
+        };
+
+        // Text written by a background cell, sent as an update of the
+        // display created in the cell that submitted it
+        struct xdisplay_output
+        {
+            std::string m_display_id;
+            std::string m_text;
+            // Whether the cell is done, its display is no longer updated
+            bool m_done;
+        };
+
+        // A cell submitted to a sub-interpreter, the display id is empty for
+        // the cells whose outputs are sent as streams by a waiting cell
+        struct xsubinterpreter_task
+        {
+            std::string m_code;
+            std::string m_display_id;
+        };
+
+        // The updates of the displays of the background cells, sent with
+        // the GIL of the main interpreter held
+        using display_update = std::pair<std::string, std::string>;
+
+        void send_display_outputs();
+
+        xgil_timer& get_display_output_timer()
+        {
+            static xgil_timer* timer = new xgil_timer(&send_display_outputs);
+            return *timer;
+        }
+
+        // Creates an empty display in the running cell, the outputs of the
+        // background cells being sent as its updates. Must be called with
+        // the GIL of the main interpreter held.
+        std::string make_output_display(const std::string& name)
+        {
+            static std::size_t counter = 0;
+            std::string display_id = "xpython-subinterp-" + name + "-" + std::to_string(++counter);
+            flush_streams();
+            nl::json data = {{"text/plain", ""}};
+            nl::json transient = {{"display_id", display_id}};
+            auto& interp = xeus::get_interpreter();
+            xpublish_guard guard;
+            interp.display_data(std::move(data), nl::json::object(), std::move(transient));
+            return display_id;
+        }
+
+        class xsubinterpreter
+        {
+        public:
+
+            explicit xsubinterpreter(const std::string& name);
+
+            void submit(std::string code, std::string display_id);
+            bool wait(double timeout);
+            void stop();
+
+            void collect_display_updates(std::vector<display_update>& updates);
+
+        private:
+
+            using output_list = std::vector<xsubinterpreter_output>;
+            using display_output_list = std::vector<xdisplay_output>;
+
+            static PyObject* write(PyObject* self, PyObject* args);
+
+            void append(const std::string& stream_name, std::string text);
+            void append_display_output(xdisplay_output output);
+            void detach_foreground_cells();
+            void run();
+            bool initialize(PyObject*& run_function);
+            void execute(PyObject* run_function, const std::string& code);
+
+            std::string m_name;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::deque<xsubinterpreter_task> m_tasks;
+            output_list m_outputs;
+            display_output_list m_display_outputs;
+            // Display id of the running cell
+            std::string m_display_id;
+            // Text of the displays of the background cells, only accessed
+            // with the GIL of the main interpreter held
+            std::map<std::string, std::string> m_display_texts;
+            std::thread m_thread;
+            bool m_running = false;
+            bool m_failed = false;
+            bool m_stopping = false;
+        };
+
+        xsubinterpreter::xsubinterpreter(const std::string& name)
+            : m_name(name)
+        {
+            m_thread = std::thread(&xsubinterpreter::run, this);
+        }
+
+        void xsubinterpreter::submit(std::string code, std::string display_id)
+        {
+            bool failed = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                failed = m_failed;
+                if (!failed)
+                {
+                    m_tasks.push_back({std::move(code), std::move(display_id)});
+                }
+            }
+            if (failed && !display_id.empty())
+            {
+                append_display_output({display_id, "The sub-interpreter '" + m_name + "' could not be created\n", true});
+            }
+            m_cv.notify_all();
+        }
+
+        bool xsubinterpreter::wait(double timeout)
+        {
+            // The outputs of the cells without display are sent by the
+            // waiting cell, while its request is the parent of the messages
+            // published by the kernel
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout < 0. ? 0. : timeout);
+            while (true)
+            {
+                output_list outputs;
+                bool done = false;
+                {
+                    py::gil_scoped_release release;
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    // The outputs written meanwhile are sent together
+                    m_cv.wait_for(lock, std::chrono::milliseconds(100), [this]() { return m_tasks.empty() && !m_running; });
+                    outputs.swap(m_outputs);
+                    done = m_tasks.empty() && !m_running;
+                    if (m_failed && !m_tasks.empty())
+                    {
+                        m_tasks.clear();
+                        done = true;
+                    }
+                }
+
+                if (!outputs.empty())
+                {
+                    flush_streams();
+                    for (const auto& output : outputs)
+                    {
+                        publish_stream_message(output.m_stream_name, output.m_text);
+                    }
+                }
+                if (done)
+                {
+                    return true;
+                }
+                if (timeout >= 0. && std::chrono::steady_clock::now() >= deadline)
+                {
+                    return false;
+                }
+                // The cell keeps running in the sub-interpreter when the wait
+                // is interrupted, its outputs are sent to a display of the
+                // interrupted cell
+                if (PyErr_CheckSignals() != 0)
+                {
+                    py::error_already_set error;
+                    detach_foreground_cells();
+                    throw error;
+                }
+            }
+        }
+
+        void xsubinterpreter::stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+                m_tasks.clear();
+            }
+            m_cv.notify_all();
+            if (m_thread.joinable())
+            {
+                // The worker takes the GIL of the main interpreter to end
+                // the sub-interpreter, after its running cell is done
+                py::gil_scoped_release release;
+                m_thread.join();
+            }
+        }
+
+        void xsubinterpreter::detach_foreground_cells()
+        {
+            std::string display_id = make_output_display(m_name);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_running && m_display_id.empty())
+                {
+                    m_display_id = display_id;
+                }
+                for (auto& task : m_tasks)
+                {
+                    if (task.m_display_id.empty())
+                    {
+                        task.m_display_id = display_id;
+                    }
+                }
+                // Written while the display was created
+                for (auto& output : m_outputs)
+                {
+                    m_display_outputs.push_back({display_id, std::move(output.m_text), false});
+                }
+                m_outputs.clear();
+            }
+            get_display_output_timer().schedule(xgil_timer::clock_type::duration::zero());
+        }
+
+        void xsubinterpreter::collect_display_updates(std::vector<display_update>& updates)
+        {
+            display_output_list outputs;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                outputs.swap(m_display_outputs);
+            }
+            std::vector<std::string> updated;
+            for (auto& output : outputs)
+            {
+                std::string& text = m_display_texts[output.m_display_id];
+                text += output.m_text;
+                if (std::find(updated.begin(), updated.end(), output.m_display_id) == updated.end())
+                {
+                    updated.push_back(output.m_display_id);
+                }
+            }
+            for (const auto& display_id : updated)
+            {
+                updates.emplace_back(display_id, m_display_texts[display_id]);
+            }
+            for (const auto& output : outputs)
+            {
+                if (output.m_done)
+                {
+                    m_display_texts.erase(output.m_display_id);
+                }
+            }
+        }
+
+        void xsubinterpreter::append_display_output(xdisplay_output output)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_display_outputs.empty() && m_display_outputs.back().m_display_id == output.m_display_id && !m_display_outputs.back().m_done)
+                {
+                    m_display_outputs.back().m_text += output.m_text;
+                    m_display_outputs.back().m_done = output.m_done;
+                }
+                else
+                {
+                    m_display_outputs.push_back(std::move(output));
+                }
+            }
+            // The outputs written meanwhile are sent together
+            get_display_output_timer().schedule(std::chrono::milliseconds(100));
+        }
+
+        void xsubinterpreter::append(const std::string& stream_name, std::string text)
+        {
+            std::string display_id;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                display_id = m_display_id;
+                if (display_id.empty())
+                {
+                    if (!m_outputs.empty() && m_outputs.back().m_stream_name == stream_name)
+                    {
+                        m_outputs.back().m_text += text;
+                    }
+                    else
+                    {
+                        m_outputs.push_back({stream_name, std::move(text)});
+                    }
+                }
+            }
+            if (display_id.empty())
+            {
+                m_cv.notify_all();
+            }
+            else
+            {
+                append_display_output({std::move(display_id), std::move(text), false});
+            }
+        }
+
+        PyObject* xsubinterpreter::write(PyObject* self, PyObject* args)
+        {
+            const char* stream_name = nullptr;
+            PyObject* text = nullptr;
+            if (!PyArg_ParseTuple(args, "sU", &stream_name, &text))
+            {
+                return nullptr;
+            }
+            Py_ssize_t size = 0;
+            const char* data = PyUnicode_AsUTF8AndSize(text, &size);
+            if (data == nullptr)
+            {
+                return nullptr;
+            }
+            auto* interpreter = static_cast<xsubinterpreter*>(PyCapsule_GetPointer(self, nullptr));
+            interpreter->append(stream_name, std::string(data, static_cast<std::size_t>(size)));
+            Py_RETURN_NONE;
+        }
+
+        void xsubinterpreter::run()
+        {
+            // The interpreter is created from a thread state of the main
+            // interpreter, whose GIL is released by Py_NewInterpreterFromConfig
+            PyGILState_STATE gil_state = PyGILState_Ensure();
+            PyThreadState* main_state = PyThreadState_Get();
+
+            PyInterpreterConfig config = {};
+            config.use_main_obmalloc = 0;
+            config.allow_fork = 0;
+            config.allow_exec = 0;
+            config.allow_threads = 1;
+            config.allow_daemon_threads = 0;
+            config.check_multi_interp_extensions = 1;
+            config.gil = PyInterpreterConfig_OWN_GIL;
+
+            PyThreadState* state = nullptr;
+            PyStatus status = Py_NewInterpreterFromConfig(&state, &config);
+            PyObject* run_function = nullptr;
+            if (PyStatus_Exception(status) || !initialize(run_function))
+            {
+                if (state != nullptr)
+                {
+                    Py_EndInterpreter(state);
+                    PyEval_RestoreThread(main_state);
+                }
+                PyGILState_Release(gil_state);
+
+                std::string message = "The sub-interpreter '" + m_name + "' could not be created\n";
+                std::vector<std::string> display_ids;
+                bool waited = false;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_failed = true;
+                    for (const auto& task : m_tasks)
+                    {
+                        if (task.m_display_id.empty())
+                        {
+                            waited = true;
+                        }
+                        else
+                        {
+                            display_ids.push_back(task.m_display_id);
+                        }
+                    }
+                    m_tasks.clear();
+                }
+                if (waited)
+                {
+                    append("stderr", message);
+                }
+                for (auto& display_id : display_ids)
+                {
+                    append_display_output({std::move(display_id), message, true});
+                }
+                m_cv.notify_all();
+                return;
+            }
+
+            // The worker only holds the GIL of the sub-interpreter while a cell runs
+            PyThreadState* saved_state = PyEval_SaveThread();
+            while (true)
+            {
+                std::string code;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]() { return !m_tasks.empty() || m_stopping; });
+                    if (m_stopping)
+                    {
+                        break;
+                    }
+                    code = std::move(m_tasks.front().m_code);
+                    m_display_id = std::move(m_tasks.front().m_display_id);
+                    m_tasks.pop_front();
+                    m_running = true;
+                }
+
+                PyEval_RestoreThread(saved_state);
+                execute(run_function, code);
+                saved_state = PyEval_SaveThread();
+
+                std::string display_id;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_running = false;
+                    display_id.swap(m_display_id);
+                }
+                if (!display_id.empty())
+                {
+                    append_display_output({std::move(display_id), std::string(), true});
+                }
+                m_cv.notify_all();
+            }
+
+            // Py_Finalize aborts if a sub-interpreter is still alive
+            PyEval_RestoreThread(saved_state);
+            Py_DECREF(run_function);
+            Py_EndInterpreter(saved_state);
+            PyEval_RestoreThread(main_state);
+            PyGILState_Release(gil_state);
+        }
+
+        bool xsubinterpreter::initialize(PyObject*& run_function)
+        {
+            static PyMethodDef write_method_def = {
+                "_xpyt_write",
+                &xsubinterpreter::write,
+                METH_VARARGS,
+                "Sends the text to the stream of the kernel."
+            };
+
+            PyObject* globals = PyDict_New();
+            PyObject* self = PyCapsule_New(this, nullptr, nullptr);
+            PyObject* write_function = self != nullptr ? PyCFunction_New(&write_method_def, self) : nullptr;
+            bool ok = globals != nullptr
+                && write_function != nullptr
+                && PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins()) == 0
+                && PyDict_SetItemString(globals, "_xpyt_write", write_function) == 0;
+            if (ok)
+            {
+                PyObject* res = PyRun_String(subinterpreter_bootstrap, Py_file_input, globals, globals);
+                ok = res != nullptr;
+                Py_XDECREF(res);
+            }
+            if (ok)
+            {
+                // The globals are kept alive by the function
+                run_function = PyDict_GetItemString(globals, "_xpyt_run");
+                Py_XINCREF(run_function);
+                ok = run_function != nullptr;
+            }
+            if (!ok)
+            {
+                PyErr_Print();
+            }
+            Py_XDECREF(globals);
+            Py_XDECREF(write_function);
+            Py_XDECREF(self);
+            return ok;
+        }
+
+        void xsubinterpreter::execute(PyObject* run_function, const std::string& code)
+        {
+            std::string filename = "<subinterp " + m_name + ">";
+            PyObject* res = PyObject_CallFunction(run_function, "ss", code.c_str(), filename.c_str());
+            if (res == nullptr)
+            {
+                PyErr_Clear();
+                append("stderr", "The cell could not be run in the sub-interpreter '" + m_name + "'\n");
+            }
+            Py_XDECREF(res);
+        }
+
+        // Only accessed with the GIL of the main interpreter held. The
+        // interpreters are ended at exit, before the finalization of Python.
+        std::map<std::string, xsubinterpreter*>& get_subinterpreters()
+        {
+            static std::map<std::string, xsubinterpreter*> subinterpreters;
+            return subinterpreters;
+        }
+
+        void stop_subinterpreters()
+        {
+            // Removed first, the outputs of the background cells are sent
+            // while the workers are joined
+            std::map<std::string, xsubinterpreter*> subinterpreters;
+            subinterpreters.swap(get_subinterpreters());
+            for (auto& item : subinterpreters)
+            {
+                item.second->stop();
+                delete item.second;
+            }
+        }
+
+        void reset_subinterpreters_after_fork()
+        {
+            // The sub-interpreters are deleted by PyOS_AfterFork_Child and
+            // their workers do not exist in the child, the objects are leaked
+            get_subinterpreters().clear();
+        }
+
+        void send_display_outputs()
+        {
+            // The updates are collected before the GIL is released by the
+            // publishing, the sub-interpreters may be ended meanwhile
+            std::vector<display_update> updates;
+            for (auto& item : get_subinterpreters())
+            {
+                item.second->collect_display_updates(updates);
+            }
+
+            auto& interp = xeus::get_interpreter();
+            for (auto& update : updates)
+            {
+                nl::json data = {{"text/plain", std::move(update.second)}};
+                nl::json transient = {{"display_id", std::move(update.first)}};
+                xpublish_guard guard;
+                interp.update_display_data(std::move(data), nl::json::object(), std::move(transient));
+            }
+        }
+
+        xsubinterpreter& get_subinterpreter(const std::string& name)
+        {
+            auto& subinterpreters = get_subinterpreters();
+            auto it = subinterpreters.find(name);
+            if (it == subinterpreters.end())
+            {
+                // The atexit callbacks are run by Py_Finalize before it
+                // checks that no sub-interpreter remains
+                static bool stop_registered = (py::module::import("atexit").attr("register")(py::cpp_function(&stop_subinterpreters)), true);
+                (void)stop_registered;
+#ifndef _WIN32
+                static bool atfork_registered = (pthread_atfork(nullptr, nullptr, &reset_subinterpreters_after_fork) == 0);
+                (void)atfork_registered;
+#endif
+                it = subinterpreters.emplace(name, new xsubinterpreter(name)).first;
+            }
+            return *(it->second);
+        }
+    }
+
+    bool subinterpreters_supported()
+    {
+        return true;
+    }
+
+    void run_in_subinterpreter(const std::string& name, const std::string& code, bool background)
+    {
+        xsubinterpreter& subinterpreter = get_subinterpreter(name);
+        // The display is created before the cell can write to it
+        subinterpreter.submit(code, background ? make_output_display(name) : std::string());
+    }
+
+    bool wait_subinterpreter(const std::string& name, double timeout)
+    {
+        auto& subinterpreters = get_subinterpreters();
+        auto it = subinterpreters.find(name);
+        if (it == subinterpreters.end())
+        {
+            throw std::invalid_argument("Unknown sub-interpreter: " + name);
+        }
+        return it->second->wait(timeout);
+    }
+
+    py::list subinterpreter_names()
+    {
+        py::list names;
+        for (const auto& item : get_subinterpreters())
+        {
+            names.append(item.first);
+        }
+        return names;
+    }
+
+#else
+
+    bool subinterpreters_supported()
+    {
+        return false;
+    }
+
+    void run_in_subinterpreter(const std::string&, const std::string&, bool)
+    {
+        throw std::runtime_error("Sub-interpreters require Python 3.12 and a build with XPYT_ENABLE_SUBINTERPRETERS");
+    }
+
+    bool wait_subinterpreter(const std::string&, double)
+    {
+        throw std::runtime_error("Sub-interpreters require Python 3.12 and a build with XPYT_ENABLE_SUBINTERPRETERS");
+    }
+
+    py::list subinterpreter_names()
+    {
+        return py::list();
+    }
+
+#endif
+}
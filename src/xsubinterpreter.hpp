@@ -0,0 +1,52 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_SUBINTERPRETER_HPP
+#define XPYT_SUBINTERPRETER_HPP
+
+#include <string>
+
+#include "pybind11/pybind11.h"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /*******************
+     * subinterpreters *
+     *******************/
+
+    // Sub-interpreters with their own GIL (PEP 684) require Python 3.12 and
+    // a build with XPYT_ENABLE_SUBINTERPRETERS
+    bool subinterpreters_supported();
+
+    // Runs code in the named sub-interpreter, created on its first use with
+    // a worker thread. The cells of a sub-interpreter run one at a time in
+    // its __main__ namespace, the cells of different sub-interpreters run in
+    // parallel. The sub-interpreters are ended at exit, once their running
+    // cell is done. Must be called with the GIL of the main interpreter held.
+    //
+    // The stdout and stderr outputs of the cell, the repr of the value of
+    // its last expression and the traceback of its errors are sent as the
+    // streams of the cell waiting for it. In the background, a display is
+    // created in the running cell, and updated with the outputs.
+    void run_in_subinterpreter(const std::string& name, const std::string& code, bool background);
+
+    // Waits until the cells submitted to the sub-interpreter are done,
+    // sending the outputs of the cells run without background. When the
+    // wait is interrupted, the outputs are sent to a display of the waiting
+    // cell. A negative timeout waits indefinitely. Must be called with the
+    // GIL of the main interpreter held, which is released while waiting.
+    bool wait_subinterpreter(const std::string& name, double timeout);
+
+    py::list subinterpreter_names();
+}
+
+#endif
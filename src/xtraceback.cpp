@@ -8,32 +8,294 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
-#include <map>
+#include <cctype>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <stdexcept>
 #include <vector>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include "xeus-python/xutils.hpp"
 #include "xeus-python/xtraceback.hpp"
 
 #include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
 
+#include "xfilename_registry.hpp"
 #include "xinternal_utils.hpp"
 
 namespace py = pybind11;
 
 namespace xpyt
 {
-    std::string highlight(const std::string& code)
+    /*********************
+     * traceback options *
+     *********************/
+
+    enum class xhighlighter
+    {
+        pygments,
+        builtin,
+        none
+    };
+
+    struct xtraceback_options
+    {
+        // Maximum number of frames displayed, 0 meaning no limit
+        std::size_t m_max_frames = 0;
+        xhighlighter m_highlighter = xhighlighter::pygments;
+    };
+
+    xtraceback_options& get_traceback_options()
+    {
+        static xtraceback_options options;
+        return options;
+    }
+
+    void set_traceback_options(std::size_t max_frames, const std::string& highlighter)
+    {
+        xtraceback_options& options = get_traceback_options();
+        options.m_max_frames = max_frames;
+        if (highlighter == "pygments")
+        {
+            options.m_highlighter = xhighlighter::pygments;
+        }
+        else if (highlighter == "builtin")
+        {
+            options.m_highlighter = xhighlighter::builtin;
+        }
+        else if (highlighter == "none")
+        {
+            options.m_highlighter = xhighlighter::none;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown traceback highlighter: " + highlighter);
+        }
+    }
+
+    /************************
+     * pygments highlighter *
+     ************************/
+
+    class xpygments_highlighter
     {
-        py::object py_highlight = py::module::import("pygments").attr("highlight");
+    public:
+
+        xpygments_highlighter();
+
+        std::string highlight(const std::string& code) const;
+
+    private:
+
+        py::object m_highlight;
+        py::object m_lexer;
+        py::object m_formatter;
+    };
+
+    xpygments_highlighter::xpygments_highlighter()
+    {
+        m_highlight = py::module::import("pygments").attr("highlight");
         // py::module::import("pygments").attr("formatters") does NOT work due
         // to side effects when importing pygments
-        py::object formatter = py::module::import("pygments.formatters").attr("TerminalFormatter");
+        m_formatter = py::module::import("pygments.formatters").attr("TerminalFormatter")();
+        m_lexer = py::module::import("pygments.lexers").attr("Python3Lexer")();
+    }
+
+    std::string xpygments_highlighter::highlight(const std::string& code) const
+    {
+        return py::str(m_highlight(code, m_lexer, m_formatter));
+    }
+
+    const xpygments_highlighter& get_pygments_highlighter()
+    {
+        // Intentionally leaked: the Python objects must not be
+        // released after the finalization of the interpreter
+        static xpygments_highlighter* highlighter = new xpygments_highlighter();
+        return *highlighter;
+    }
+
+    /***********************
+     * builtin highlighter *
+     ***********************/
+
+    // Minimal tokenizer for single lines of Python code, using the
+    // colors of the Pygments terminal formatter.
+    namespace
+    {
+        const char* ansi_reset = "\033[39;49;00m";
+        const char* ansi_blue = "\033[34m";
+        const char* ansi_cyan = "\033[36m";
+        const char* ansi_green = "\033[32m";
+        const char* ansi_yellow = "\033[33m";
+        const char* ansi_gray = "\033[37m";
+
+        bool is_python_keyword(const std::string& word)
+        {
+            static const std::unordered_set<std::string> keywords = {
+                "False", "None", "True", "and", "as", "assert", "async", "await",
+                "break", "class", "continue", "def", "del", "elif", "else", "except",
+                "finally", "for", "from", "global", "if", "import", "in", "is",
+                "lambda", "nonlocal", "not", "or", "pass", "raise", "return", "try",
+                "while", "with", "yield"
+            };
+            return keywords.find(word) != keywords.end();
+        }
+
+        bool is_python_builtin(const std::string& word)
+        {
+            static const std::unordered_set<std::string> builtins = {
+                "abs", "all", "any", "bin", "bool", "bytearray", "bytes", "callable",
+                "chr", "classmethod", "compile", "complex", "delattr", "dict", "dir",
+                "divmod", "enumerate", "eval", "exec", "filter", "float", "format",
+                "frozenset", "getattr", "globals", "hasattr", "hash", "hex", "id",
+                "input", "int", "isinstance", "issubclass", "iter", "len", "list",
+                "locals", "map", "max", "memoryview", "min", "next", "object", "oct",
+                "open", "ord", "pow", "print", "property", "range", "repr", "reversed",
+                "round", "set", "setattr", "slice", "sorted", "staticmethod", "str",
+                "sum", "super", "tuple", "type", "vars", "zip", "self", "cls"
+            };
+            return builtins.find(word) != builtins.end();
+        }
+
+        bool is_identifier_start(char c)
+        {
+            return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+        }
+
+        bool is_identifier_part(char c)
+        {
+            return is_identifier_start(c) || std::isdigit(static_cast<unsigned char>(c));
+        }
+
+        void append_colored(std::string& out, const char* color, const std::string& code, std::size_t begin, std::size_t end)
+        {
+            out += color;
+            out.append(code, begin, end - begin);
+            out += ansi_reset;
+        }
+
+        // Returns the position after the string literal starting at pos
+        std::size_t skip_string(const std::string& code, std::size_t pos)
+        {
+            char quote = code[pos];
+            bool triple = code.compare(pos, 3, std::string(3, quote)) == 0;
+            pos += triple ? 3 : 1;
+            while (pos < code.size())
+            {
+                if (code[pos] == '\\')
+                {
+                    pos += 2;
+                }
+                else if (code[pos] == quote && (!triple || code.compare(pos, 3, std::string(3, quote)) == 0))
+                {
+                    return pos + (triple ? 3 : 1);
+                }
+                else
+                {
+                    ++pos;
+                }
+            }
+            return code.size();
+        }
+    }
 
-        py::object lexer = py::module::import("pygments.lexers").attr("Python3Lexer");
+    std::string builtin_highlight(const std::string& code)
+    {
+        std::string out;
+        out.reserve(code.size() * 2);
+        std::string previous_word;
+        std::size_t pos = 0;
+        while (pos < code.size())
+        {
+            char c = code[pos];
+            if (c == '#')
+            {
+                append_colored(out, ansi_gray, code, pos, code.size());
+                pos = code.size();
+            }
+            else if (c == '\'' || c == '"')
+            {
+                std::size_t end = skip_string(code, pos);
+                append_colored(out, ansi_yellow, code, pos, end);
+                pos = end;
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c))
+                     || (c == '.' && pos + 1 < code.size() && std::isdigit(static_cast<unsigned char>(code[pos + 1]))))
+            {
+                std::size_t end = pos + 1;
+                while (end < code.size() && (is_identifier_part(code[end]) || code[end] == '.'
+                       || ((code[end] == '+' || code[end] == '-') && (code[end - 1] == 'e' || code[end - 1] == 'E'))))
+                {
+                    ++end;
+                }
+                append_colored(out, ansi_blue, code, pos, end);
+                pos = end;
+            }
+            else if (is_identifier_start(c))
+            {
+                std::size_t end = pos + 1;
+                while (end < code.size() && is_identifier_part(code[end]))
+                {
+                    ++end;
+                }
+                // String prefixes, e.g. f"..." or rb'...'
+                if (end < code.size() && end - pos <= 2 && (code[end] == '\'' || code[end] == '"')
+                    && code.find_first_not_of("rRbBuUfF", pos) >= end)
+                {
+                    std::size_t string_end = skip_string(code, end);
+                    append_colored(out, ansi_yellow, code, pos, string_end);
+                    pos = string_end;
+                    continue;
+                }
+
+                std::string word = code.substr(pos, end - pos);
+                if (is_python_keyword(word))
+                {
+                    append_colored(out, ansi_blue, code, pos, end);
+                }
+                else if (previous_word == "def" || previous_word == "class")
+                {
+                    append_colored(out, ansi_green, code, pos, end);
+                }
+                else if (is_python_builtin(word))
+                {
+                    append_colored(out, ansi_cyan, code, pos, end);
+                }
+                else
+                {
+                    out.append(code, pos, end - pos);
+                }
+                previous_word = std::move(word);
+                pos = end;
+            }
+            else
+            {
+                out += c;
+                ++pos;
+            }
+        }
+        out += '\n';
+        return out;
+    }
 
-        return py::str(py_highlight(code, lexer(), formatter()));
+    std::string highlight(const std::string& code)
+    {
+        switch (get_traceback_options().m_highlighter)
+        {
+        case xhighlighter::pygments:
+            return get_pygments_highlighter().highlight(code);
+        case xhighlighter::builtin:
+            return builtin_highlight(code);
+        default:
+            return code + '\n';
+        }
     }
 
     std::string extract_line(const std::string& code, std::size_t lineno)
@@ -60,17 +322,214 @@ namespace xpyt
         return line;
     }
 
-    using filename_map = std::map<std::string, int>;
+    /*********************
+     * filename registry *
+     *********************/
+
+    // Maps the temporary files of the cells to their execution count.
+    // The least recently registered files are evicted when the number
+    // of entries exceeds the capacity, except the pinned ones.
+    class xfilename_registry
+    {
+    public:
+
+        std::vector<std::string> insert(const std::string& filename, int execution_count);
+        bool find(const std::string& filename, int& execution_count) const;
+
+        void set_capacity(std::size_t capacity);
+        void set_pinned(std::function<bool(const std::string&)> pinned);
+
+    private:
 
-    filename_map& get_filename_map()
+        using entry_list = std::list<std::pair<std::string, int>>;
+
+        mutable std::mutex m_mutex;
+        // Most recently registered entries first
+        entry_list m_entries;
+        std::unordered_map<std::string, entry_list::iterator> m_index;
+        std::size_t m_capacity = 1000;
+        std::function<bool(const std::string&)> m_pinned;
+    };
+
+    std::vector<std::string> xfilename_registry::insert(const std::string& filename, int execution_count)
     {
-        static filename_map fnm;
-        return fnm;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(filename);
+        if (it != m_index.end())
+        {
+            it->second->second = execution_count;
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+        }
+        else
+        {
+            m_entries.emplace_front(filename, execution_count);
+            m_index.emplace(filename, m_entries.begin());
+        }
+
+        // The entry just registered is never evicted
+        std::vector<std::string> evicted;
+        if (m_capacity != 0)
+        {
+            auto it = m_entries.end();
+            while (m_entries.size() > m_capacity && it != std::next(m_entries.begin()))
+            {
+                --it;
+                if (m_pinned && m_pinned(it->first))
+                {
+                    continue;
+                }
+                evicted.push_back(std::move(it->first));
+                m_index.erase(evicted.back());
+                it = m_entries.erase(it);
+            }
+        }
+        return evicted;
+    }
+
+    bool xfilename_registry::find(const std::string& filename, int& execution_count) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(filename);
+        if (it == m_index.end())
+        {
+            return false;
+        }
+        execution_count = it->second->second;
+        return true;
+    }
+
+    void xfilename_registry::set_capacity(std::size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = capacity;
+    }
+
+    void xfilename_registry::set_pinned(std::function<bool(const std::string&)> pinned)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pinned = std::move(pinned);
+    }
+
+    xfilename_registry& get_filename_registry()
+    {
+        static xfilename_registry registry;
+        return registry;
+    }
+
+    std::vector<std::string> register_cell_filename(const std::string& filename, int execution_count)
+    {
+        return get_filename_registry().insert(filename, execution_count);
     }
 
     void register_filename_mapping(const std::string& filename, int execution_count)
     {
-        get_filename_map()[filename] = execution_count;
+        register_cell_filename(filename, execution_count);
+    }
+
+    void set_filename_mapping_capacity(std::size_t capacity)
+    {
+        get_filename_registry().set_capacity(capacity);
+    }
+
+    void set_filename_mapping_pinned(std::function<bool(const std::string&)> pinned)
+    {
+        get_filename_registry().set_pinned(std::move(pinned));
+    }
+
+    namespace
+    {
+        struct xframe
+        {
+            std::string m_filename;
+            std::string m_lineno;
+            std::string m_name;
+            std::string m_line;
+            // Number of identical frames collapsed after this one
+            std::size_t m_repeated = 0;
+        };
+
+        bool same_location(const xframe& lhs, const xframe& rhs)
+        {
+            return lhs.m_filename == rhs.m_filename && lhs.m_lineno == rhs.m_lineno && lhs.m_name == rhs.m_name;
+        }
+
+        // Like CPython, keeps the three first occurrences of a recursive
+        // frame and counts the following ones.
+        std::vector<xframe> extract_frames(const py::object& traceback)
+        {
+            const std::size_t recursion_cutoff = 3;
+            std::vector<xframe> frames;
+            std::size_t occurrences = 0;
+            for (py::handle py_frame : py::module::import("traceback").attr("extract_tb")(traceback))
+            {
+                xframe frame;
+                frame.m_filename = py::str(py_frame.attr("filename"));
+                // Workaround for py::exec
+                if (frame.m_filename == "<string>")
+                {
+                    continue;
+                }
+                frame.m_lineno = py::str(py_frame.attr("lineno"));
+                frame.m_name = py::str(py_frame.attr("name"));
+
+                if (!frames.empty() && same_location(frames.back(), frame))
+                {
+                    if (++occurrences >= recursion_cutoff)
+                    {
+                        ++frames.back().m_repeated;
+                        continue;
+                    }
+                }
+                else
+                {
+                    occurrences = 0;
+                }
+
+                frame.m_line = py::str(py_frame.attr("line"));
+                frames.push_back(std::move(frame));
+            }
+            return frames;
+        }
+
+        std::string format_frame(const xframe& frame, const std::string& prefix)
+        {
+            std::string filename = frame.m_filename;
+            std::string file_prefix;
+            std::string func_name;
+
+            // If the error occured in a cell code, extract the line from the given code
+            if (!filename.empty() && !filename.compare(0, prefix.size(), prefix.c_str(), prefix.size()))
+            {
+                file_prefix = "In  ";
+                int execution_count = 0;
+                if (get_filename_registry().find(filename, execution_count))
+                {
+                    filename = '[' + std::to_string(execution_count) + ']';
+                }
+            }
+            else
+            {
+                file_prefix = "File ";
+                func_name = ", in " + green_text(frame.m_name);
+            }
+
+            std::string padding(frame.m_lineno.size() < 6 ? 6 - frame.m_lineno.size() : 0, ' ');
+            std::string cpp_frame;
+            cpp_frame.reserve(frame.m_line.size() * 2 + filename.size() + 64);
+            cpp_frame += file_prefix;
+            cpp_frame += blue_text(filename);
+            cpp_frame += func_name;
+            cpp_frame += ":\nLine ";
+            cpp_frame += blue_text(frame.m_lineno);
+            cpp_frame += ":";
+            cpp_frame += padding;
+            cpp_frame += highlight(frame.m_line);
+            if (frame.m_repeated != 0)
+            {
+                cpp_frame += "[Previous line repeated " + std::to_string(frame.m_repeated) + " more times]\n";
+            }
+            return cpp_frame;
+        }
     }
 
     xerror extract_error(const py::object& type, const py::object& value, const py::object& traceback)
@@ -93,64 +552,39 @@ namespace xpyt
             std::string traceback_msg("Traceback (most recent call last)");
             std::string first_frame_padding(first_frame_size - traceback_msg.size() - out.m_ename.size(), ' ');
 
-            std::stringstream first_frame;
-            first_frame << red_text(delimiter) << "\n"
-                        << red_text(out.m_ename) << first_frame_padding << traceback_msg;
-            out.m_traceback.push_back(first_frame.str());
+            out.m_traceback.push_back(red_text(delimiter) + "\n" + red_text(out.m_ename) + first_frame_padding + traceback_msg);
 
             if (traceback.ptr() != nullptr && !traceback.is_none())
             {
-                for (py::handle py_frame : py::module::import("traceback").attr("extract_tb")(traceback))
-                {
-                    std::string filename;
-                    std::string lineno;
-                    std::string name;
-                    std::string line;
-
-                    filename = py::str(py_frame.attr("filename"));
-                    lineno = py::str(py_frame.attr("lineno"));
-                    name = py::str(py_frame.attr("name"));
-                    line = py::str(py_frame.attr("line"));
+                std::vector<xframe> frames = extract_frames(traceback);
+                std::string prefix = get_tmp_prefix();
 
-                    // Workaround for py::exec
-                    if (filename == "<string>")
+                std::size_t max_frames = get_traceback_options().m_max_frames;
+                if (max_frames != 0 && frames.size() > max_frames)
+                {
+                    // Keep the outermost and the innermost frames
+                    std::size_t head = (max_frames + 1) / 2;
+                    std::size_t tail = max_frames - head;
+                    for (std::size_t i = 0; i < head; ++i)
                     {
-                        continue;
+                        out.m_traceback.push_back(format_frame(frames[i], prefix));
                     }
-
-                    std::stringstream cpp_frame;
-                    std::string padding(6 - lineno.size(), ' ');
-                    std::string file_prefix;
-                    std::string func_name;
-
-                    std::string prefix = get_tmp_prefix();
-                    // If the error occured in a cell code, extract the line from the given code
-                    if(!filename.empty() && !filename.compare(0, prefix.size(), prefix.c_str(), prefix.size()))
+                    out.m_traceback.push_back("[... skipping " + std::to_string(frames.size() - max_frames) + " frames ...]");
+                    for (std::size_t i = frames.size() - tail; i < frames.size(); ++i)
                     {
-                        file_prefix = "In  ";
-                        auto it = get_filename_map().find(filename);
-                        if(it != get_filename_map().end())
-                        {
-                            filename = '[' + std::to_string(it->second) + ']';
-                        }
+                        out.m_traceback.push_back(format_frame(frames[i], prefix));
                     }
-                    else
+                }
+                else
+                {
+                    for (const xframe& frame : frames)
                     {
-                        file_prefix = "File ";
-                        func_name = ", in " + green_text(name);
+                        out.m_traceback.push_back(format_frame(frame, prefix));
                     }
-
-                    cpp_frame << file_prefix << blue_text(filename) << func_name << ":\n"
-                            << "Line " << blue_text(lineno) << ":"
-                            << padding << highlight(line);
-                    out.m_traceback.push_back(cpp_frame.str());
                 }
             }
 
-            std::stringstream last_frame;
-            last_frame << red_text(out.m_ename) << ": " << out.m_evalue << "\n"
-                       << red_text(delimiter);
-            out.m_traceback.push_back(last_frame.str());
+            out.m_traceback.push_back(red_text(out.m_ename) + ": " + out.m_evalue + "\n" + red_text(delimiter));
         }
 
         return out;
@@ -170,11 +604,22 @@ namespace xpyt
         py::module traceback_module = create_module("traceback");
 
         traceback_module.def("register_filename_mapping",
-            register_filename_mapping,
+            register_cell_filename,
             py::arg("filename"),
             py::arg("execution_count")
         );
 
+        traceback_module.def("set_filename_mapping_capacity",
+            set_filename_mapping_capacity,
+            py::arg("capacity")
+        );
+
+        traceback_module.def("set_options",
+            set_traceback_options,
+            py::arg("max_frames"),
+            py::arg("highlighter")
+        );
+
         exec(py::str(R"(
 last_error = None
 
@@ -0,0 +1,424 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+// Measures the latency and the throughput of a running xpython kernel.
+//
+// Usage: benchmark_xeus_python [--kernel <command>] [--repeat <n>] [--output <file>]
+//
+// The kernel command defaults to "xpython" and is run with the "-f" option;
+// the results are printed as JSON on the standard output, or written to
+// the output file.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xkernel_configuration.hpp"
+
+#include "xeus_client.hpp"
+
+namespace nl = nlohmann;
+using namespace std::chrono_literals;
+
+namespace
+{
+    const std::string KERNEL_JSON = "kernel-benchmark.json";
+
+    using clock_type = std::chrono::steady_clock;
+
+    double elapsed_ms(clock_type::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+    }
+
+    nl::json summarize(std::vector<double> samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        double total = std::accumulate(samples.begin(), samples.end(), 0.);
+        auto percentile = [&samples](double p)
+        {
+            std::size_t index = static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1));
+            return samples[index];
+        };
+        return {
+            {"samples", samples.size()},
+            {"mean_ms", total / static_cast<double>(samples.size())},
+            {"min_ms", samples.front()},
+            {"median_ms", percentile(0.5)},
+            {"p95_ms", percentile(0.95)},
+            {"max_ms", samples.back()}
+        };
+    }
+
+    void dump_connection_file()
+    {
+        std::ofstream out(KERNEL_JSON);
+        out << R"(
+{
+  "shell_port": 61779,
+  "iopub_port": 56691,
+  "stdin_port": 57973,
+  "control_port": 57505,
+  "hb_port": 46551,
+  "ip": "127.0.0.1",
+  "key": "0f8e5c2a-7ab31d42c8e91f0b6d3a4e57",
+  "transport": "tcp",
+  "signature_scheme": "hmac-sha256",
+  "kernel_name": "xpython"
+}
+        )";
+    }
+}
+
+/********************
+ * benchmark_client *
+ ********************/
+
+// Unlike xeus_logger_client, does not log the messages and
+// reads the iopub socket on the calling thread, so that the
+// measures only include the kernel and the transport.
+class benchmark_client : public xeus_client_base
+{
+public:
+
+    using base_type = xeus_client_base;
+
+    benchmark_client(zmq::context_t& context, const xeus::xconfiguration& config);
+
+    // Sends a request on the shell channel and returns its msg_id
+    std::string send_request(const std::string& msg_type,
+                             nl::json content,
+                             xeus::buffer_sequence buffers = xeus::buffer_sequence());
+
+    // Reads iopub until the kernel is idle after the request msg_id,
+    // calling on_message for each message sent in reply to the request
+    template <class F>
+    void wait_for_idle(const std::string& msg_id, F&& on_message);
+    void wait_for_idle(const std::string& msg_id);
+
+    nl::json receive_reply();
+
+    void shutdown();
+};
+
+benchmark_client::benchmark_client(zmq::context_t& context, const xeus::xconfiguration& config)
+    : xeus_client_base(context, "benchmark", config)
+{
+    base_type::subscribe_iopub("");
+}
+
+std::string benchmark_client::send_request(const std::string& msg_type,
+                                           nl::json content,
+                                           xeus::buffer_sequence buffers)
+{
+    nl::json header = base_type::make_header(msg_type);
+    std::string msg_id = header["msg_id"];
+    base_type::send_on_shell(std::move(header),
+                             nl::json::object(),
+                             nl::json::object(),
+                             std::move(content),
+                             std::move(buffers));
+    return msg_id;
+}
+
+template <class F>
+void benchmark_client::wait_for_idle(const std::string& msg_id, F&& on_message)
+{
+    while (true)
+    {
+        nl::json msg = base_type::receive_on_iopub();
+        if (msg["parent_header"].value("msg_id", "") != msg_id)
+        {
+            continue;
+        }
+        if (msg["header"]["msg_type"] == "status" && msg["content"]["execution_state"] == "idle")
+        {
+            return;
+        }
+        on_message(msg);
+    }
+}
+
+void benchmark_client::wait_for_idle(const std::string& msg_id)
+{
+    wait_for_idle(msg_id, [](const nl::json&) {});
+}
+
+nl::json benchmark_client::receive_reply()
+{
+    return base_type::receive_on_shell();
+}
+
+void benchmark_client::shutdown()
+{
+    base_type::send_on_control(base_type::make_header("shutdown_request"),
+                               nl::json::object(),
+                               nl::json::object(),
+                               {{"restart", false}});
+    base_type::receive_on_control();
+}
+
+/**************
+ * benchmarks *
+ **************/
+
+nl::json make_execute_request(const std::string& code)
+{
+    return {
+        {"code", code},
+        {"silent", false},
+        {"store_history", true},
+        {"user_expressions", nl::json::object()},
+        {"allow_stdin", false}
+    };
+}
+
+double execute(benchmark_client& client, const std::string& code)
+{
+    auto start = clock_type::now();
+    std::string msg_id = client.send_request("execute_request", make_execute_request(code));
+    client.wait_for_idle(msg_id);
+    client.receive_reply();
+    return elapsed_ms(start);
+}
+
+nl::json benchmark_startup(benchmark_client& client, const std::string& kernel_command)
+{
+    auto start = clock_type::now();
+    std::thread kernel([kernel_command]()
+    {
+        std::string cmd = kernel_command + " -f " + KERNEL_JSON + "&";
+        int ret = std::system(cmd.c_str());
+        (void)ret;
+    });
+    kernel.detach();
+
+    // The request is queued by zmq until the kernel binds its sockets
+    client.send_request("kernel_info_request", nl::json::object());
+    client.receive_reply();
+    double startup = elapsed_ms(start);
+
+    return {{"kernel_info_reply_ms", startup}};
+}
+
+nl::json benchmark_execute(benchmark_client& client, std::size_t repeat)
+{
+    std::vector<double> samples;
+    for (std::size_t i = 0; i < repeat; ++i)
+    {
+        samples.push_back(execute(client, "a = 1"));
+    }
+    return summarize(samples);
+}
+
+nl::json benchmark_stream(benchmark_client& client, std::size_t lines)
+{
+    std::string code = "for i in range(" + std::to_string(lines) + "):\n    print('x' * 79)";
+    std::size_t messages = 0;
+    std::size_t bytes = 0;
+
+    auto start = clock_type::now();
+    std::string msg_id = client.send_request("execute_request", make_execute_request(code));
+    client.wait_for_idle(msg_id, [&messages, &bytes](const nl::json& msg)
+    {
+        if (msg["header"]["msg_type"] == "stream")
+        {
+            ++messages;
+            bytes += msg["content"]["text"].get<std::string>().size();
+        }
+    });
+    double elapsed = elapsed_ms(start);
+    client.receive_reply();
+
+    return {
+        {"lines", lines},
+        {"messages", messages},
+        {"bytes", bytes},
+        {"elapsed_ms", elapsed},
+        {"lines_per_s", static_cast<double>(lines) * 1000. / elapsed},
+        {"messages_per_s", static_cast<double>(messages) * 1000. / elapsed},
+        {"mb_per_s", static_cast<double>(bytes) / 1000. / elapsed}
+    };
+}
+
+nl::json benchmark_comm(benchmark_client& client, std::size_t repeat)
+{
+    execute(client, R"(
+def _benchmark_echo_target(comm, open_msg):
+    @comm.on_msg
+    def _echo(msg):
+        comm.send(msg['content']['data'], buffers=msg['buffers'])
+
+get_ipython().kernel.comm_manager.register_target('xpython_benchmark', _benchmark_echo_target)
+)");
+
+    std::string comm_id = "xpython-benchmark-comm";
+    std::string open_id = client.send_request("comm_open", {
+        {"comm_id", comm_id},
+        {"target_name", "xpython_benchmark"},
+        {"data", nl::json::object()}
+    });
+    client.wait_for_idle(open_id);
+
+    nl::json res = nl::json::object();
+    const std::vector<std::pair<std::string, std::size_t>> sizes = {
+        {"1KB", 1000},
+        {"1MB", 1000 * 1000},
+        {"100MB", 100 * 1000 * 1000}
+    };
+    for (const auto& size : sizes)
+    {
+        // The largest buffers are sent a few times only
+        std::size_t count = size.second > 10 * 1000 * 1000 ? std::min(repeat, std::size_t(3)) : repeat;
+        std::vector<double> samples;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            xeus::buffer_sequence buffers;
+            buffers.emplace_back(size.second);
+            auto start = clock_type::now();
+            std::string msg_id = client.send_request("comm_msg", {
+                {"comm_id", comm_id},
+                {"data", nl::json::object()}
+            }, std::move(buffers));
+            double sample = 0.;
+            client.wait_for_idle(msg_id, [&sample, &start](const nl::json& msg)
+            {
+                if (msg["header"]["msg_type"] == "comm_msg")
+                {
+                    sample = elapsed_ms(start);
+                }
+            });
+            samples.push_back(sample);
+        }
+        res[size.first] = summarize(samples);
+    }
+
+    std::string close_id = client.send_request("comm_close", {
+        {"comm_id", comm_id},
+        {"data", nl::json::object()}
+    });
+    client.wait_for_idle(close_id);
+    return res;
+}
+
+nl::json benchmark_complete(benchmark_client& client, std::size_t repeat)
+{
+    execute(client, "import os");
+    // Alternates between two unrelated requests, so
+    // that the completer cannot reuse a previous result
+    const std::vector<std::string> codes = {"os.pa", "pri"};
+    std::vector<double> samples;
+    for (std::size_t i = 0; i < repeat; ++i)
+    {
+        const std::string& code = codes[i % codes.size()];
+        auto start = clock_type::now();
+        std::string msg_id = client.send_request("complete_request", {
+            {"code", code},
+            {"cursor_pos", code.size()}
+        });
+        client.receive_reply();
+        samples.push_back(elapsed_ms(start));
+        client.wait_for_idle(msg_id);
+    }
+    return summarize(samples);
+}
+
+nl::json benchmark_traceback(benchmark_client& client, std::size_t repeat)
+{
+    execute(client, R"(
+def _benchmark_raise(n):
+    if n == 0:
+        raise ValueError('benchmark')
+    return _benchmark_raise(n - 1)
+
+def _benchmark_alternate(n):
+    return _benchmark_raise(n) if n % 2 else _benchmark_alternate(n - 1)
+)");
+
+    nl::json res = nl::json::object();
+    const std::vector<std::pair<std::string, std::string>> cells = {
+        {"depth_1", "_benchmark_raise(0)"},
+        {"depth_500", "_benchmark_raise(500)"},
+        {"depth_500_alternate", "_benchmark_alternate(501)"}
+    };
+    for (const auto& cell : cells)
+    {
+        std::vector<double> samples;
+        for (std::size_t i = 0; i < repeat; ++i)
+        {
+            samples.push_back(execute(client, cell.second));
+        }
+        res[cell.first] = summarize(samples);
+    }
+    return res;
+}
+
+/********
+ * main *
+ ********/
+
+std::string extract_option(int argc, char* argv[], const std::string& option, const std::string& default_value)
+{
+    for (int i = 0; i < argc - 1; ++i)
+    {
+        if (std::string(argv[i]) == option)
+        {
+            return argv[i + 1];
+        }
+    }
+    return default_value;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string kernel_command = extract_option(argc, argv, "--kernel", "xpython");
+    std::size_t repeat = static_cast<std::size_t>(std::stoul(extract_option(argc, argv, "--repeat", "50")));
+    std::string output = extract_option(argc, argv, "--output", "");
+
+    dump_connection_file();
+    zmq::context_t context;
+    nl::json results;
+    results["kernel"] = kernel_command;
+    {
+        benchmark_client client(context, xeus::load_configuration(KERNEL_JSON));
+        results["startup"] = benchmark_startup(client, kernel_command);
+
+        // Lets the iopub subscription reach the kernel and warms it up
+        std::this_thread::sleep_for(1s);
+        execute(client, "pass");
+
+        results["execute"] = benchmark_execute(client, repeat);
+        results["stream"] = benchmark_stream(client, 100000);
+        results["comm"] = benchmark_comm(client, repeat);
+        results["complete"] = benchmark_complete(client, repeat);
+        results["traceback"] = benchmark_traceback(client, std::max(repeat / 10, std::size_t(1)));
+
+        client.shutdown();
+    }
+
+    if (output.empty())
+    {
+        std::cout << results.dump(4) << std::endl;
+    }
+    else
+    {
+        std::ofstream out(output);
+        out << results.dump(4) << std::endl;
+    }
+    return 0;
+}
@@ -380,8 +380,10 @@ public:
     bool test_stack_trace();
     bool test_debug_info();
     bool test_inspect_variables();
+    bool test_lazy_inspect_variables();
     bool test_rich_inspect_variables();
     bool test_variables();
+    bool test_lazy_cell_filenames();
     void shutdown();
 
 private:
@@ -737,6 +739,41 @@ bool debugger_client::test_inspect_variables()
     return res;
 }
 
+bool debugger_client::test_lazy_inspect_variables()
+{
+    std::string code = "get_ipython().debugger_lazy_variables = True\nl = list(range(1000))\n";
+    m_client.send_on_shell("execute_request", make_execute_request(code));
+    m_client.receive_on_shell();
+
+    m_client.send_on_control("debug_request", make_inspect_variables_request(0));
+    nl::json rep = m_client.receive_on_control();
+
+    nl::json vars = rep["content"]["body"]["variables"];
+    auto x = std::find_if(vars.begin(), vars.end(), [](const nl::json& var) {
+        return var.is_object() && var.value("name", "") == "l";
+    });
+    if (x == vars.end())
+    {
+        return false;
+    }
+    nl::json var = *x;
+    int var_ref = var["variablesReference"].get<int>();
+    bool res = var_ref != 0 && var["length"] == 1000 && var["indexedVariables"] == 1000;
+
+    nl::json req = make_inspect_variables_request(1);
+    req["arguments"] = {
+        {"variablesReference", var_ref},
+        {"start", 10},
+        {"count", 5}
+    };
+    m_client.send_on_control("debug_request", req);
+    nl::json rep2 = m_client.receive_on_control();
+
+    nl::json children = rep2["content"]["body"]["variables"];
+    bool res2 = children.size() == 5 && children[0]["name"] == "10" && children[0]["value"] == "10";
+    return res && res2;
+}
+
 std::string rich_inspect_class_def = R"RICH(
 class Person:
     def __init__(self, name="John Doe", address="Paris", picture=""):
@@ -862,6 +899,43 @@ bool debugger_client::test_variables()
     return res;
 }
 
+bool debugger_client::test_lazy_cell_filenames()
+{
+    m_client.send_on_shell("execute_request", make_execute_request("get_ipython().lazy_cell_filenames = True"));
+    m_client.receive_on_shell();
+
+    // Defined before the debugger starts, in a cell named from the counter
+    std::string code = "def f():\n    i = 4\n    i += 4\n    return i";
+    m_client.send_on_shell("execute_request", make_execute_request(code));
+    m_client.receive_on_shell();
+
+    attach();
+
+    m_client.send_on_control("debug_request", make_dump_cell_request(4, code));
+    nl::json dump_res = m_client.receive_on_control();
+    std::string path = dump_res["content"]["body"]["sourcePath"].get<std::string>();
+    bool res = path.find("cell_") == std::string::npos;
+
+    m_client.send_on_control("debug_request", make_source_request(5, path));
+    nl::json source = m_client.receive_on_control();
+    res = source["content"]["body"]["content"] == code && res;
+
+    m_client.send_on_control("debug_request", make_breakpoint_request(6, path, 3));
+    m_client.receive_on_control();
+    m_client.send_on_control("debug_request", make_configuration_done_request(7));
+    m_client.receive_on_control();
+
+    // The breakpoint set in the hashed file applies to the earlier cell
+    m_client.send_on_shell("execute_request", make_execute_request("f()"));
+    nl::json ev = m_client.wait_for_debug_event("stopped");
+    int seq = ev["content"]["seq"].get<int>();
+    res = print_code_variable("4", seq) && res;
+
+    continue_exec(seq);
+    nl::json rep = m_client.receive_on_shell();
+    return rep["content"]["status"] == "ok" && res;
+}
+
 void debugger_client::shutdown()
 {
     m_client.send_on_control("shutdown_request", make_shutdown_request());
@@ -1226,6 +1300,21 @@ TEST(debugger, inspect_variables)
     }
 }
 
+TEST(debugger, lazy_inspect_variables)
+{
+    start_kernel();
+    start_timer();
+    zmq::context_t context;
+    {
+        debugger_client deb(context, KERNEL_JSON, "debugger_lazy_inspect_variables.log");
+        bool res = deb.test_lazy_inspect_variables();
+        deb.shutdown();
+        std::this_thread::sleep_for(2s);
+        EXPECT_TRUE(res);
+        notify_done();
+    }
+}
+
 TEST(debugger, rich_inspect_variables)
 {
     start_kernel();
@@ -1255,3 +1344,18 @@ TEST(debugger, variables)
         notify_done();
     }
 }
+
+TEST(debugger, lazy_cell_filenames)
+{
+    start_kernel();
+    start_timer();
+    zmq::context_t context;
+    {
+        debugger_client deb(context, KERNEL_JSON, "debugger_lazy_cell_filenames.log");
+        bool res = deb.test_lazy_cell_filenames();
+        deb.shutdown();
+        std::this_thread::sleep_for(2s);
+        EXPECT_TRUE(res);
+        notify_done();
+    }
+}
@@ -8,7 +8,11 @@
 # The full license is in the file LICENSE, distributed with this software.  #
 #############################################################################
 
+import importlib.util
+import subprocess
+import sys
 import tempfile
+import time
 import unittest
 import jupyter_kernel_test
 
@@ -38,11 +42,76 @@ class XeusPythonTests(jupyter_kernel_test.KernelTests):
         reply, output_msgs = self.execute_helper(code="assert get_ipython().history_manager is not None")
         self.assertEqual(reply['content']['status'], 'ok')
 
+    def test_xeus_python_history_request(self):
+        self.execute_helper(code="history_marker = 42")
+        self.kc.history(hist_access_type='tail', n=10, raw=True)
+        reply = self.kc.get_shell_msg(timeout=10)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertIn('history_marker = 42', [entry[2] for entry in reply['content']['history']])
+
+    def test_xeus_python_inspect_cache(self):
+        self.execute_helper(code="def inspected():\n    'first'")
+        self.kc.inspect('inspected', 9)
+        reply = self.kc.get_shell_msg(timeout=10)
+        self.assertIn('first', reply['content']['data']['text/plain'])
+        # Rebound by a background thread between two requests
+        code = (
+            "import threading, time\n"
+            "def rebound():\n"
+            "    'second'\n"
+            "def rebind():\n"
+            "    time.sleep(0.5)\n"
+            "    globals()['inspected'] = rebound\n"
+            "threading.Thread(target=rebind).start()"
+        )
+        self.execute_helper(code=code)
+        self.kc.inspect('inspected', 9)
+        self.kc.get_shell_msg(timeout=10)
+        time.sleep(1)
+        self.kc.inspect('inspected', 9)
+        reply = self.kc.get_shell_msg(timeout=10)
+        self.assertIn('second', reply['content']['data']['text/plain'])
+
+    def test_xeus_python_lazy_cell_filenames(self):
+        self.execute_helper(code="get_ipython().lazy_cell_filenames = True")
+        code = "import sys; print('cell_' in sys._getframe().f_code.co_filename)"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'True\n')
+        self.execute_helper(code="get_ipython().lazy_cell_filenames = False")
+
+    def test_xeus_python_cell_filename_eviction(self):
+        self.execute_helper(code="get_ipython().cell_filename_cache_size = 2")
+        self.execute_helper(code="import sys; first_cell_filename = sys._getframe().f_code.co_filename")
+        self.execute_helper(code="second_cell_value = 1")
+        code = "import linecache; print(first_cell_filename in linecache.cache, sys._getframe().f_code.co_filename in linecache.cache)"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'False True\n')
+        self.execute_helper(code="get_ipython().cell_filename_cache_size = 1000")
+
+    def test_xeus_python_input_history_size(self):
+        self.execute_helper(code="get_ipython().input_history_size = 5")
+        for i in range(20):
+            self.execute_helper(code="# " + 'a' * 10000)
+        code = (
+            "history_manager = get_ipython().history_manager\n"
+            "inputs = [name for name in globals() if name.startswith('_i') and name[2:].isdigit()]\n"
+            "print(sum(map(len, history_manager.input_hist_raw)) < 6 * 10100, len(inputs) <= 6, len(In) == len(_ih))"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'True True True\n')
+        self.execute_helper(code="get_ipython().input_history_size = 1000")
+
     def test_xeus_python_stdout(self):
         reply, output_msgs = self.execute_helper(code='print(3)')
         self.assertEqual(output_msgs[0]['msg_type'], 'stream')
         self.assertEqual(output_msgs[0]['content']['name'], 'stdout')
-        self.assertEqual(output_msgs[0]['content']['text'], '3')
+        self.assertEqual(output_msgs[0]['content']['text'], '3\n')
+
+    def test_xeus_python_stdout_coalescing(self):
+        reply, output_msgs = self.execute_helper(code='for i in range(100): print(i)')
+        self.assertEqual(len(output_msgs), 1)
+        self.assertEqual(output_msgs[0]['msg_type'], 'stream')
+        self.assertEqual(output_msgs[0]['content']['text'], ''.join('{}\n'.format(i) for i in range(100)))
 
     def test_xeus_python_stderr(self):
         reply, output_msgs = self.execute_helper(code='a = []; a.push_back(3)')
@@ -62,5 +131,336 @@ class XeusPythonTests(jupyter_kernel_test.KernelTests):
             traceback[3]
         )
 
+    def test_xeus_python_recursion_traceback(self):
+        reply, output_msgs = self.execute_helper(code='def f():\n    return f()\nf()')
+        self.assertEqual(output_msgs[0]['msg_type'], 'error')
+        self.assertEqual(output_msgs[0]['content']['ename'], 'RecursionError')
+        traceback = output_msgs[0]['content']['traceback']
+        self.assertLess(len(traceback), 10)
+        self.assertTrue("more times]" in traceback[-2])
+
+    def test_xeus_python_display_throttle(self):
+        self.execute_helper(code="get_ipython().display_throttle = True")
+        code = (
+            "h = display('frame 0', display_id=True)\n"
+            "for i in range(1, 100): h.update('frame {}'.format(i))"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        updates = [msg for msg in output_msgs if msg['msg_type'] == 'update_display_data']
+        self.assertLess(len(updates), 99)
+        self.assertEqual(updates[-1]['content']['data']['text/plain'], "'frame 99'")
+        self.execute_helper(code="get_ipython().display_throttle = False")
+
+    def test_xeus_python_display_throttle_clear(self):
+        self.execute_helper(code="get_ipython().display_throttle = True")
+        code = (
+            "from IPython.display import clear_output\n"
+            "for i in range(3):\n"
+            "    clear_output(wait=True)\n"
+            "    print('step', i)\n"
+            "    display('frame {}'.format(i))"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        # The prints are sent with the frame following the last clear
+        last_clear = max(i for i, msg in enumerate(output_msgs) if msg['msg_type'] == 'clear_output')
+        frame = output_msgs[last_clear + 1:]
+        self.assertEqual([msg['msg_type'] for msg in frame], ['stream', 'display_data'])
+        self.assertEqual(frame[0]['content']['text'], 'step 2\n')
+        self.assertEqual(frame[1]['content']['data']['text/plain'], "'frame 2'")
+        self.execute_helper(code="get_ipython().display_throttle = False")
+
+    def test_xeus_python_output_spill(self):
+        self.execute_helper(code="get_ipython().output_max_message_size = 1000")
+        reply, output_msgs = self.execute_helper(code="print('x' * 10000)")
+        text = output_msgs[0]['content']['text']
+        self.assertLess(len(text), 10000)
+        self.assertIn('spilled output', text)
+        code = (
+            "import xeus_python\n"
+            "output_id = max(xeus_python.spilled_outputs(), key=int)\n"
+            "print(len(xeus_python.read_spilled_output(output_id)))"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], '10001\n')
+        self.execute_helper(code="get_ipython().output_max_message_size = 0; xeus_python.clear_spilled_outputs()")
+
+    def test_xeus_python_output_cell_budget(self):
+        self.execute_helper(code="import sys, xeus_python; get_ipython().output_max_cell_size = 1000")
+        code = (
+            "print('a' * 600); sys.stdout.flush()\n"
+            "print('b' * 600); sys.stdout.flush()\n"
+            "print('c' * 600); sys.stdout.flush()"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        texts = [msg['content']['text'] for msg in output_msgs if msg['msg_type'] == 'stream']
+        self.assertEqual(texts[0], 'a' * 600 + '\n')
+        self.assertIn('Output budget of the cell exceeded', texts[1])
+        self.assertNotIn('c' * 10, ''.join(texts))
+        self.assertLessEqual(sum(len(text) for text in texts), 1000 + 200)
+        # The outputs following the overflow are appended to its spill file
+        code = "print(xeus_python.read_spilled_output(max(xeus_python.spilled_outputs(), key=int)) == b'b' * 600 + b'\\n' + b'c' * 600 + b'\\n')"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'True\n')
+        self.execute_helper(code="get_ipython().output_max_cell_size = 0; xeus_python.clear_spilled_outputs()")
+
+    def test_xeus_python_output_spill_size(self):
+        code = (
+            "import sys, xeus_python; xeus_python.clear_spilled_outputs()\n"
+            "get_ipython().output_max_message_size = 100; get_ipython().output_max_spill_size = 1500"
+        )
+        self.execute_helper(code=code)
+        self.execute_helper(code="print('x' * 1000); sys.stdout.flush(); print('y' * 1000)")
+        code = "outputs = xeus_python.spilled_outputs(); print(len(outputs), xeus_python.read_spilled_output(list(outputs)[0])[:1])"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], "1 b'y'\n")
+        code = (
+            "get_ipython().output_max_message_size = 0; get_ipython().output_max_spill_size = 1024 ** 3\n"
+            "xeus_python.clear_spilled_outputs()"
+        )
+        self.execute_helper(code=code)
+
+    def test_xeus_python_log_sink(self):
+        code = (
+            "import xeus_python\n"
+            "log = get_ipython().log; level = log.level; log.setLevel('INFO')\n"
+            "get_ipython().log_sample_rate = 2\n"
+            "for i in range(10): log.info('message %d', i)\n"
+            "get_ipython().log_sample_rate = 1; log.setLevel(level)\n"
+            "print(xeus_python.log_stats()['sampled_out'] >= 5)"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'True\n')
+
+    def test_xeus_python_resource_usage(self):
+        self.execute_helper(code="get_ipython().resource_accounting = 'basic'")
+        reply, output_msgs = self.execute_helper(code="sum(range(100000))")
+        self.assertGreaterEqual(reply['content']['resource_usage']['wall_time'], 0)
+        code = "import xeus_python; print(len(xeus_python.resource_usage(1)))"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], '1\n')
+        self.execute_helper(code="get_ipython().resource_accounting = 'none'; xeus_python.clear_resource_usage()")
+
+    def test_xeus_python_cell_timeout(self):
+        self.execute_helper(code="get_ipython().cell_timeout = 0.5")
+        reply, output_msgs = self.execute_helper(code="import time; time.sleep(30)", timeout=10)
+        self.assertEqual(reply['content']['status'], 'error')
+        self.assertEqual(reply['content']['ename'], 'KeyboardInterrupt')
+        self.execute_helper(code="get_ipython().cell_timeout = 0")
+
+    def test_xeus_python_metrics(self):
+        reply, output_msgs = self.execute_helper(code='import xeus_python; xeus_python.enable_metrics()')
+        self.assertEqual(reply['content']['status'], 'ok')
+        reply, output_msgs = self.execute_helper(code='a = 1')
+        reply, output_msgs = self.execute_helper(code='print(xeus_python.metrics()["metrics"]["run_cell"]["count"])')
+        self.assertEqual(output_msgs[0]['msg_type'], 'stream')
+        self.assertGreaterEqual(int(output_msgs[0]['content']['text']), 1)
+        self.execute_helper(code='xeus_python.enable_metrics(False)')
+
+    def test_xeus_python_subinterpreter(self):
+        reply, output_msgs = self.execute_helper(code="import xeus_python; print(xeus_python.subinterpreters_supported())")
+        supported = output_msgs[0]['content']['text'] == 'True\n'
+        self.execute_helper(code="get_ipython().subinterpreter_cells = True")
+        try:
+            reply, cell_msgs = self.execute_helper(code="%%subinterp test\nprint(6 * 7)")
+            if not supported:
+                self.assertEqual(reply['content']['status'], 'error')
+                self.assertEqual(reply['content']['ename'], 'UsageError')
+                return
+            streams = [msg['content'] for msg in cell_msgs if msg['msg_type'] == 'stream']
+            self.assertEqual(streams, [{'name': 'stdout', 'text': '42\n'}])
+            # The outputs of a background cell update a display of that cell,
+            # whichever cell is running when they are written
+            reply, cell_msgs = self.execute_helper(code="%%subinterp --background test\nimport time; time.sleep(1); 1 / 0")
+            self.assertFalse([msg for msg in cell_msgs if msg['msg_type'] == 'stream'])
+            displays = [msg['content'] for msg in cell_msgs if msg['msg_type'] == 'display_data']
+            display_id = displays[0]['transient']['display_id']
+            reply, wait_msgs = self.execute_helper(code="xeus_python.wait_subinterpreter('test', 10)")
+            self.assertFalse([msg for msg in wait_msgs if msg['msg_type'] == 'stream'])
+            updates = [msg['content'] for msg in wait_msgs if msg['msg_type'] == 'update_display_data']
+            while not any('ZeroDivisionError' in update['data']['text/plain'] for update in updates):
+                msg = self.kc.get_iopub_msg(timeout=10)
+                if msg['msg_type'] == 'update_display_data':
+                    updates.append(msg['content'])
+            self.assertTrue(all(update['transient']['display_id'] == display_id for update in updates))
+        finally:
+            self.execute_helper(code="get_ipython().subinterpreter_cells = False")
+
+    def test_xeus_python_asyncio_event_loop(self):
+        self.execute_helper(code="get_ipython().event_loop = 'asyncio'")
+        code = (
+            "import asyncio\n"
+            "ticks = []\n"
+            "async def tick():\n"
+            "    while True:\n"
+            "        ticks.append(1)\n"
+            "        await asyncio.sleep(0.01)\n"
+            "task = asyncio.ensure_future(tick())\n"
+            "await asyncio.sleep(0)"
+        )
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        # The task keeps running between the requests
+        time.sleep(0.5)
+        reply, output_msgs = self.execute_helper(code='print(len(ticks) > 5)')
+        self.assertEqual(output_msgs[0]['content']['text'], 'True\n')
+        self.execute_helper(code="task.cancel(); get_ipython().event_loop = 'none'")
+
+    def test_xeus_python_asyncio_event_loop_blocked(self):
+        code = (
+            "import asyncio, time\n"
+            "get_ipython().event_loop = 'asyncio'; get_ipython().event_loop_suspend_timeout = 0.5"
+        )
+        self.execute_helper(code=code)
+        self.execute_helper(code="asyncio.get_event_loop().call_soon(time.sleep, 3)")
+        reply, output_msgs = self.execute_helper(code="print('run')")
+        self.assertEqual(reply['content']['status'], 'error')
+        self.assertEqual(reply['content']['ename'], 'RuntimeError')
+        time.sleep(3)
+        reply, output_msgs = self.execute_helper(code="print('run')")
+        self.assertEqual(output_msgs[0]['content']['text'], 'run\n')
+        self.execute_helper(code="get_ipython().event_loop = 'none'; get_ipython().event_loop_suspend_timeout = 10.0")
+
+    def test_xeus_python_output_cache_budget(self):
+        self.execute_helper(code="get_ipython().displayhook.output_cache_budget = 10000")
+        self.execute_helper(code="bytearray(8000)")
+        self.execute_helper(code="bytearray(8000)")
+        reply, output_msgs = self.execute_helper(code="import xeus_python; print(xeus_python.output_cache_stats()['evictions'])")
+        self.assertGreaterEqual(int(output_msgs[0]['content']['text']), 1)
+        self.execute_helper(code="get_ipython().displayhook.output_cache_budget = 0")
+
+    def test_xeus_python_comm_batch_interval(self):
+        code = (
+            "import time\n"
+            "from ipykernel.comm import Comm\n"
+            "get_ipython().kernel.comm_manager.register_target('xeus_python_test_batch', lambda comm, msg: None)\n"
+            "get_ipython().comm_batch_interval = 0.5"
+        )
+        self.execute_helper(code=code)
+        code = (
+            "comm = Comm(target_name='xeus_python_test_batch')\n"
+            "for i in range(10): comm.send({'method': 'update', 'state': {'value': i}})\n"
+            "comm.send({'method': 'update', 'state': {'other': 1}})\n"
+            "time.sleep(1)\n"
+            "comm.send({'method': 'update', 'state': {'value': 10}})\n"
+            "unbatched = Comm(target_name='xeus_python_test_batch', batch=False)\n"
+            "for i in range(3): unbatched.send({'method': 'update', 'state': {'value': i}})"
+        )
+        msg_id = self.kc.execute(code)
+        reply = self.kc.get_shell_msg(timeout=10)
+        self.assertEqual(reply['content']['status'], 'ok')
+        comm_msgs = [msg['content'] for msg in self._get_output_msgs(msg_id) if msg['msg_type'] == 'comm_msg']
+        comm_ids = []
+        for content in comm_msgs:
+            if content['comm_id'] not in comm_ids:
+                comm_ids.append(content['comm_id'])
+        self.assertEqual(len(comm_ids), 2)
+        # The updates of the window are merged, the later values winning
+        states = [content['data']['state'] for content in comm_msgs if content['comm_id'] == comm_ids[0]]
+        self.assertEqual(states, [{'value': 9, 'other': 1}, {'value': 10}])
+        states = [content['data']['state'] for content in comm_msgs if content['comm_id'] == comm_ids[1]]
+        self.assertEqual(states, [{'value': 0}, {'value': 1}, {'value': 2}])
+        self.execute_helper(code="get_ipython().comm_batch_interval = 0")
+
+    def _execute_with_input(self, code, answer, interrupt=False):
+        msg_id = self.kc.execute(code, allow_stdin=True)
+        request = self.kc.get_stdin_msg(timeout=10)
+        self.assertEqual(request['msg_type'], 'input_request')
+        if interrupt:
+            # The cell returns without waiting for the reply, which is sent
+            # once the cell ended
+            self.km.interrupt_kernel()
+            reply = self.kc.get_shell_msg(timeout=10)
+            self.kc.input(answer)
+        else:
+            self.kc.input(answer)
+            reply = self.kc.get_shell_msg(timeout=10)
+        self.assertEqual(reply['parent_header']['msg_id'], msg_id)
+        return reply, self._get_output_msgs(msg_id)
+
+    def _get_output_msgs(self, msg_id):
+        output_msgs = []
+        while True:
+            msg = self.kc.get_iopub_msg(timeout=10)
+            if msg['parent_header'].get('msg_id') != msg_id:
+                continue
+            if msg['msg_type'] == 'status' and msg['content']['execution_state'] == 'idle':
+                return output_msgs
+            if msg['msg_type'] != 'status':
+                output_msgs.append(msg)
+
+    def test_xeus_python_input_interrupt(self):
+        # The reply to the interrupted request is dropped
+        reply, output_msgs = self._execute_with_input("value = input('first')", 'stale', interrupt=True)
+        self.assertEqual(reply['content']['status'], 'error')
+        self.assertEqual(reply['content']['ename'], 'KeyboardInterrupt')
+        # The next request receives its own reply
+        reply, output_msgs = self._execute_with_input("print(input('second'))", 'fresh')
+        self.assertEqual(reply['content']['status'], 'ok')
+        streams = [msg['content']['text'] for msg in output_msgs if msg['msg_type'] == 'stream']
+        self.assertEqual(''.join(streams), 'fresh\n')
+
+    def test_xeus_python_interrupt_handled(self):
+        # An interrupt delivered to Python and handled by the cell is not
+        # injected again after the escalation delay
+        self.execute_helper(code="get_ipython().interrupt_escalation_delay = 1.0")
+        code = (
+            "import time\n"
+            "try:\n"
+            "    time.sleep(10)\n"
+            "except KeyboardInterrupt:\n"
+            "    time.sleep(2)\n"
+            "    print('handled')"
+        )
+        msg_id = self.kc.execute(code)
+        time.sleep(1)
+        self.km.interrupt_kernel()
+        reply = self.kc.get_shell_msg(timeout=20)
+        self.assertEqual(reply['parent_header']['msg_id'], msg_id)
+        self.assertEqual(reply['content']['status'], 'ok')
+        streams = [msg['content']['text'] for msg in self._get_output_msgs(msg_id) if msg['msg_type'] == 'stream']
+        self.assertEqual(''.join(streams), 'handled\n')
+        self.execute_helper(code="get_ipython().interrupt_escalation_delay = 0.0")
+
+
+@unittest.skipIf(importlib.util.find_spec('xpython_extension') is None, 'the Python extension is not installed')
+class XeusPythonExtensionTests(unittest.TestCase):
+
+    # The kernel shares the interpreter of its host, which is run in a
+    # subprocess. The prints of the host go to the kernel until it stops.
+    start_code = (
+        "import sys, jupyter_client, xpython_extension\n"
+        "kernel = xpython_extension.start_kernel(background=True)\n"
+        "client = jupyter_client.BlockingKernelClient()\n"
+        "client.load_connection_info(kernel.connection_info)\n"
+        "client.start_channels()\n"
+        "client.wait_for_ready(timeout=30)\n"
+        "texts = []\n"
+        "def output_hook(msg):\n"
+        "    if msg['msg_type'] == 'stream':\n"
+        "        texts.append(msg['content']['text'])\n"
+        "reply = client.execute_interactive('print(6 * 7)', timeout=30, output_hook=output_hook)\n"
+    )
+
+    def _run_host(self, code):
+        return subprocess.run([sys.executable, '-c', code], stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                              universal_newlines=True, timeout=120)
+
+    def test_xeus_python_extension_stop(self):
+        code = self.start_code + (
+            "client.stop_channels()\n"
+            "kernel.stop(timeout=30)\n"
+            "print(reply['content']['status'], ''.join(texts).strip(), kernel.is_alive())"
+        )
+        result = self._run_host(code)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertEqual(result.stdout, 'ok 42 False\n')
+
+    def test_xeus_python_extension_exit(self):
+        # The kernel still running at exit is stopped before the finalization
+        code = self.start_code + "client.stop_channels()\n"
+        result = self._run_host(code)
+        self.assertEqual(result.returncode, 0, result.stderr)
+
+
 if __name__ == '__main__':
     unittest.main()
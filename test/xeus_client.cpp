@@ -60,12 +60,14 @@ xeus_client_base::~xeus_client_base()
 void xeus_client_base::send_on_shell(nl::json header,
                                      nl::json parent_header,
                                      nl::json metadata,
-                                     nl::json content)
+                                     nl::json content,
+                                     xeus::buffer_sequence buffers)
 {
     send_message(std::move(header),
                  std::move(parent_header),
                  std::move(metadata),
                  std::move(content),
+                 std::move(buffers),
                  m_shell,
                  *p_shell_authentication);
 }
@@ -84,6 +86,7 @@ void xeus_client_base::send_on_control(nl::json header,
                  std::move(parent_header),
                  std::move(metadata),
                  std::move(content),
+                 xeus::buffer_sequence(),
                  m_control,
                  *p_control_authentication);
 }
@@ -127,6 +130,7 @@ void xeus_client_base::send_message(nl::json header,
                                     nl::json parent_header,
                                     nl::json metadata,
                                     nl::json content,
+                                    xeus::buffer_sequence buffers,
                                     zmq::socket_t& socket,
                                     const xeus::xauthentication& auth)
 {
@@ -136,7 +140,7 @@ void xeus_client_base::send_message(nl::json header,
                        std::move(parent_header),
                        std::move(metadata),
                        std::move(content),
-                       xeus::buffer_sequence());
+                       std::move(buffers));
     std::move(msg).serialize(wire_msg, auth);
     wire_msg.send(socket);
 }
@@ -17,6 +17,7 @@
 #include "nlohmann/json.hpp"
 #include "xeus/xauthentication.hpp"
 #include "xeus/xkernel_configuration.hpp"
+#include "xeus/xmessage.hpp"
 
 // Base class for clients, provides an API to 
 // send and receive messages, but nothing more ;)
@@ -41,7 +42,8 @@ protected:
     void send_on_shell(nl::json header,
                        nl::json parent_header,
                        nl::json metadata,
-                       nl::json content);
+                       nl::json content,
+                       xeus::buffer_sequence buffers = xeus::buffer_sequence());
     nl::json receive_on_shell();
 
     void send_on_control(nl::json header,
@@ -64,6 +66,7 @@ private:
                       nl::json parent_header,
                       nl::json metadata,
                       nl::json content,
+                      xeus::buffer_sequence buffers,
                       zmq::socket_t& socket,
                       const xeus::xauthentication& auth);
 